@@ -0,0 +1,834 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "bench.h"
+#include "crypto.h"
+#include "codebook.h"
+#include "isa.h"
+#include "memory.h"
+#include "cpu_pipe.h"
+#include "cpu_fast.h"
+#include "machine.h"
+#include "workpool.h"
+#include "input.h"
+#include "cache.h"
+
+void init_cpu(CpuState *cpu);
+void step_single(Machine *m, CpuState *cpu);
+void build_streaming_program(Machine *m);
+void build_vector_streaming_program(Machine *m);
+void build_ctr_streaming_program(Machine *m);
+void set_chunk_counters(Machine *m, int blocks, uint16_t ctr);
+int load_chunk_words(Machine *m, uint16_t k0, uint16_t k1, const uint16_t *words, int blocks, uint32_t mem_words);
+uint32_t chunk_word_addr(int blocks, int i, int cipher);
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Two passes per layout: a dependent chain (latency, as the simulators see it,
+// one ENC/DEC at a time) and independent blocks from a buffer (throughput).
+// The chain runs both on a precomputed key schedule (what the CPUs do) and
+// through enc_func, which derives the schedule on every call.
+static int bench_crypto(void) {
+    const long n = 1L << 24;
+    const uint16_t k0 = 0x7368, k1 = 0xA5C3;
+    static uint16_t buf[1 << 16];
+    KeySchedule ks;
+    key_schedule_init(&ks, k0, k1);
+
+    long bad = crypto_self_test();
+    printf("crypto self-test: %s (%ld mismatches over 65536 inputs)\n", bad ? "FAIL" : "PASS", bad);
+
+    SboxLayout saved = crypto_get_layout();
+    for (int l = 0; l < SBOX_LAYOUT_COUNT; l++) {
+        crypto_set_layout((SboxLayout)l);
+        uint16_t x = 0x1234;
+        double t0 = now_sec();
+        for (long i = 0; i < n; i++) x = enc_func_ks((uint16_t)(x + i), &ks);
+        double t1 = now_sec();
+        for (long i = 0; i < n; i++) x = dec_func_ks((uint16_t)(x + i), &ks);
+        double t2 = now_sec();
+        for (long base = 0; base < n; base += 1 << 16) {
+            for (int i = 0; i < 1 << 16; i++) buf[i] = enc_func_ks((uint16_t)(base + i * 40503), &ks);
+            x ^= buf[base & 0xFFFF];
+        }
+        double t3 = now_sec();
+        for (long i = 0; i < n; i++) x = enc_func((uint16_t)(x + i), k0, k1);
+        double t4 = now_sec();
+        printf("  %-6s chain enc %7.2f dec %7.2f (enc_func %7.2f)  |  stream enc %7.2f Mblocks/s  (sink=%04X)\n",
+               crypto_layout_name((SboxLayout)l),
+               n / (t1 - t0) / 1e6, n / (t2 - t1) / 1e6, n / (t4 - t3) / 1e6, n / (t3 - t2) / 1e6, x);
+    }
+    crypto_set_layout(saved);
+    return bad ? 1 : 0;
+}
+
+// One sim worker's first codebook, built while the other workers build theirs
+typedef struct {
+    uint16_t k0, k1;
+    long bad;
+    pthread_t tid;
+} CodebookJob;
+
+static void *codebook_job(void *arg) {
+    CodebookJob *j = arg;
+    CodebookCache cc;
+    codebook_init(&cc);
+    codebook_set_enabled(&cc, 1);
+    const Codebook *cb = codebook_get(&cc, j->k0, j->k1);
+    j->bad = cb ? 0 : 1;
+    for (uint32_t x = 0; cb && x < 65536; x++) {
+        if (cb->fwd[x] != enc_func((uint16_t)x, j->k0, j->k1)) j->bad++;
+    }
+    codebook_free(&cc);
+    return NULL;
+}
+
+// Codebook lookups vs direct enc_func_ks, and the number of lookups needed to
+// amortise one table build.
+static int bench_codebook(void) {
+    const long n = 1L << 24;
+    const uint16_t k0 = 0x7368, k1 = 0xA5C3;
+    CodebookCache cc;
+    KeySchedule ks;
+    long bad = 0;
+    key_schedule_init(&ks, k0, k1);
+
+    // Concurrent first builds (-j N --codebook): the batch kernel is chosen
+    // by whichever thread gets there first
+    enum { JOBS = 4 };
+    CodebookJob jobs[JOBS];
+    int started = 0;
+    for (int i = 0; i < JOBS; i++) {
+        jobs[i] = (CodebookJob){ .k0 = (uint16_t)(k0 + i), .k1 = (uint16_t)(k1 ^ (i << 8)) };
+        if (pthread_create(&jobs[i].tid, NULL, codebook_job, &jobs[i]) != 0) break;
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(jobs[i].tid, NULL);
+        bad += jobs[i].bad;
+    }
+    bad += started != JOBS;
+
+    codebook_init(&cc);
+    codebook_set_enabled(&cc, 1);
+    const Codebook *cb = codebook_get(&cc, k0, k1);
+    for (uint32_t x = 0; cb && x < 65536; x++) {
+        if (cb->fwd[x] != enc_func((uint16_t)x, k0, k1)) bad++;
+        if (cb->inv[cb->fwd[x]] != x) bad++;
+    }
+    printf("codebook check: %s (%ld mismatches)\n", bad ? "FAIL" : "PASS", bad);
+
+    uint16_t x = 0x1234;
+    double t0 = now_sec();
+    for (long i = 0; i < n; i++) x = enc_func_ks((uint16_t)(x + i), &ks);
+    double t1 = now_sec();
+    for (long i = 0; i < n; i++) x = codebook_enc(&cc, (uint16_t)(x + i), &ks);
+    double t2 = now_sec();
+
+    CodebookStats st;
+    codebook_get_stats(&cc, &st);
+    double direct_ns = (t1 - t0) * 1e9 / n;
+    double cached_ns = (t2 - t1) * 1e9 / n;
+    printf("  enc_func_ks  %6.2f ns/block\n", direct_ns);
+    printf("  codebook_enc %6.2f ns/block (sink=%04X)\n", cached_ns, x);
+    if (direct_ns > cached_ns) {
+        printf("  build %.3f ms -> pays off after ~%.0f blocks per key pair\n",
+               st.build_sec * 1e3, st.build_sec * 1e9 / (direct_ns - cached_ns));
+    }
+    codebook_print_stats(&st);
+    codebook_free(&cc);
+    return bad ? 1 : 0;
+}
+
+// Batch kernels: correctness against enc_func, then blocks/sec for each kernel
+static int bench_batch(void) {
+    const size_t n = 1 << 16;
+    const int reps = 512;
+    const uint16_t k0 = 0x7368, k1 = 0xA5C3;
+    static uint16_t in[1 << 16], out[1 << 16];
+
+    long bad = crypto_batch_self_test();
+    printf("batch self-test: %s (%ld mismatches)\n", bad ? "FAIL" : "PASS", bad);
+
+    for (size_t i = 0; i < n; i++) in[i] = (uint16_t)(i * 40503u);
+    CryptoImpl saved = crypto_batch_impl();
+    for (int i = 0; i < CRYPTO_IMPL_COUNT; i++) {
+        if (!crypto_set_batch_impl((CryptoImpl)i)) {
+            printf("  %-6s not supported on this CPU\n", crypto_impl_name((CryptoImpl)i));
+            continue;
+        }
+        double t0 = now_sec();
+        for (int r = 0; r < reps; r++) enc_blocks(in, out, n, k0, (uint16_t)(k1 + r));
+        double t1 = now_sec();
+        for (int r = 0; r < reps; r++) dec_blocks(in, out, n, k0, (uint16_t)(k1 + r));
+        double t2 = now_sec();
+        double blocks = (double)n * reps;
+        printf("  %-6s enc %8.1f Mblocks/s  dec %8.1f Mblocks/s  (%.1f MB/s)\n",
+               crypto_impl_name((CryptoImpl)i),
+               blocks / (t1 - t0) / 1e6, blocks / (t2 - t1) / 1e6, 2.0 * blocks / (t1 - t0) / 1e6);
+    }
+    crypto_set_batch_impl(saved);
+    printf("  runtime choice: %s\n", crypto_impl_name(saved));
+
+    // Key agility: the same buffer as runs of `len` blocks cycling through 8 key
+    // schedules, against one fixed key over the whole buffer
+    enum { KEYS = 8 };
+    static const size_t LENS[] = { 16, 64, 256, 4096 };
+    static KeySpan spans[(1 << 16) / 16];
+    KeySchedule ks[KEYS];
+    for (int k = 0; k < KEYS; k++) key_schedule_init(&ks[k], (uint16_t)(k0 + k * 0x1111), (uint16_t)(k1 ^ (k << 4)));
+    double t0 = now_sec();
+    for (int r = 0; r < reps; r++) enc_blocks_ks(in, out, n, &ks[r % KEYS]);
+    double fixed = (double)n * reps / (now_sec() - t0) / 1e6;
+    printf("  key-agile (%s, %d keys): fixed key %8.1f Mblocks/s", crypto_impl_name(saved), KEYS, fixed);
+    for (size_t l = 0; l < sizeof(LENS) / sizeof(LENS[0]); l++) {
+        size_t count = n / LENS[l];
+        for (size_t s = 0; s < count; s++) spans[s] = (KeySpan){ .ks = &ks[s % KEYS], .n = LENS[l] };
+        t0 = now_sec();
+        for (int r = 0; r < reps; r++) enc_blocks_spans(in, out, spans, count);
+        double agile = (double)n * reps / (now_sec() - t0) / 1e6;
+        printf("  | %zu-block runs %8.1f (%3.0f%%)", LENS[l], agile, 100.0 * agile / fixed);
+    }
+    printf("\n");
+    return bad ? 1 : 0;
+}
+
+// Simulated cycles per host second for both CPU models on the streaming program
+// (no tracing, no per-cycle printing). The threaded engine must reproduce the
+// switch engine's cycle count, final registers and data memory exactly.
+static int bench_sim(void) {
+    enum { BLOCKS = 200000 };
+    static uint16_t words[BLOCKS];
+    for (int i = 0; i < BLOCKS; i++) words[i] = (uint16_t)(i * 40503u);
+    long max_cycles = (32L + 2L * CRYPTO_MAX_LATENCY) * BLOCKS + 4096;
+    int bad = 0;
+    Machine *m = machine_create(0);
+    if (!m) return 1;
+    build_streaming_program(m);
+
+    load_chunk_words(m, 0x7368, 0x6572, words, BLOCKS, DATA_MEM_DEFAULT_WORDS);
+    CpuState cpu;
+    init_cpu(&cpu);
+    long sc_cycles = 0;
+    double t0 = now_sec();
+    while (cpu.PC < m->program_size && sc_cycles < max_cycles) {
+        step_single(m, &cpu);
+        sc_cycles++;
+    }
+    double t1 = now_sec();
+    uint32_t mem_words = m->data_mem_size;
+    uint16_t *ref_mem = malloc((size_t)mem_words * sizeof(uint16_t));
+    if (ref_mem) memcpy(ref_mem, m->data_mem, (size_t)mem_words * sizeof(uint16_t));
+
+    // Threaded engine without and with superinstruction fusion
+    long fast_cycles[2];
+    double fast_sec[2];
+    for (int fuse = 0; fuse < 2; fuse++) {
+        load_chunk_words(m, 0x7368, 0x6572, words, BLOCKS, DATA_MEM_DEFAULT_WORDS);
+        single_fast_set_fusion(m, fuse);
+        CpuState fast;
+        init_cpu(&fast);
+        double ta = now_sec();
+        fast_cycles[fuse] = run_single_fast(m, &fast, max_cycles);
+        fast_sec[fuse] = now_sec() - ta;
+        if (fast_cycles[fuse] != sc_cycles || memcmp(&fast, &cpu, sizeof(cpu)) != 0 ||
+            (ref_mem && memcmp(ref_mem, m->data_mem, (size_t)mem_words * sizeof(uint16_t)) != 0)) {
+            bad = 1;
+        }
+    }
+
+    // A budget that stops mid-loop must leave identical state in every engine
+    const long cut = 1234567;
+    CpuState cut_ref, cut_fast;
+    load_chunk_words(m, 0x7368, 0x6572, words, BLOCKS, DATA_MEM_DEFAULT_WORDS);
+    init_cpu(&cut_ref);
+    long cut_cycles = 0;
+    while (cut_ref.PC < m->program_size && cut_cycles < cut) { step_single(m, &cut_ref); cut_cycles++; }
+    if (ref_mem) memcpy(ref_mem, m->data_mem, (size_t)mem_words * sizeof(uint16_t));
+    load_chunk_words(m, 0x7368, 0x6572, words, BLOCKS, DATA_MEM_DEFAULT_WORDS);
+    init_cpu(&cut_fast);
+    if (run_single_fast(m, &cut_fast, cut) != cut_cycles || memcmp(&cut_fast, &cut_ref, sizeof(cut_ref)) != 0 ||
+        (ref_mem && memcmp(ref_mem, m->data_mem, (size_t)mem_words * sizeof(uint16_t)) != 0)) {
+        bad = 1;
+    }
+
+    // Pipeline with each predictor, then with other crypto units, then dual
+    // issue: same final registers and memory as the single-cycle run
+    static const struct { BpKind bp; CryptoUnitKind unit; int latency; int width; } PIPE_RUNS[] = {
+        { BP_NONE, CRYPTO_UNIT_PIPELINED, 4, 1 }, { BP_BTFN, CRYPTO_UNIT_PIPELINED, 4, 1 },
+        { BP_BIMODAL, CRYPTO_UNIT_PIPELINED, 4, 1 }, { BP_BTB, CRYPTO_UNIT_PIPELINED, 4, 1 },
+        { BP_BIMODAL, CRYPTO_UNIT_PIPELINED, 1, 1 }, { BP_BIMODAL, CRYPTO_UNIT_ITERATIVE, 4, 1 },
+        { BP_BIMODAL, CRYPTO_UNIT_PIPELINED, 8, 1 }, { BP_BIMODAL, CRYPTO_UNIT_ITERATIVE, 8, 1 },
+        { BP_BIMODAL, CRYPTO_UNIT_PIPELINED, 4, 2 }, { BP_BIMODAL, CRYPTO_UNIT_PIPELINED, 1, 2 },
+        { BP_NONE, CRYPTO_UNIT_ITERATIVE, 8, 2 },
+    };
+    enum { NRUNS = sizeof(PIPE_RUNS) / sizeof(PIPE_RUNS[0]) };
+    load_chunk_words(m, 0x7368, 0x6572, words, BLOCKS, DATA_MEM_DEFAULT_WORDS);
+    init_cpu(&cpu);
+    run_single_fast(m, &cpu, max_cycles);
+    if (ref_mem) memcpy(ref_mem, m->data_mem, (size_t)mem_words * sizeof(uint16_t));
+    PipeCounters pl_ctr[NRUNS];
+    double pl_sec[NRUNS];
+    int pl_bad = 0;
+    for (int k = 0; k < NRUNS; k++) {
+        load_chunk_words(m, 0x7368, 0x6572, words, BLOCKS, DATA_MEM_DEFAULT_WORDS);
+        m->bp_kind = PIPE_RUNS[k].bp;
+        m->crypto_kind = PIPE_RUNS[k].unit;
+        m->crypto_latency = PIPE_RUNS[k].latency;
+        m->issue_width = PIPE_RUNS[k].width;
+        double ta = now_sec();
+        machine_run_pipeline(m, max_cycles, NULL);
+        pl_sec[k] = now_sec() - ta;
+        pl_ctr[k] = *machine_pipe_counters(m);
+        const CpuState *core = machine_pipe_core(m);
+        if (memcmp(core->R, cpu.R, sizeof(cpu.R)) != 0 || core->K0 != cpu.K0 || core->K1 != cpu.K1 ||
+            core->DB != cpu.DB ||
+            (ref_mem && memcmp(ref_mem, m->data_mem, (size_t)mem_words * sizeof(uint16_t)) != 0)) {
+            pl_bad = 1;
+        }
+    }
+    free(ref_mem);
+
+    // With the iterative unit the program stalls on both the LDP -> ENC/DEC load-use
+    // and the crypto unit. The stalled flag that --trace-trigger load-use reads
+    // must be set on load-use stalls only.
+    m->bp_kind = BP_BIMODAL;
+    m->crypto_kind = CRYPTO_UNIT_ITERATIVE;
+    m->crypto_latency = CRYPTO_MAX_LATENCY;
+    PipeCounters lu_ctr[ISSUE_WIDTH_MAX];
+    long lu_flagged[ISSUE_WIDTH_MAX];
+    int lu_bad = 0;
+    for (int w = 0; w < ISSUE_WIDTH_MAX; w++) {
+        load_chunk_words(m, 0x7368, 0x6572, words, BLOCKS, DATA_MEM_DEFAULT_WORDS);
+        long flagged = 0, cycles = 0;
+        if (w == 0) {
+            init_pipe_cpu(&m->pipe);
+            while ((m->pipe.core.PC < m->program_size || !pipeline_empty(&m->pipe)) && cycles++ < max_cycles) {
+                step_pipe(m, &m->pipe);
+                flagged += m->pipe.stalled != 0;
+            }
+            lu_ctr[w] = m->pipe.ctr;
+        } else {
+            init_dual_pipe_cpu(&m->dual);
+            while ((m->dual.core.PC < m->program_size || !dual_pipeline_empty(&m->dual)) && cycles++ < max_cycles) {
+                step_dual_pipe(m, &m->dual);
+                flagged += m->dual.stalled != 0;
+            }
+            lu_ctr[w] = m->dual.ctr;
+        }
+        lu_flagged[w] = flagged;
+        const PipeCounters *c = &lu_ctr[w];
+        if (c->load_use_stalls == 0 || c->crypto_dep_stalls + c->crypto_struct_stalls == 0 ||
+            (uint64_t)flagged != c->load_use_stalls) {
+            lu_bad = 1;
+        }
+    }
+
+    printf("streaming program, %d blocks\n", BLOCKS);
+    printf("  single-cycle (switch):   %ld cycles in %.3f s = %7.2f MIPS\n", sc_cycles, t1 - t0, sc_cycles / (t1 - t0) / 1e6);
+    printf("  single-cycle (threaded): %ld cycles in %.3f s = %7.2f MIPS\n", fast_cycles[0], fast_sec[0],
+           fast_cycles[0] / fast_sec[0] / 1e6);
+    printf("  single-cycle (fused):    %ld cycles in %.3f s = %7.2f MIPS  (%d superinstructions)\n", fast_cycles[1], fast_sec[1],
+           fast_cycles[1] / fast_sec[1] / 1e6, single_fast_superinstructions(m));
+    printf("  engines agree on cycles, registers and memory: %s\n", bad ? "NO (MISMATCH)" : "yes");
+    for (int k = 0; k < NRUNS; k++) {
+        const PipeCounters *c = &pl_ctr[k];
+        printf("  pipeline x%d (bp=%-7s crypto=%s/%d): %llu cycles CPI=%.3f mispredicts=%llu/%llu crypto stalls=%llu+%llu "
+               "in %.3f s = %6.2f Mcycles/s\n",
+               PIPE_RUNS[k].width, bp_kind_name(PIPE_RUNS[k].bp), crypto_unit_name(PIPE_RUNS[k].unit), PIPE_RUNS[k].latency,
+               (unsigned long long)c->cycles, (double)c->cycles / (double)c->retired,
+               (unsigned long long)c->mispredicts, (unsigned long long)c->branches,
+               (unsigned long long)c->crypto_dep_stalls, (unsigned long long)c->crypto_struct_stalls, pl_sec[k],
+               (double)c->cycles / pl_sec[k] / 1e6);
+        if (PIPE_RUNS[k].width > 1) {
+            printf("      IPC=%.3f pairs=%llu unpaired: dep=%llu struct=%llu ctrl=%llu stall=%llu\n",
+                   (double)c->retired / (double)c->cycles, (unsigned long long)c->issue_pairs,
+                   (unsigned long long)c->pair_dep_fails, (unsigned long long)c->pair_struct_fails,
+                   (unsigned long long)c->pair_ctrl_fails, (unsigned long long)c->pair_stall_fails);
+        }
+    }
+    printf("  pipeline matches single-cycle registers and memory: %s\n", pl_bad ? "NO (MISMATCH)" : "yes");
+    for (int w = 0; w < ISSUE_WIDTH_MAX; w++) {
+        const PipeCounters *c = &lu_ctr[w];
+        printf("  pipeline x%d (crypto=iterative/%d): load-use stalls %llu, crypto stalls %llu, load-use flag set %ld times\n",
+               w + 1, CRYPTO_MAX_LATENCY, (unsigned long long)c->load_use_stalls,
+               (unsigned long long)(c->crypto_dep_stalls + c->crypto_struct_stalls), lu_flagged[w]);
+    }
+    printf("  load-use flag set on load-use stalls only: %s\n", lu_bad ? "NO (MISMATCH)" : "yes");
+    bad |= pl_bad | lu_bad;
+    machine_destroy(m);
+    return bad;
+}
+
+// Simulated cycles per block of the scalar streaming program against the
+// vectorised one at 4, 8 and 16 lanes, on both CPU models (pipeline with its
+// default predictor and crypto unit, single and dual issue). Every run must
+// leave the same ciphertext and decrypted text as the scalar single-cycle run.
+static int bench_vector(void) {
+    enum { BLOCKS = 200000, SIMS = 3 };   // single-cycle, pipeline, dual-issue pipeline
+    static const int WIDTHS[] = { 0, 4, 8, 16 };   // 0 = scalar program
+    static uint16_t words[BLOCKS], ref[2][BLOCKS], got[BLOCKS];
+    for (int i = 0; i < BLOCKS; i++) words[i] = (uint16_t)(i * 40503u);
+    long max_cycles = (32L + 2L * CRYPTO_MAX_LATENCY) * BLOCKS + 4096;
+    int bad = 0;
+    Machine *m = machine_create(0);
+    if (!m) return 1;
+
+    printf("streaming program, %d blocks (cycles per block)\n", BLOCKS);
+    double base[SIMS] = {0};
+    for (size_t w = 0; w < sizeof(WIDTHS) / sizeof(WIDTHS[0]); w++) {
+        if (WIDTHS[w]) {
+            m->vlen = WIDTHS[w];
+            build_vector_streaming_program(m);
+        } else {
+            build_streaming_program(m);
+        }
+        long cycles[SIMS], retired[SIMS] = {0};
+        int ok = 1;
+        for (int sim = 0; sim < SIMS; sim++) {
+            load_chunk_words(m, 0x7368, 0x6572, words, BLOCKS, DATA_MEM_DEFAULT_WORDS);
+            m->issue_width = sim == 2 ? 2 : 1;
+            cycles[sim] = sim == 0 ? machine_run_single(m, max_cycles, ENGINE_SWITCH, &retired[sim])
+                                   : machine_run_pipeline(m, max_cycles, &retired[sim]);
+            for (int region = 0; region < 2; region++) {
+                uint16_t *out = (w == 0 && sim == 0) ? ref[region] : got;
+                for (int i = 0; i < BLOCKS; i++) out[i] = m->data_mem[chunk_word_addr(BLOCKS, i, region)];
+                if (out == got && memcmp(got, ref[region], sizeof(got)) != 0) ok = 0;
+            }
+        }
+        double per[SIMS];
+        for (int sim = 0; sim < SIMS; sim++) {
+            per[sim] = (double)cycles[sim] / BLOCKS;
+            if (w == 0) base[sim] = per[sim];
+        }
+        if (w == 0) printf("  scalar: ");
+        else printf("  vlen=%2d:", WIDTHS[w]);
+        printf("  single-cycle %6.3f  pipeline %6.3f (CPI %.2f)  dual %6.3f (IPC %.2f)",
+               per[0], per[1], (double)cycles[1] / retired[1], per[2], (double)retired[2] / cycles[2]);
+        if (w > 0) printf("  speedup %5.2fx / %5.2fx / %5.2fx", base[0] / per[0], base[1] / per[1], base[2] / per[2]);
+        printf("%s\n", ok ? "" : "  MISMATCH");
+        bad |= !ok;
+    }
+    printf("  every width leaves the scalar ciphertext and plaintext: %s\n", bad ? "NO (MISMATCH)" : "yes");
+    machine_destroy(m);
+    return bad;
+}
+
+// One thread's share of a CTR buffer: it starts at its own counter, no hand-off
+typedef struct {
+    const uint16_t *in;
+    uint16_t *out;
+    size_t n;
+    uint16_t ctr;
+    pthread_t tid;
+} CtrJob;
+
+static void *ctr_job(void *arg) {
+    CtrJob *j = arg;
+    ctr_blocks(j->in, j->out, j->n, 0x7368, 0x6572, j->ctr);
+    return NULL;
+}
+
+// CTR mode: kernel self-test, the ISA program against ctr_blocks on every
+// simulator, ECB vs CTR throughput per batch kernel, then one large buffer split
+// across threads by counter offset (each piece seeks straight to its blocks).
+static int bench_ctr(int threads) {
+    enum { BLOCKS = 100000, SIMS = 4 };   // spans two windows
+    static const char *const SIM_NAMES[SIMS] = { "single-cycle", "threaded", "pipeline", "dual" };
+    const uint16_t k0 = 0x7368, k1 = 0x6572, iv = 0xFFF0;   // the counter wraps inside the first window
+    static uint16_t words[BLOCKS], ref[BLOCKS];
+    int bad = 0;
+
+    long st = crypto_ctr_self_test();
+    printf("ctr self-test: %s (%ld mismatches)\n", st ? "FAIL" : "PASS", st);
+    bad |= st != 0;
+
+    for (int i = 0; i < BLOCKS; i++) words[i] = (uint16_t)(i & 7);   // repeats: ECB would leak them
+    ctr_blocks(words, ref, BLOCKS, k0, k1, iv);
+    Machine *m = machine_create(0);
+    if (!m) return 1;
+    long max_cycles = (32L + 2L * CRYPTO_MAX_LATENCY) * BLOCKS + 4096;
+    printf("ISA program, %d blocks (cycles per block, ECB program in brackets)\n ", BLOCKS);
+    for (int sim = 0; sim < SIMS; sim++) {
+        long cycles[2], retired = 0;
+        int ok = 1;
+        for (int ctr = 0; ctr < 2; ctr++) {
+            if (ctr) build_ctr_streaming_program(m);
+            else build_streaming_program(m);
+            load_chunk_words(m, k0, k1, words, BLOCKS, DATA_MEM_DEFAULT_WORDS);
+            set_chunk_counters(m, BLOCKS, iv);
+            m->issue_width = sim == 3 ? 2 : 1;
+            cycles[ctr] = sim < 2 ? machine_run_single(m, max_cycles, sim == 0 ? ENGINE_SWITCH : ENGINE_THREADED, NULL)
+                                  : machine_run_pipeline(m, max_cycles, &retired);
+        }
+        for (int i = 0; i < BLOCKS; i++) {
+            if (m->data_mem[chunk_word_addr(BLOCKS, i, 1)] != ref[i] ||
+                m->data_mem[chunk_word_addr(BLOCKS, i, 0)] != words[i]) ok = 0;
+        }
+        printf(" %s %.3f (%.3f)%s", SIM_NAMES[sim], (double)cycles[1] / BLOCKS, (double)cycles[0] / BLOCKS,
+               ok ? "" : " MISMATCH");
+        bad |= !ok;
+    }
+    printf("\n  every simulator matches ctr_blocks and decrypts back: %s\n", bad ? "NO (MISMATCH)" : "yes");
+    machine_destroy(m);
+
+    const size_t n = 1 << 16;
+    const int reps = 512;
+    static uint16_t in[1 << 16], out[1 << 16];
+    for (size_t i = 0; i < n; i++) in[i] = (uint16_t)(i * 40503u);
+    CryptoImpl saved = crypto_batch_impl();
+    for (int i = 0; i < CRYPTO_IMPL_COUNT; i++) {
+        if (!crypto_set_batch_impl((CryptoImpl)i)) continue;
+        double t0 = now_sec();
+        for (int r = 0; r < reps; r++) enc_blocks(in, out, n, k0, k1);
+        double t1 = now_sec();
+        for (int r = 0; r < reps; r++) ctr_blocks(in, out, n, k0, k1, (uint16_t)(r * n));
+        double t2 = now_sec();
+        double blocks = (double)n * reps;
+        printf("  %-6s ecb %8.1f Mblocks/s  ctr %8.1f Mblocks/s  (%.1f MB/s)\n", crypto_impl_name((CryptoImpl)i),
+               blocks / (t1 - t0) / 1e6, blocks / (t2 - t1) / 1e6, 2.0 * blocks / (t2 - t1) / 1e6);
+    }
+    crypto_set_batch_impl(saved);
+
+    // Threads: 64 MB, each thread one contiguous piece
+    const size_t big = (size_t)32 << 20;
+    uint16_t *src = malloc(big * sizeof(uint16_t)), *one = malloc(big * sizeof(uint16_t)),
+             *par = malloc(big * sizeof(uint16_t));
+    if (threads <= 1) threads = workpool_cpu_count();
+    CtrJob *jobs = calloc((size_t)threads, sizeof(CtrJob));
+    if (!src || !one || !par || !jobs) {
+        free(src); free(one); free(par); free(jobs);
+        return 1;
+    }
+    for (size_t i = 0; i < big; i++) src[i] = (uint16_t)(i * 40503u);
+    ctr_blocks(src, one, big, k0, k1, iv);
+    double base = 0.0;
+    printf("  %zu MB across threads (%s):\n", big * 2 >> 20, crypto_impl_name(saved));
+    for (int t = 1; ; t = (t * 2 > threads && t < threads) ? threads : t * 2) {
+        memset(par, 0, big * sizeof(uint16_t));
+        double t0 = now_sec();
+        int started = 0;
+        for (int i = 0; i < t; i++) {
+            size_t lo = big * (size_t)i / (size_t)t, hi = big * (size_t)(i + 1) / (size_t)t;
+            jobs[i] = (CtrJob){ .in = src + lo, .out = par + lo, .n = hi - lo, .ctr = (uint16_t)(iv + lo) };
+            if (pthread_create(&jobs[i].tid, NULL, ctr_job, &jobs[i]) != 0) break;
+            started++;
+        }
+        for (int i = 0; i < started; i++) pthread_join(jobs[i].tid, NULL);
+        double secs = now_sec() - t0;
+        int ok = started == t && memcmp(par, one, big * sizeof(uint16_t)) == 0;
+        double mbs = 2.0 * big / secs / 1e6;
+        if (t == 1) base = mbs;
+        printf("  %3d threads: %9.1f MB/s (%.2fx)%s\n", t, mbs, base > 0.0 ? mbs / base : 0.0, ok ? "" : "  MISMATCH");
+        bad |= !ok;
+        if (t >= threads) break;
+    }
+    free(src); free(one); free(par); free(jobs);
+    return bad;
+}
+
+// One independent simulator per thread, each with its own key and data memory
+typedef struct {
+    const uint16_t *words;
+    int blocks;
+    uint16_t k0, k1;
+    Machine *m;
+    long cycles;
+    pthread_t tid;
+} MachineJob;
+
+static void *machine_job(void *arg) {
+    MachineJob *j = arg;
+    j->m = machine_create(0);
+    if (!j->m) return NULL;
+    build_streaming_program(j->m);
+    if (!load_chunk_words(j->m, j->k0, j->k1, j->words, j->blocks, DATA_MEM_DEFAULT_WORDS)) return NULL;
+    j->cycles = machine_run_single(j->m, 32L * j->blocks + 4096, ENGINE_THREADED, NULL);
+    return NULL;
+}
+
+// Aggregate simulated MIPS for 1, 2, 4, ... up to `threads` Machines running at
+// once. Every machine's ciphertext and decrypted text is checked afterwards,
+// which would catch any state leaking between instances.
+static int bench_machines(int threads) {
+    enum { BLOCKS = 500000 };
+    static uint16_t words[BLOCKS];
+    for (int i = 0; i < BLOCKS; i++) words[i] = (uint16_t)(i * 40503u);
+    if (threads <= 1) threads = workpool_cpu_count();
+    MachineJob *jobs = calloc((size_t)threads, sizeof(MachineJob));
+    if (!jobs) return 1;
+
+    int bad = 0;
+    double base_mips = 0.0;
+    printf("streaming program, %d blocks per machine, threaded engine\n", BLOCKS);
+    for (int n = 1; ; n = (n * 2 > threads && n < threads) ? threads : n * 2) {
+        double t0 = now_sec();
+        int started = 0;
+        for (int i = 0; i < n; i++) {
+            jobs[i] = (MachineJob){ .words = words, .blocks = BLOCKS,
+                                    .k0 = (uint16_t)(0x7368 + i * 0x0101), .k1 = (uint16_t)(0x6572 + i * 0x0202) };
+            if (pthread_create(&jobs[i].tid, NULL, machine_job, &jobs[i]) != 0) break;
+            started++;
+        }
+        for (int i = 0; i < started; i++) pthread_join(jobs[i].tid, NULL);
+        double secs = now_sec() - t0;
+
+        long cycles = 0;
+        for (int i = 0; i < started; i++) {
+            Machine *m = jobs[i].m;
+            if (!m || jobs[i].cycles == 0 || jobs[i].cycles != jobs[0].cycles) bad = 1;
+            for (int b = 0; m && b < BLOCKS; b++) {
+                if (m->data_mem[chunk_word_addr(BLOCKS, b, 1)] != enc_func(words[b], jobs[i].k0, jobs[i].k1) ||
+                    m->data_mem[chunk_word_addr(BLOCKS, b, 0)] != words[b]) {
+                    bad = 1;
+                    break;
+                }
+            }
+            cycles += jobs[i].cycles;
+            machine_destroy(m);
+        }
+        if (started < n) bad = 1;
+        double mips = cycles / secs / 1e6;
+        if (n == 1) base_mips = mips;
+        printf("  %3d machines: %11ld cycles in %.3f s = %8.2f MIPS aggregate (%.2fx one machine)\n",
+               started, cycles, secs, mips, base_mips > 0.0 ? mips / base_mips : 0.0);
+        if (n >= threads) break;
+    }
+    printf("  every machine produced its own correct ciphertext: %s\n", bad ? "NO (MISMATCH)" : "yes");
+    free(jobs);
+    return bad;
+}
+
+// Run the streaming program on both simulators with data cache cfg. Returns 0 if
+// either left memory different from ref (filled in instead when fill_ref).
+static int dcache_case(Machine *m, const CacheConfig *cfg, const uint16_t *words, int blocks, uint16_t *ref[2],
+                       int fill_ref, long cycles[2], long insts[2]) {
+    long max_cycles = (32L + 2L * m->crypto_latency + 8L * cfg->miss_latency) * blocks + 4096;
+    int ok = 1;
+    m->dcache = *cfg;
+    for (int sim = 0; sim < 2; sim++) {
+        load_chunk_words(m, 0x7368, 0x6572, words, blocks, DATA_MEM_DEFAULT_WORDS);
+        cycles[sim] = sim == 0 ? machine_run_single(m, max_cycles, ENGINE_SWITCH, &insts[sim])
+                               : machine_run_pipeline(m, max_cycles, &insts[sim]);
+        for (int region = 0; region < 2; region++) {
+            for (int i = 0; i < blocks; i++) {
+                uint16_t v = m->data_mem[chunk_word_addr(blocks, i, region)];
+                if (fill_ref && sim == 0) ref[region][i] = v;
+                else if (v != ref[region][i]) ok = 0;
+            }
+        }
+    }
+    return ok;
+}
+
+// Data cache sweep on the scalar streaming program: CPI of both simulators, hit
+// rate and writebacks per geometry/policy, then the pipeline's memory stall
+// cycles with the prefetchers and the store buffer. These only change timing,
+// so every configuration must leave the same memory contents as no cache.
+static int bench_dcache(void) {
+    enum { BLOCKS = 60000 };
+#define DC(words, ways, line, repl, write, miss) \
+    { (words), (ways), (line), CACHE_REPL_##repl, CACHE_WRITE_##write, (miss), PREFETCH_NONE, 0 }
+    static const CacheConfig CONFIGS[] = {
+        DC(   0, 1,  8, LRU,  BACK,    10),   // no cache (reference)
+        DC( 256, 1,  8, LRU,  BACK,    10),
+        DC( 256, 2,  2, LRU,  BACK,    10),
+        DC( 256, 2,  8, LRU,  BACK,    10),
+        DC( 256, 2,  8, PLRU, BACK,    10),
+        DC(1024, 4, 16, LRU,  BACK,    10),
+        DC(1024, 4, 16, PLRU, BACK,    10),
+        DC(1024, 4, 16, LRU,  THROUGH, 10),
+        DC(1024, 4, 16, LRU,  BACK,    40),
+    };
+    static const CacheConfig UNIT_BASES[] = {
+        DC( 512, 2,  8, LRU,  BACK,    10),
+        DC( 512, 2,  8, LRU,  THROUGH, 10),
+        DC(1024, 4, 16, LRU,  BACK,    40),
+    };
+#undef DC
+    static const struct { PrefetchKind pf; int sb; } UNITS[] = {
+        { PREFETCH_NONE, 0 }, { PREFETCH_NEXT_LINE, 0 }, { PREFETCH_STRIDE, 0 }, { PREFETCH_NONE, 4 },
+        { PREFETCH_STRIDE, 4 },
+    };
+    static uint16_t words[BLOCKS], ref_plain[BLOCKS], ref_cipher[BLOCKS];
+    uint16_t *ref[2] = { ref_plain, ref_cipher };
+    for (int i = 0; i < BLOCKS; i++) words[i] = (uint16_t)(i * 40503u);
+    int bad = 0;
+    Machine *m = machine_create(0);
+    if (!m) return 1;
+    build_streaming_program(m);
+
+    printf("streaming program, %d blocks\n", BLOCKS);
+    for (size_t c = 0; c < sizeof(CONFIGS) / sizeof(CONFIGS[0]); c++) {
+        long cycles[2], insts[2] = {0};
+        int ok = dcache_case(m, &CONFIGS[c], words, BLOCKS, ref, c == 0, cycles, insts);
+        const CacheStats *st = &machine_pipe_dcache(m)->st;
+        uint64_t acc = st->reads + st->writes, miss = st->read_misses + st->write_misses;
+        char desc[80];
+        cache_describe(&CONFIGS[c], desc, sizeof(desc));
+        printf("  %-36s single CPI %5.2f  pipeline CPI %5.2f  hit rate %6.2f%%  writebacks %6llu%s\n", desc,
+               (double)cycles[0] / (double)insts[0], (double)cycles[1] / (double)insts[1],
+               acc ? 100.0 * (double)(acc - miss) / (double)acc : 100.0, (unsigned long long)st->writebacks,
+               ok ? "" : "  MISMATCH");
+        bad |= !ok;
+    }
+
+    printf("pipeline memory stall cycles removed by the MEM-stage units\n");
+    for (size_t b = 0; b < sizeof(UNIT_BASES) / sizeof(UNIT_BASES[0]); b++) {
+        uint64_t base_stalls = 0;
+        for (size_t u = 0; u < sizeof(UNITS) / sizeof(UNITS[0]); u++) {
+            CacheConfig cfg = UNIT_BASES[b];
+            cfg.prefetch = UNITS[u].pf;
+            cfg.store_buffer = UNITS[u].sb;
+            long cycles[2], insts[2] = {0};
+            int ok = dcache_case(m, &cfg, words, BLOCKS, ref, 0, cycles, insts);
+            uint64_t stalls = machine_pipe_counters(m)->dcache_stalls;
+            if (u == 0) base_stalls = stalls;
+            char desc[80];
+            cache_describe(&cfg, desc, sizeof(desc));
+            printf("  %-50s stalls %8llu (%5.1f%% removed)  pipeline CPI %5.2f%s\n", desc,
+                   (unsigned long long)stalls,
+                   base_stalls ? 100.0 * (double)(base_stalls - stalls) / (double)base_stalls : 0.0,
+                   (double)cycles[1] / (double)insts[1], ok ? "" : "  MISMATCH");
+            bad |= !ok;
+        }
+    }
+    printf("  every configuration leaves the uncached ciphertext and plaintext: %s\n", bad ? "NO (MISMATCH)" : "yes");
+    machine_destroy(m);
+    return bad;
+}
+
+// Input paths, cheapest to dearest in copies: mmap + pack_be_words straight off
+// the mapping, large aligned read() + pack_be_words, and the old fread + byte
+// loop. Each one packs and encrypts the whole file in 64 KiB slices (what the
+// bulk path does) and folds the ciphertext into a checksum that must agree.
+// Files are written fresh, so they are mostly in the page cache: this measures
+// copies and syscalls, not the disk.
+#define INPUT_SPAN  (4u << 20)
+#define INPUT_SLICE (64u << 10)
+
+static uint64_t input_fold(const uint16_t *w, size_t n, uint64_t h) {
+    for (size_t i = 0; i < n; i++) h = (h ^ w[i]) * 0x100000001B3ull;
+    return h;
+}
+
+static uint64_t input_pass_fread(const char *path, size_t *bytes) {
+    static uint16_t words[INPUT_SLICE / 2];
+    unsigned char *buf = malloc(INPUT_SLICE);
+    FILE *f = fopen(path, "rb");
+    uint64_t h = 0xCBF29CE484222325ull;
+    size_t n;
+    *bytes = 0;
+    if (!f || !buf) { if (f) fclose(f); free(buf); return 0; }
+    while ((n = fread(buf, 1, INPUT_SLICE, f)) > 0) {
+        size_t w = 0;
+        for (size_t i = 0; i < n; i += 2) {
+            uint16_t hi = buf[i];
+            uint16_t lo = (i + 1 < n) ? buf[i + 1] : 0;
+            words[w++] = (uint16_t)((hi << 8) | lo);
+        }
+        enc_blocks(words, words, w, 0x7368, 0);
+        h = input_fold(words, w, h);
+        *bytes += n;
+    }
+    fclose(f);
+    free(buf);
+    return h;
+}
+
+static uint64_t input_pass(const char *path, InputMode mode, size_t *bytes) {
+    static uint16_t words[INPUT_SLICE / 2];
+    InputSource src;
+    uint64_t h = 0xCBF29CE484222325ull;
+    *bytes = 0;
+    if (!input_open(&src, path, mode)) return 0;
+    unsigned char *buf = src.mode == INPUT_MMAP ? NULL : input_alloc_buffer(INPUT_SPAN);
+    const unsigned char *data;
+    size_t n;
+    while ((n = input_next(&src, buf, INPUT_SPAN, &data)) > 0) {
+        for (size_t off = 0; off < n; off += INPUT_SLICE) {
+            size_t len = n - off < INPUT_SLICE ? n - off : INPUT_SLICE;
+            size_t w = pack_be_words(data + off, len, words);
+            enc_blocks(words, words, w, 0x7368, 0);
+            h = input_fold(words, w, h);
+        }
+        *bytes += n;
+    }
+    free(buf);
+    input_close(&src);
+    return h;
+}
+
+static int bench_input(long max_mb) {
+    static const long sizes_mb[] = { 1, 10, 100, 1024, 10240 };
+    const char *dir = getenv("TMPDIR");
+    char path[512];
+    int bad = 0;
+    if (!dir || !*dir) dir = "/tmp";
+    snprintf(path, sizeof(path), "%s/cipher_bench_input.bin", dir);
+    printf("input paths (pack + encrypt, files in %s, up to %ld MB; --bench-max-mb to change)\n", dir, max_mb);
+
+    for (unsigned s = 0; s < sizeof(sizes_mb) / sizeof(sizes_mb[0]) && sizes_mb[s] <= max_mb; s++) {
+        // One odd byte on top, so every path has to pad the tail
+        size_t size = (size_t)sizes_mb[s] << 20 | 1;
+        FILE *f = fopen(path, "wb");
+        unsigned char *chunk = malloc(INPUT_SPAN);
+        size_t left = size;
+        uint32_t x = 0x2545F491u;
+        if (!f || !chunk) {
+            fprintf(stderr, "Cannot create %s\n", path);
+            if (f) fclose(f);
+            free(chunk);
+            return 1;
+        }
+        for (size_t i = 0; i < INPUT_SPAN; i++) { x ^= x << 13; x ^= x >> 17; x ^= x << 5; chunk[i] = (unsigned char)x; }
+        while (left > 0) {
+            size_t n = left < INPUT_SPAN ? left : INPUT_SPAN;
+            if (fwrite(chunk, 1, n, f) != n) break;
+            left -= n;
+        }
+        free(chunk);
+        if (fclose(f) != 0 || left > 0) {
+            fprintf(stderr, "Cannot write %zu bytes to %s\n", size, path);
+            remove(path);
+            return 1;
+        }
+
+        size_t b0, b1, b2;
+        double t0 = now_sec();
+        uint64_t h0 = input_pass_fread(path, &b0);
+        double t1 = now_sec();
+        uint64_t h1 = input_pass(path, INPUT_READ, &b1);
+        double t2 = now_sec();
+        uint64_t h2 = input_pass(path, INPUT_MMAP, &b2);
+        double t3 = now_sec();
+        int ok = b0 == size && b1 == size && b2 == size && h0 == h1 && h0 == h2;
+        bad |= !ok;
+        printf("  %6ld MB  fread+loop %8.1f MB/s  read %8.1f MB/s  mmap %8.1f MB/s  %s\n",
+               sizes_mb[s], size / (t1 - t0) / 1e6, size / (t2 - t1) / 1e6, size / (t3 - t2) / 1e6,
+               ok ? "match" : "MISMATCH");
+        remove(path);
+    }
+    return bad;
+}
+
+int run_bench(const char *name, const BenchOptions *opt) {
+    if (strcmp(name, "crypto") == 0) return bench_crypto();
+    if (strcmp(name, "codebook") == 0) return bench_codebook();
+    if (strcmp(name, "batch") == 0) return bench_batch();
+    if (strcmp(name, "sim") == 0) return bench_sim();
+    if (strcmp(name, "vector") == 0) return bench_vector();
+    if (strcmp(name, "dcache") == 0) return bench_dcache();
+    if (strcmp(name, "machines") == 0) return bench_machines(opt->threads);
+    if (strcmp(name, "ctr") == 0) return bench_ctr(opt->threads);
+    if (strcmp(name, "input") == 0) return bench_input(opt->max_mb);
+    fprintf(stderr, "Unknown benchmark '%s' (available: crypto, codebook, batch, sim, vector, dcache, machines, ctr, input)\n", name);
+    return 2;
+}
@@ -0,0 +1,14 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+typedef struct {
+    int threads;   // -j value ("machines" and "ctr" scale up to it; <= 1 means one per CPU)
+    long max_mb;   // largest file "input" generates (1 MB .. 10 GB in 10x steps)
+} BenchOptions;
+
+// Run a named microbenchmark / self-check ("crypto", "codebook", "batch", "sim",
+// "vector", "dcache", "machines", "ctr", "input").
+// Returns 0 on success, non-zero if a correctness check failed or the name is unknown.
+int run_bench(const char *name, const BenchOptions *opt);
+
+#endif // BENCH_H
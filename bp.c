@@ -0,0 +1,80 @@
+#include <string.h>
+#include "bp.h"
+
+void bp_reset(BranchPredictor *bp) {
+    memset(bp, 0, sizeof(*bp));
+    memset(bp->ctr, 1, sizeof(bp->ctr));
+}
+
+int bp_predict(const BranchPredictor *bp, BpKind kind, uint16_t pc, const DecodedInstr *d, uint16_t *target) {
+    uint16_t t = (uint16_t)(pc + 1 + d->imm6);   // PC+1 semantics, as EX computes it
+    switch (kind) {
+        case BP_BTFN:
+            if (d->imm6 >= 0) return 0;
+            break;
+        case BP_BIMODAL:
+            if (bp->ctr[pc % BP_BIMODAL_ENTRIES] < 2) return 0;
+            break;
+        case BP_BTB: {
+            // Only a hit can redirect fetch; the target comes from the buffer
+            const BtbEntry *e = &bp->btb[pc % BP_BTB_ENTRIES];
+            if (!e->valid || e->tag != pc || e->ctr < 2) return 0;
+            t = e->target;
+            break;
+        }
+        default:
+            return 0;
+    }
+    *target = t;
+    return 1;
+}
+
+static uint8_t bump(uint8_t c, int taken) {
+    if (taken) return c < 3 ? (uint8_t)(c + 1) : c;
+    return c > 0 ? (uint8_t)(c - 1) : c;
+}
+
+void bp_update(BranchPredictor *bp, BpKind kind, uint16_t pc, int taken, uint16_t target) {
+    switch (kind) {
+        case BP_BIMODAL: {
+            uint8_t *c = &bp->ctr[pc % BP_BIMODAL_ENTRIES];
+            *c = bump(*c, taken);
+            break;
+        }
+        case BP_BTB: {
+            BtbEntry *e = &bp->btb[pc % BP_BTB_ENTRIES];
+            if (!e->valid || e->tag != pc) {
+                if (!taken) break;            // allocate on taken branches only
+                e->valid = 1;
+                e->tag = pc;
+                e->ctr = 2;
+            } else {
+                e->ctr = bump(e->ctr, taken);
+            }
+            if (taken) e->target = target;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+const char *bp_kind_name(BpKind kind) {
+    switch (kind) {
+        case BP_NONE:    return "none";
+        case BP_BTFN:    return "btfn";
+        case BP_BIMODAL: return "bimodal";
+        case BP_BTB:     return "btb";
+        default:         return "???";
+    }
+}
+
+int bp_parse_kind(const char *name, BpKind *out) {
+    for (int k = 0; k < BP_KIND_COUNT; k++) {
+        if (strcmp(name, bp_kind_name((BpKind)k)) == 0) {
+            *out = (BpKind)k;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef BP_H
+#define BP_H
+
+#include <stdint.h>
+#include "isa.h"
+
+// Front-end branch predictor for the pipeline. Predictions are made in IF from
+// the pre-decoded instruction and checked when the BNE resolves in EX.
+typedef enum {
+    BP_NONE    = 0,  // always fall through (fetch PC + 1)
+    BP_BTFN    = 1,  // static: backward taken, forward not taken
+    BP_BIMODAL = 2,  // 2-bit saturating counters indexed by PC
+    BP_BTB     = 3   // small tagged branch target buffer with a 2-bit counter per entry
+} BpKind;
+
+#define BP_KIND_COUNT       4
+#define BP_BIMODAL_ENTRIES 64
+#define BP_BTB_ENTRIES     16
+
+typedef struct {
+    uint16_t tag;       // branch PC
+    uint16_t target;
+    uint8_t  valid;
+    uint8_t  ctr;       // 2-bit, taken when >= 2
+} BtbEntry;
+
+// Predictor tables (per PipeCpu). Which design uses them is Machine.bp_kind.
+typedef struct {
+    uint8_t ctr[BP_BIMODAL_ENTRIES];
+    BtbEntry btb[BP_BTB_ENTRIES];
+} BranchPredictor;
+
+// Clear the tables: counters weakly not-taken, BTB empty
+void bp_reset(BranchPredictor *bp);
+
+// Predict the BNE d at pc. Returns 1 and sets *target if predicted taken.
+int bp_predict(const BranchPredictor *bp, BpKind kind, uint16_t pc, const DecodedInstr *d, uint16_t *target);
+
+// Train with the resolved outcome
+void bp_update(BranchPredictor *bp, BpKind kind, uint16_t pc, int taken, uint16_t target);
+
+const char *bp_kind_name(BpKind kind);
+int bp_parse_kind(const char *name, BpKind *out);
+
+#endif // BP_H
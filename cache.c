@@ -0,0 +1,377 @@
+#include <string.h>
+#include "cache.h"
+
+void cache_reset(Cache *c) {
+    memset(c, 0, sizeof(*c));
+}
+
+static int pow2(uint32_t v) {
+    return v && (v & (v - 1)) == 0;
+}
+
+const char *cache_config_check(const CacheConfig *cfg) {
+    if (!cache_enabled(cfg)) {
+        if (cfg->prefetch != PREFETCH_NONE || cfg->store_buffer) return "prefetcher and store buffer need a cache";
+        return NULL;
+    }
+    if (!pow2((uint32_t)cfg->line_words) || cfg->line_words > CACHE_MAX_LINE_WORDS)
+        return "line size must be a power of two up to 64 words";
+    if (!pow2((uint32_t)cfg->ways) || cfg->ways > CACHE_MAX_WAYS)
+        return "associativity must be a power of two up to 16";
+    if (!pow2(cfg->words) || cfg->words < (uint32_t)cfg->ways * (uint32_t)cfg->line_words)
+        return "size must be a power of two holding at least one set";
+    if (cfg->words / (uint32_t)cfg->line_words > CACHE_MAX_LINES)
+        return "too many lines (at most 1024)";
+    if (cfg->miss_latency < 0) return "miss latency must not be negative";
+    if (cfg->store_buffer < 0 || cfg->store_buffer > STORE_BUFFER_MAX)
+        return "store buffer must have 0..8 entries";
+    return NULL;
+}
+
+// Tree PLRU: each node's bit points at the half to replace next. A use points
+// every node on the way's path away from it.
+static void plru_touch(uint16_t *bits, int ways, int way) {
+    int node = 1;
+    for (int half = ways / 2; half >= 1; half /= 2) {
+        int right = (way & half) != 0;
+        if (right) *bits &= (uint16_t)~(1u << node);
+        else *bits |= (uint16_t)(1u << node);
+        node = 2 * node + right;
+    }
+}
+
+static int plru_victim(uint16_t bits, int ways) {
+    int node = 1, way = 0;
+    for (int half = ways / 2; half >= 1; half /= 2) {
+        int right = (bits >> node) & 1;
+        if (right) way |= half;
+        node = 2 * node + right;
+    }
+    return way;
+}
+
+static void touch(Cache *c, const CacheConfig *cfg, uint32_t set, int way) {
+    c->line[set * (uint32_t)cfg->ways + (uint32_t)way].last_use = c->use_clock;
+    if (cfg->repl == CACHE_REPL_PLRU) plru_touch(&c->plru[set], cfg->ways, way);
+}
+
+// An invalid way if there is one, otherwise the replacement policy's choice
+static int victim(const Cache *c, const CacheConfig *cfg, uint32_t set) {
+    const CacheLine *ln = &c->line[set * (uint32_t)cfg->ways];
+    for (int w = 0; w < cfg->ways; w++) {
+        if (!ln[w].valid) return w;
+    }
+    if (cfg->repl == CACHE_REPL_PLRU) return plru_victim(c->plru[set], cfg->ways);
+    int v = 0;
+    for (int w = 1; w < cfg->ways; w++) {
+        if (ln[w].last_use < ln[v].last_use) v = w;
+    }
+    return v;
+}
+
+// Lines of the set lineno maps to
+static CacheLine *set_of(Cache *c, const CacheConfig *cfg, uint32_t lineno, uint32_t *set, uint32_t *tag) {
+    uint32_t sets = cfg->words / ((uint32_t)cfg->ways * (uint32_t)cfg->line_words);
+    *set = lineno % sets;
+    *tag = lineno / sets;
+    return &c->line[*set * (uint32_t)cfg->ways];
+}
+
+// One demand access at cycle now. Returns the extra cycles; *fresh is set on a
+// miss or the first use of a prefetched line (what next-line prefetch follows).
+static int lookup(Cache *c, const CacheConfig *cfg, uint32_t addr, int write, uint64_t now, int *fresh) {
+    uint32_t set, tag;
+    CacheLine *ln = set_of(c, cfg, addr / (uint32_t)cfg->line_words, &set, &tag);
+    int lat = 0;
+
+    *fresh = 0;
+    c->use_clock++;
+    if (write) c->st.writes++;
+    else c->st.reads++;
+
+    int way = -1;
+    for (int w = 0; w < cfg->ways; w++) {
+        if (ln[w].valid && ln[w].tag == tag) {
+            way = w;
+            break;
+        }
+    }
+    if (way >= 0) {
+        if (ln[way].prefetched) {
+            ln[way].prefetched = 0;
+            c->st.pf_useful++;
+            *fresh = 1;
+            if (ln[way].ready > now) c->st.pf_late++;
+        }
+        if (ln[way].ready > now) lat = (int)(ln[way].ready - now);   // fill still on its way
+        if (write && cfg->write == CACHE_WRITE_THROUGH) lat += cfg->miss_latency;
+        else if (write) ln[way].dirty = 1;
+        touch(c, cfg, set, way);
+    } else if (write && cfg->write == CACHE_WRITE_THROUGH) {
+        c->st.write_misses++;
+        lat = cfg->miss_latency;           // straight to memory, no allocate
+    } else {
+        *fresh = 1;
+        if (write) c->st.write_misses++;
+        else c->st.read_misses++;
+        way = victim(c, cfg, set);
+        if (ln[way].valid && ln[way].dirty) {
+            c->st.writebacks++;
+            lat += cfg->miss_latency;
+        }
+        lat += cfg->miss_latency;          // line fill
+        ln[way] = (CacheLine){ .tag = tag, .valid = 1, .dirty = (uint8_t)(write != 0) };
+        touch(c, cfg, set, way);
+    }
+    return lat;
+}
+
+int cache_access(Cache *c, const CacheConfig *cfg, uint32_t addr, int write) {
+    if (!cache_enabled(cfg)) return 0;
+    int fresh;
+    int lat = lookup(c, cfg, addr, write, 0, &fresh);
+    c->st.stall_cycles += (uint64_t)lat;
+    return lat;
+}
+
+int cache_access_range(Cache *c, const CacheConfig *cfg, uint32_t addr, uint32_t n, int write) {
+    if (!cache_enabled(cfg) || n == 0) return 0;
+    uint32_t lw = (uint32_t)cfg->line_words;
+    int lat = 0;
+    for (uint32_t line = addr / lw; line <= (addr + n - 1) / lw; line++) {
+        lat += cache_access(c, cfg, line * lw, write);
+    }
+    return lat;
+}
+
+// ---- Prefetcher ----
+
+// Start filling lineno in the background unless it is already present. A dirty
+// victim is written back off the critical path too.
+static void prefetch_line(Cache *c, const CacheConfig *cfg, uint32_t lineno, uint64_t now) {
+    uint32_t set, tag;
+    CacheLine *ln = set_of(c, cfg, lineno, &set, &tag);
+    for (int w = 0; w < cfg->ways; w++) {
+        if (ln[w].valid && ln[w].tag == tag) return;
+    }
+    int way = victim(c, cfg, set);
+    if (ln[way].valid && ln[way].dirty) c->st.writebacks++;
+    ln[way] = (CacheLine){ .tag = tag, .valid = 1, .prefetched = 1, .ready = now + (uint64_t)cfg->miss_latency };
+    c->use_clock++;
+    touch(c, cfg, set, way);
+    c->st.pf_issued++;
+}
+
+static void prefetch_train(Cache *c, const CacheConfig *cfg, uint16_t pc, uint32_t addr, int fresh, uint64_t now) {
+    uint32_t lw = (uint32_t)cfg->line_words;
+    if (cfg->prefetch == PREFETCH_NEXT_LINE) {
+        if (fresh) prefetch_line(c, cfg, addr / lw + 1, now);
+        return;
+    }
+    if (cfg->prefetch != PREFETCH_STRIDE) return;
+
+    StrideEntry *e = &c->pf[pc % PREFETCH_ENTRIES];
+    if (!e->valid || e->pc != pc) {
+        *e = (StrideEntry){ .pc = pc, .valid = 1, .last = addr };
+        return;
+    }
+    int32_t d = (int32_t)(addr - e->last);
+    if (d != 0 && d == e->stride) {
+        if (e->conf < 3) e->conf++;
+    } else {
+        e->stride = d;
+        e->conf = 0;
+    }
+    e->last = addr;
+    if (e->conf == 0) return;
+    // One line ahead of the stream (or one stride, for strides of a line or more)
+    int64_t mag = e->stride < 0 ? -(int64_t)e->stride : e->stride;
+    int64_t ahead = mag >= (int64_t)lw ? e->stride : e->stride * (int64_t)(lw / (uint32_t)mag);
+    int64_t target = (int64_t)addr + ahead;
+    if (target >= 0 && target <= (int64_t)UINT32_MAX) prefetch_line(c, cfg, (uint32_t)target / lw, now);
+}
+
+// ---- Store buffer ----
+
+// Retire drains finished by now and start the next where the head is ready to go
+static void sb_advance(Cache *c, const CacheConfig *cfg, uint64_t now) {
+    StoreBuffer *sb = &c->sb;
+    for (;;) {
+        if (sb->draining) {
+            if (sb->drain_done > now) return;
+            sb->free_at = sb->drain_done;
+            sb->draining = 0;
+            sb->n--;
+            memmove(sb->e, sb->e + 1, (size_t)sb->n * sizeof(sb->e[0]));
+        }
+        if (sb->n == 0 || (sb->n < 2 && sb->n < cfg->store_buffer)) return;
+        uint64_t closed = sb->n >= 2 ? sb->e[1].since : sb->e[0].since;
+        uint64_t start = closed > sb->free_at ? closed : sb->free_at;
+        if (start > now) return;
+        int fresh;
+        sb->drain_done = start + 1 + (uint64_t)lookup(c, cfg, sb->e[0].line * (uint32_t)cfg->line_words, 1, start, &fresh);
+        sb->draining = 1;
+        c->st.sb_drains++;
+    }
+}
+
+// Buffer a store to mask's words of line. Returns the cycles it waited for an entry.
+static int sb_store(Cache *c, const CacheConfig *cfg, uint32_t line, uint64_t mask, uint64_t now) {
+    StoreBuffer *sb = &c->sb;
+    sb_advance(c, cfg, now);
+    for (int i = sb->draining; i < sb->n; i++) {
+        if (sb->e[i].line == line) {
+            sb->e[i].mask |= mask;
+            c->st.sb_coalesced++;
+            return 0;
+        }
+    }
+    int wait = 0;
+    if (sb->n == cfg->store_buffer) {
+        // Full, so the head is draining: wait for it
+        wait = (int)(sb->drain_done - now);
+        sb_advance(c, cfg, sb->drain_done);
+        c->st.sb_full_stalls += (uint64_t)wait;
+    }
+    sb->e[sb->n++] = (StoreBufferEntry){ .line = line, .mask = mask, .since = now + (uint64_t)wait };
+    sb_advance(c, cfg, now + (uint64_t)wait);
+    return wait;
+}
+
+// True if every word of mask in line is buffered (so a load can take it from there)
+static int sb_forward(const Cache *c, uint32_t line, uint64_t mask) {
+    const StoreBuffer *sb = &c->sb;
+    for (int i = 0; i < sb->n; i++) {
+        if (sb->e[i].line == line && (sb->e[i].mask & mask) == mask) return 1;
+    }
+    return 0;
+}
+
+int cache_pipe_access(Cache *c, const CacheConfig *cfg, uint16_t pc, uint32_t addr, uint32_t n, int write,
+                      uint64_t now) {
+    if (!cache_enabled(cfg) || n == 0) return 0;
+    uint32_t lw = (uint32_t)cfg->line_words;
+    int lat = 0;
+    if (cfg->store_buffer) sb_advance(c, cfg, now);
+    for (uint32_t line = addr / lw; line <= (addr + n - 1) / lw; line++) {
+        // Words [lo, hi) of this line
+        uint32_t lo = line * lw > addr ? line * lw : addr;
+        uint32_t hi = (line + 1) * lw < addr + n ? (line + 1) * lw : addr + n;
+        uint32_t k = hi - lo;
+        uint64_t mask = (k == 64 ? ~0ull : ((1ull << k) - 1)) << (lo - line * lw);
+        uint64_t t = now + (uint64_t)lat;
+        int fresh = 0;
+        if (write && cfg->store_buffer) {
+            lat += sb_store(c, cfg, line, mask, t);
+        } else if (!write && cfg->store_buffer && sb_forward(c, line, mask)) {
+            c->st.sb_forwards++;
+        } else {
+            lat += lookup(c, cfg, lo, write, t, &fresh);
+        }
+        prefetch_train(c, cfg, pc, lo, fresh, now + (uint64_t)lat);
+    }
+    c->st.stall_cycles += (uint64_t)lat;
+    return lat;
+}
+
+void cache_add_stats(CacheStats *acc, const CacheStats *s) {
+    acc->reads += s->reads;
+    acc->writes += s->writes;
+    acc->read_misses += s->read_misses;
+    acc->write_misses += s->write_misses;
+    acc->writebacks += s->writebacks;
+    acc->stall_cycles += s->stall_cycles;
+    acc->pf_issued += s->pf_issued;
+    acc->pf_useful += s->pf_useful;
+    acc->pf_late += s->pf_late;
+    acc->sb_coalesced += s->sb_coalesced;
+    acc->sb_forwards += s->sb_forwards;
+    acc->sb_drains += s->sb_drains;
+    acc->sb_full_stalls += s->sb_full_stalls;
+}
+
+void cache_print_stats(FILE *fp, const char *label, const CacheStats *s) {
+    uint64_t acc = s->reads + s->writes, miss = s->read_misses + s->write_misses;
+    fprintf(fp, "%s accesses=%llu hits=%llu misses=%llu (read=%llu write=%llu) hit rate=%.2f%% "
+                "writebacks=%llu stall cycles=%llu\n",
+            label, (unsigned long long)acc, (unsigned long long)(acc - miss), (unsigned long long)miss,
+            (unsigned long long)s->read_misses, (unsigned long long)s->write_misses,
+            acc ? 100.0 * (double)(acc - miss) / (double)acc : 0.0,
+            (unsigned long long)s->writebacks, (unsigned long long)s->stall_cycles);
+    if (s->pf_issued || s->sb_coalesced || s->sb_forwards || s->sb_drains) {
+        fprintf(fp, "%*s prefetch: issued=%llu useful=%llu late=%llu  store buffer: coalesced=%llu forwarded=%llu "
+                    "drains=%llu full stalls=%llu\n",
+                (int)strlen(label), "", (unsigned long long)s->pf_issued, (unsigned long long)s->pf_useful,
+                (unsigned long long)s->pf_late, (unsigned long long)s->sb_coalesced,
+                (unsigned long long)s->sb_forwards, (unsigned long long)s->sb_drains,
+                (unsigned long long)s->sb_full_stalls);
+    }
+}
+
+void cache_describe(const CacheConfig *cfg, char *out, size_t cap) {
+    if (!cache_enabled(cfg)) {
+        snprintf(out, cap, "off");
+        return;
+    }
+    int len = snprintf(out, cap, "%uw %d-way %dw/line %s %s miss=%d", (unsigned)cfg->words, cfg->ways,
+                       cfg->line_words, cache_repl_name(cfg->repl), cache_write_name(cfg->write), cfg->miss_latency);
+    if (cfg->prefetch != PREFETCH_NONE && len > 0 && (size_t)len < cap)
+        len += snprintf(out + len, cap - (size_t)len, " pf=%s", cache_prefetch_name(cfg->prefetch));
+    if (cfg->store_buffer && len > 0 && (size_t)len < cap)
+        snprintf(out + len, cap - (size_t)len, " sb=%d", cfg->store_buffer);
+}
+
+const char *cache_repl_name(CacheRepl repl) {
+    switch (repl) {
+        case CACHE_REPL_LRU:  return "lru";
+        case CACHE_REPL_PLRU: return "plru";
+        default:              return "???";
+    }
+}
+
+int cache_repl_parse(const char *name, CacheRepl *out) {
+    for (int r = CACHE_REPL_LRU; r <= CACHE_REPL_PLRU; r++) {
+        if (strcmp(name, cache_repl_name((CacheRepl)r)) == 0) {
+            *out = (CacheRepl)r;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char *cache_write_name(CacheWrite write) {
+    switch (write) {
+        case CACHE_WRITE_BACK:    return "wb";
+        case CACHE_WRITE_THROUGH: return "wt";
+        default:                  return "???";
+    }
+}
+
+int cache_write_parse(const char *name, CacheWrite *out) {
+    for (int w = CACHE_WRITE_BACK; w <= CACHE_WRITE_THROUGH; w++) {
+        if (strcmp(name, cache_write_name((CacheWrite)w)) == 0) {
+            *out = (CacheWrite)w;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char *cache_prefetch_name(PrefetchKind kind) {
+    switch (kind) {
+        case PREFETCH_NONE:      return "none";
+        case PREFETCH_NEXT_LINE: return "next-line";
+        case PREFETCH_STRIDE:    return "stride";
+        default:                 return "???";
+    }
+}
+
+int cache_prefetch_parse(const char *name, PrefetchKind *out) {
+    for (int k = PREFETCH_NONE; k <= PREFETCH_STRIDE; k++) {
+        if (strcmp(name, cache_prefetch_name((PrefetchKind)k)) == 0) {
+            *out = (PrefetchKind)k;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// L1 data cache timing model. Only tags are kept: loads and stores still go
+// to data_mem, the cache decides how many extra cycles each access costs.
+// The pipeline's MEM stage can also put a prefetcher and a write-combining
+// store buffer in front of it (cache_pipe_access).
+
+#define CACHE_MAX_LINES      1024
+#define CACHE_MAX_WAYS       16
+#define CACHE_MAX_LINE_WORDS 64
+#define PREFETCH_ENTRIES     16   // stride table, indexed by the accessing instruction's PC
+#define STORE_BUFFER_MAX     8
+
+typedef enum {
+    CACHE_REPL_LRU  = 0,   // true LRU (per-line timestamps)
+    CACHE_REPL_PLRU = 1    // tree pseudo-LRU (ways - 1 bits per set)
+} CacheRepl;
+
+typedef enum {
+    CACHE_WRITE_BACK    = 0,   // stores allocate and dirty the line; dirty victims are written back
+    CACHE_WRITE_THROUGH = 1    // every store goes to memory; store misses do not allocate
+} CacheWrite;
+
+typedef enum {
+    PREFETCH_NONE      = 0,
+    PREFETCH_NEXT_LINE = 1,   // tagged: a miss or first use of a prefetched line fetches the next line
+    PREFETCH_STRIDE    = 2    // per-PC stride detection, one line ahead once a stride repeats
+} PrefetchKind;
+
+// Geometry and policy (Machine.dcache). words == 0: no cache, accesses cost nothing extra.
+// words, ways and line_words are powers of two.
+typedef struct {
+    uint32_t words;        // capacity in 16-bit words
+    int ways;
+    int line_words;
+    CacheRepl repl;
+    CacheWrite write;
+    int miss_latency;      // cycles per line fill, dirty writeback or written-through store
+    // Pipeline MEM stage only (the single-cycle core goes straight to the cache)
+    PrefetchKind prefetch;
+    int store_buffer;      // write-combining entries, one line each (0 = stores go to the cache)
+} CacheConfig;
+
+typedef struct {
+    uint64_t reads, writes;
+    uint64_t read_misses, write_misses;
+    uint64_t writebacks;   // dirty lines evicted
+    uint64_t stall_cycles; // sum of the latencies cache_access / cache_pipe_access returned
+    uint64_t pf_issued;    // lines the prefetcher brought in
+    uint64_t pf_useful;    // of those, lines a demand access used
+    uint64_t pf_late;      // uses that still waited for the fill
+    uint64_t sb_coalesced; // stores merged into a buffered line
+    uint64_t sb_forwards;  // loads served from the store buffer
+    uint64_t sb_drains;    // buffered lines written into the cache
+    uint64_t sb_full_stalls; // cycles stores waited for a free entry
+} CacheStats;
+
+typedef struct {
+    uint32_t tag;
+    uint32_t last_use;     // LRU timestamp
+    uint64_t ready;        // cycle a prefetch fill completes
+    uint8_t  valid;
+    uint8_t  dirty;
+    uint8_t  prefetched;   // brought in by the prefetcher and not used yet
+} CacheLine;
+
+typedef struct {
+    uint16_t pc;
+    uint8_t  valid;
+    uint8_t  conf;         // times the stride repeated (saturates at 3)
+    uint32_t last;         // previous address
+    int32_t  stride;
+} StrideEntry;
+
+typedef struct {
+    uint32_t line;         // line number (address / line_words)
+    uint64_t mask;         // words written
+    uint64_t since;        // cycle the entry was allocated
+} StoreBufferEntry;
+
+// Oldest entry first. It drains into the cache, in the background, once a
+// younger entry exists (the store stream has moved on) or the buffer is full.
+typedef struct {
+    StoreBufferEntry e[STORE_BUFFER_MAX];
+    int n;
+    int draining;          // e[0] is being written into the cache
+    uint64_t drain_done;   // cycle that write finishes
+    uint64_t free_at;      // cycle the drain port last went idle
+} StoreBuffer;
+
+// Tag state for one core (each CPU model owns one, like its branch predictor)
+typedef struct {
+    CacheLine line[CACHE_MAX_LINES];   // set * ways + way
+    uint16_t  plru[CACHE_MAX_LINES];   // tree bits per set (node i at bit i, root 1)
+    uint32_t  use_clock;
+    StrideEntry pf[PREFETCH_ENTRIES];
+    StoreBuffer sb;
+    CacheStats st;
+} Cache;
+
+static inline int cache_enabled(const CacheConfig *cfg) {
+    return cfg->words != 0;
+}
+
+// Invalidate every line and clear the stats
+void cache_reset(Cache *c);
+
+// NULL if cfg describes a cache this model can hold, otherwise what is wrong with it
+const char *cache_config_check(const CacheConfig *cfg);
+
+// Look up one word (write = store). Returns the extra cycles the access takes.
+int cache_access(Cache *c, const CacheConfig *cfg, uint32_t addr, int write);
+
+// n consecutive words (VLD/VST): one access per line touched, latencies added
+int cache_access_range(Cache *c, const CacheConfig *cfg, uint32_t addr, uint32_t n, int write);
+
+// The pipeline's MEM stage at cycle now: n words at addr for the instruction
+// at pc, through the store buffer (stores buffered, loads forwarded from it)
+// and the prefetcher cfg selects. Returns the extra cycles MEM waits.
+int cache_pipe_access(Cache *c, const CacheConfig *cfg, uint16_t pc, uint32_t addr, uint32_t n, int write,
+                      uint64_t now);
+
+void cache_add_stats(CacheStats *acc, const CacheStats *s);
+void cache_print_stats(FILE *fp, const char *label, const CacheStats *s);
+
+// "256w 2-way 8w/line lru wb miss=10" (plus " pf=stride sb=4" when set)
+void cache_describe(const CacheConfig *cfg, char *out, size_t cap);
+
+const char *cache_repl_name(CacheRepl repl);
+int cache_repl_parse(const char *name, CacheRepl *out);
+const char *cache_write_name(CacheWrite write);
+int cache_write_parse(const char *name, CacheWrite *out);
+const char *cache_prefetch_name(PrefetchKind kind);
+int cache_prefetch_parse(const char *name, PrefetchKind *out);
+
+#endif // CACHE_H
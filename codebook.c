@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "codebook.h"
+#include "crypto.h"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+void codebook_init(CodebookCache *cc) {
+    CodebookCache empty = {0};
+    *cc = empty;
+}
+
+void codebook_set_enabled(CodebookCache *cc, int on) {
+    cc->enabled = on;
+}
+
+int codebook_is_enabled(const CodebookCache *cc) {
+    return cc->enabled;
+}
+
+static void build(CodebookCache *cc, Codebook *cb, uint16_t k0, uint16_t k1) {
+    double t0 = now_sec();
+    KeySchedule ks;
+    key_schedule_init(&ks, k0, k1);
+    cb->k0 = k0;
+    cb->k1 = k1;
+    for (uint32_t x = 0; x < 65536; x++) cb->fwd[x] = (uint16_t)x;
+    enc_blocks_ks(cb->fwd, cb->fwd, 65536, &ks);
+    for (uint32_t x = 0; x < 65536; x++) {
+        cb->inv[cb->fwd[x]] = (uint16_t)x;   // enc_func is a permutation, so this fills inv completely
+    }
+    cb->valid = 1;
+    cc->stats.build_sec += now_sec() - t0;
+}
+
+const Codebook *codebook_get(CodebookCache *cc, uint16_t k0, uint16_t k1) {
+    Codebook *mru = cc->mru;
+    if (mru && mru->k0 == k0 && mru->k1 == k1) {
+        cc->stats.hits++;
+        return mru;
+    }
+
+    for (int i = 0; i < CODEBOOK_WAYS; i++) {
+        Codebook *cb = cc->slots[i];
+        if (cb && cb->valid && cb->k0 == k0 && cb->k1 == k1) {
+            cc->stats.hits++;
+            cb->last_use = ++cc->use_clock;
+            cc->mru = cb;
+            return cb;
+        }
+    }
+
+    // Miss: take an empty slot, otherwise the least recently used one
+    int victim = 0;
+    for (int i = 0; i < CODEBOOK_WAYS; i++) {
+        if (!cc->slots[i] || !cc->slots[i]->valid) { victim = i; break; }
+        if (cc->slots[i]->last_use < cc->slots[victim]->last_use) victim = i;
+    }
+    if (!cc->slots[victim]) {
+        cc->slots[victim] = calloc(1, sizeof(Codebook));
+        if (!cc->slots[victim]) return NULL;
+    }
+    Codebook *cb = cc->slots[victim];
+
+    cc->stats.misses++;
+    if (cb->valid) cc->stats.evictions++;
+    build(cc, cb, k0, k1);
+    cb->last_use = ++cc->use_clock;
+    cc->mru = cb;
+    return cb;
+}
+
+uint16_t codebook_enc(CodebookCache *cc, uint16_t block, const KeySchedule *ks) {
+    if (!cc->enabled) return enc_func_ks(block, ks);
+    cc->stats.lookups++;
+    const Codebook *cb = codebook_get(cc, ks->k0, ks->k1);
+    return cb ? cb->fwd[block] : enc_func_ks(block, ks);
+}
+
+uint16_t codebook_dec(CodebookCache *cc, uint16_t block, const KeySchedule *ks) {
+    if (!cc->enabled) return dec_func_ks(block, ks);
+    cc->stats.lookups++;
+    const Codebook *cb = codebook_get(cc, ks->k0, ks->k1);
+    return cb ? cb->inv[block] : dec_func_ks(block, ks);
+}
+
+void codebook_get_stats(const CodebookCache *cc, CodebookStats *out) {
+    *out = cc->stats;
+}
+
+void codebook_reset_stats(CodebookCache *cc) {
+    CodebookStats zero = {0};
+    cc->stats = zero;
+}
+
+void codebook_add_stats(CodebookStats *acc, const CodebookStats *s) {
+    acc->lookups   += s->lookups;
+    acc->hits      += s->hits;
+    acc->misses    += s->misses;
+    acc->evictions += s->evictions;
+    acc->build_sec += s->build_sec;
+}
+
+void codebook_print_stats(const CodebookStats *s) {
+    unsigned long builds = s->misses;
+    double per_build_us = builds ? s->build_sec * 1e6 / (double)builds : 0.0;
+    printf("Codebook: lookups=%lu key-hits=%lu key-misses=%lu evictions=%lu build=%.3f ms (%.1f us/build, %.0f lookups/build)\n",
+           s->lookups, s->hits, s->misses, s->evictions,
+           s->build_sec * 1e3, per_build_us,
+           builds ? (double)s->lookups / (double)builds : 0.0);
+}
+
+void codebook_free(CodebookCache *cc) {
+    for (int i = 0; i < CODEBOOK_WAYS; i++) {
+        free(cc->slots[i]);
+        cc->slots[i] = NULL;
+    }
+    cc->mru = NULL;
+}
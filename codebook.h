@@ -0,0 +1,62 @@
+#ifndef CODEBOOK_H
+#define CODEBOOK_H
+
+#include <stdint.h>
+#include "crypto.h"
+
+// Number of (K0, K1) pairs kept resident (LRU replacement)
+#define CODEBOOK_WAYS 4
+
+// Full forward/inverse permutation of the 16-bit cipher for one key pair
+typedef struct {
+    uint16_t k0;
+    uint16_t k1;
+    int      valid;
+    unsigned long last_use;   // LRU timestamp
+    uint16_t fwd[65536];      // fwd[x] == enc_func(x, k0, k1)
+    uint16_t inv[65536];      // inv[y] == dec_func(y, k0, k1)
+} Codebook;
+
+typedef struct {
+    unsigned long lookups;    // ENC/DEC operations served
+    unsigned long hits;       // key pair already resident
+    unsigned long misses;     // key pair had to be built
+    unsigned long evictions;  // resident codebooks replaced
+    double build_sec;         // total wall time spent building tables
+} CodebookStats;
+
+// Resident codebooks for one simulator instance. Not shared between threads:
+// each Machine owns one, so ENC/DEC never needs a lock.
+typedef struct {
+    Codebook *slots[CODEBOOK_WAYS];
+    Codebook *mru;            // most recently used entry (fast path)
+    unsigned long use_clock;
+    int enabled;
+    CodebookStats stats;
+} CodebookCache;
+
+// Start empty and disabled
+void codebook_init(CodebookCache *cc);
+
+// Enable/disable the cache. When disabled codebook_enc/dec fall through to enc_func/dec_func.
+void codebook_set_enabled(CodebookCache *cc, int on);
+int  codebook_is_enabled(const CodebookCache *cc);
+
+// Return the codebook for (k0, k1), building it (and evicting the LRU entry) on a miss
+const Codebook *codebook_get(CodebookCache *cc, uint16_t k0, uint16_t k1);
+
+// ENC/DEC through the cache: one table load when the key pair is resident,
+// otherwise (or when disabled) the cipher on the caller's schedule
+uint16_t codebook_enc(CodebookCache *cc, uint16_t block, const KeySchedule *ks);
+uint16_t codebook_dec(CodebookCache *cc, uint16_t block, const KeySchedule *ks);
+
+void codebook_get_stats(const CodebookCache *cc, CodebookStats *out);
+void codebook_reset_stats(CodebookCache *cc);
+// Accumulate s into acc (for totals over several caches)
+void codebook_add_stats(CodebookStats *acc, const CodebookStats *s);
+void codebook_print_stats(const CodebookStats *s);
+
+// Release all resident codebooks
+void codebook_free(CodebookCache *cc);
+
+#endif // CODEBOOK_H
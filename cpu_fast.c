@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <string.h>
+#include "cpu_fast.h"
+#include "memory.h"
+#include "codebook.h"
+
+extern int check_ea(const Machine *m, uint32_t ea, const char *op);
+extern void step_single(Machine *m, CpuState *cpu);
+
+// ---- Superinstruction detection ----
+
+// Loop bodies the threaded engine runs as one fused handler
+enum {
+    FUSE_NONE = 0,
+    FUSE_LOOP     // LOOP rc,3; LDP r1,(ra)+s; ENC|DEC r2,r1; STP r2,(rb)+t
+};
+
+static int all_distinct(const uint8_t *r, int n) {
+    for (int i = 0; i < n; i++)
+        for (int j = i + 1; j < n; j++)
+            if (r[i] == r[j]) return 0;
+    return 1;
+}
+
+static int match_loop(const DecodedInstr *b) {
+    if (b[0].opcode != OPC_LOOP || b[0].imm6 != 3 || b[1].opcode != OPC_LDP ||
+        (b[2].opcode != OPC_ENC && b[2].opcode != OPC_DEC) || b[3].opcode != OPC_STP) return 0;
+    uint8_t r1 = b[1].f1, ra = b[1].f2, r2 = b[2].f1, rb = b[3].f2;
+    uint8_t regs[4] = { r1, r2, ra, rb };
+    return b[2].f2 == r1 && b[3].f1 == r2 && all_distinct(regs, 4);
+}
+
+// Scan the loaded program once per load (re-run only after instr_mem changes)
+static void find_superinstructions(Machine *m) {
+    if (m->fused_size == m->program_size && m->fused_version == m->instr_mem_version) return;
+    memset(m->fuse_kind, 0, sizeof(m->fuse_kind));
+    for (int i = 0; i < m->program_size; i++) {
+        if (i + 4 <= m->program_size && match_loop(&m->decoded_mem[i])) m->fuse_kind[i] = FUSE_LOOP;
+    }
+    m->fused_size = m->program_size;
+    m->fused_version = m->instr_mem_version;
+}
+
+void single_fast_set_fusion(Machine *m, int on) {
+    m->fuse = on;
+}
+
+int single_fast_superinstructions(Machine *m) {
+    int n = 0;
+    find_superinstructions(m);
+    for (int i = 0; i < m->program_size; i++) n += m->fuse_kind[i] != FUSE_NONE;
+    return n;
+}
+
+#if defined(__GNUC__)
+
+int single_fast_available(void) {
+    return 1;
+}
+
+// Direct-threaded interpreter: every decoded_mem entry carries the address of its
+// opcode's handler, and each handler jumps straight to the next one. Slots past
+// program_size resolve to a stop handler, so sequential fetch needs no bounds check;
+// only taken branches can leave the program and they check explicitly.
+//
+// The first slot of a recognised loop body gets a fused handler instead. It runs the
+// whole loop, charging the same cycles per iteration as the unfused body, when the
+// cycle budget allows; otherwise the loop falls back to the per-instruction handlers.
+//
+// Hardware loops end on a fetch address, which threaded dispatch does not look at,
+// so a LOOP that is not fused runs its body on step_single.
+long run_single_fast(Machine *m, CpuState *cpu, long max_cycles) {
+    static const void *const op_labels[16] = {
+        [OPC_LD]   = &&op_ld,   [OPC_ST]   = &&op_st,   [OPC_ADDI] = &&op_addi,
+        [OPC_LDK]  = &&op_ldk,  [OPC_ENC]  = &&op_enc,  [OPC_DEC]  = &&op_dec,
+        [OPC_BNE]  = &&op_bne,  [OPC_HLT]  = &&op_hlt,  [OPC_ADD]  = &&op_add,
+        [OPC_LDP]  = &&op_ldp,  [OPC_STP]  = &&op_stp,  [OPC_LOOP] = &&op_loop,
+        [OPC_VEC]  = &&op_vec,  [OPC_SETB] = &&op_setb, [OPC_XOR]  = &&op_xor,
+        [OPC_NOP]  = &&op_nop
+    };
+
+    static const void *const fused_labels[] = {
+        [FUSE_LOOP] = &&fused_loop
+    };
+
+    // Resolve handlers for the loaded program (cheap: at most INSTR_MEM_SIZE entries)
+    find_superinstructions(m);
+    DecodedInstr *const code = m->decoded_mem;
+    const int program_size = m->program_size;
+    uint16_t *const data_mem = m->data_mem;
+    const uint32_t mem_limit = m->data_mem_size;   // fixed for the whole run
+    CodebookCache *const cb = &m->codebook;
+    for (int i = 0; i <= INSTR_MEM_SIZE; i++) {
+        if (i >= program_size)                        code[i].handler = &&stop;
+        else if (m->fuse && m->fuse_kind[i])          code[i].handler = fused_labels[m->fuse_kind[i]];
+        else                                          code[i].handler = op_labels[code[i].opcode];
+    }
+
+    uint16_t *R = cpu->R;
+    long cycles = 0;
+    const DecodedInstr *d;
+
+    // Resuming inside a hardware loop body (an earlier run ran out of budget)
+    while (cpu->LC && cpu->PC < program_size && cycles < max_cycles) {
+        step_single(m, cpu);
+        cycles++;
+    }
+    uint16_t pc = cpu->PC;
+
+    if (pc >= program_size || max_cycles <= 0) goto out;
+
+// Bounds check inline; check_ea only runs to report a fault
+#define IN_BOUNDS(ea, op) ((ea) < mem_limit || check_ea(m, (ea), (op)))
+#define NEXT() do {                              \
+        if (cycles == max_cycles) goto out;      \
+        d = &code[pc];                           \
+        goto *d->handler;                        \
+    } while (0)
+
+    NEXT();
+
+op_ld: {
+        uint32_t ea = PHYS_ADDR(cpu->DB, R[d->f2] + d->imm6);
+        cycles++; pc++;
+        if (!IN_BOUNDS(ea, "LD")) { pc = INSTR_MEM_SIZE; goto out; }
+        R[d->f1] = data_mem[ea];
+        NEXT();
+    }
+op_st: {
+        uint32_t ea = PHYS_ADDR(cpu->DB, R[d->f2] + d->imm6);
+        cycles++; pc++;
+        if (!IN_BOUNDS(ea, "ST")) { pc = INSTR_MEM_SIZE; goto out; }
+        data_mem[ea] = R[d->f1];
+        NEXT();
+    }
+op_addi:
+    cycles++; pc++;
+    R[d->f1] = (uint16_t)(R[d->f2] + d->imm6);
+    NEXT();
+op_ldk: {
+        uint32_t ea = PHYS_ADDR(cpu->DB, R[d->f2] + d->imm6);
+        cycles++; pc++;
+        if (!IN_BOUNDS(ea, "LDK")) { pc = INSTR_MEM_SIZE; goto out; }
+        cpu_load_key(cpu, d->f1, data_mem[ea]);
+        NEXT();
+    }
+op_enc:
+    cycles++; pc++;
+    R[d->f1] = codebook_enc(cb, R[d->f2], &cpu->ks);
+    NEXT();
+op_dec:
+    cycles++; pc++;
+    R[d->f1] = codebook_dec(cb, R[d->f2], &cpu->ks);
+    NEXT();
+op_bne:
+    cycles++; pc++;
+    if (R[d->f1] != R[d->f2]) {
+        pc = (uint16_t)(pc + d->imm6);   // PC+1 semantics
+        if (pc >= program_size) goto out;
+    }
+    NEXT();
+op_setb:
+    cycles++; pc++;
+    cpu->DB = (uint16_t)(R[d->f2] + d->imm6);
+    NEXT();
+op_hlt:
+    cycles++;
+    pc = INSTR_MEM_SIZE;
+    goto out;
+op_nop:
+    cycles++; pc++;
+    NEXT();
+op_add:
+    cycles++; pc++;
+    R[d->f1] = (uint16_t)(R[d->f2] + R[d->f3]);
+    NEXT();
+op_xor:
+    cycles++; pc++;
+    R[d->f1] = (uint16_t)(R[d->f2] ^ R[d->f3]);
+    NEXT();
+op_ldp: {
+        uint32_t ea = PHYS_ADDR(cpu->DB, R[d->f2]);
+        cycles++; pc++;
+        if (!IN_BOUNDS(ea, "LDP")) { pc = INSTR_MEM_SIZE; goto out; }
+        R[d->f2] = (uint16_t)(R[d->f2] + d->imm6);
+        R[d->f1] = data_mem[ea];
+        NEXT();
+    }
+op_stp: {
+        uint32_t ea = PHYS_ADDR(cpu->DB, R[d->f2]);
+        cycles++; pc++;
+        if (!IN_BOUNDS(ea, "STP")) { pc = INSTR_MEM_SIZE; goto out; }
+        data_mem[ea] = R[d->f1];
+        R[d->f2] = (uint16_t)(R[d->f2] + d->imm6);
+        NEXT();
+    }
+op_loop:
+    cycles++;
+    cpu->LC = R[d->f1];
+    cpu->LS = (uint16_t)(pc + 1);
+    cpu->LE = (uint16_t)(pc + d->imm6);
+    cpu->PC = cpu->LC ? cpu->LS : (uint16_t)(cpu->LE + 1);
+    while (cpu->LC && cpu->PC < program_size && cycles < max_cycles) {
+        step_single(m, cpu);
+        cycles++;
+    }
+    pc = cpu->PC;
+    if (pc >= INSTR_MEM_SIZE) goto out;
+    NEXT();
+op_vec:
+    // Vector ops do enough work per instruction that dispatch cost does not matter
+    cycles++;
+    cpu->PC = pc;
+    step_single(m, cpu);
+    pc = cpu->PC;
+    if (pc >= INSTR_MEM_SIZE) goto out;
+    NEXT();
+
+fused_loop: {
+        // d[0..3] = LOOP rc,3; LDP r1,(ra)+s; ENC|DEC r2,r1; STP r2,(rb)+t, run to completion
+        uint32_t trips = R[d[0].f1];
+        if (1 + 3 * (long)trips > max_cycles - cycles) goto op_loop;
+        uint8_t r1 = d[1].f1, ra = d[1].f2, r2 = d[2].f1, rb = d[3].f2;
+        int enc = d[2].opcode == OPC_ENC;
+        const uint32_t bank = PHYS_ADDR(cpu->DB, 0);
+        const KeySchedule *ks = &cpu->ks;
+        const int8_t step_a = d[1].imm6, step_b = d[3].imm6;
+        uint16_t v = R[r1], w = R[r2], a = R[ra], b = R[rb];
+        int fault = 0;
+        uint32_t it;
+        for (it = 0; it < trips; it++) {
+            uint32_t ea = bank + a;
+            if (!IN_BOUNDS(ea, "LDP")) { fault = 1; break; }
+            a = (uint16_t)(a + step_a);
+            v = data_mem[ea];
+            w = enc ? codebook_enc(cb, v, ks) : codebook_dec(cb, v, ks);
+            ea = bank + b;
+            if (!IN_BOUNDS(ea, "STP")) { fault = 3; break; }
+            data_mem[ea] = w;
+            b = (uint16_t)(b + step_b);
+        }
+        R[r1] = v; R[r2] = w; R[ra] = a; R[rb] = b;
+        cpu->LC = (uint16_t)(trips - it);
+        cpu->LS = (uint16_t)(pc + 1);
+        cpu->LE = (uint16_t)(pc + 3);
+        cycles += 1 + 3 * (long)it + fault;
+        if (fault) { pc = INSTR_MEM_SIZE; goto out; }
+        pc = (uint16_t)(pc + 4);
+        NEXT();
+    }
+stop:
+out:
+#undef NEXT
+#undef IN_BOUNDS
+    cpu->PC = pc;
+    return cycles;
+}
+
+#else
+
+int single_fast_available(void) {
+    return 0;
+}
+
+// Portable fallback: same contract, plain step_single loop
+long run_single_fast(Machine *m, CpuState *cpu, long max_cycles) {
+    long cycles = 0;
+    while (cpu->PC < m->program_size && cycles < max_cycles) {
+        step_single(m, cpu);
+        cycles++;
+    }
+    return cycles;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef CPU_FAST_H
+#define CPU_FAST_H
+
+#include "isa.h"
+
+// Single-cycle execution engines
+typedef enum {
+    ENGINE_SWITCH   = 0,  // step_single() per instruction (reference)
+    ENGINE_THREADED = 1   // run_single_fast(): direct-threaded dispatch
+} SingleEngine;
+
+// True if this build supports the threaded engine (needs GCC labels-as-values)
+int single_fast_available(void);
+
+// Run the loaded program from the current state until it halts, leaves
+// [0, program_size), or max_cycles instructions have executed. Architectural
+// results and cycle counts are identical to calling step_single() in a loop
+// under the same conditions. Returns the number of cycles executed.
+long run_single_fast(Machine *m, CpuState *cpu, long max_cycles);
+
+// Enable/disable superinstruction fusion of recognised loop bodies in m (default on)
+void single_fast_set_fusion(Machine *m, int on);
+
+// Number of fused loop bodies found in the program loaded into m
+int single_fast_superinstructions(Machine *m);
+
+#endif // CPU_FAST_H
@@ -1,220 +1,832 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "cpu_pipe.h"
 #include "memory.h"
-#include "crypto.h"
+#include "codebook.h"
+#include "trace.h"
 
 extern void init_cpu(CpuState *cpu);
-extern DecodedInstr decode(uint16_t raw);
+extern int check_ea(const Machine *m, uint32_t ea, const char *op);
 
-static int is_nop_instr(uint16_t raw) {
-    return ((raw >> 12) & 0xF) == OPC_NOP;
-}
-
-static const char* opcode_name(uint8_t op) {
-    switch (op) {
-        case OPC_LD:   return "LD";
-        case OPC_ST:   return "ST";
-        case OPC_ADDI: return "ADDI";
-        case OPC_LDK:  return "LDK";
-        case OPC_ENC:  return "ENC";
-        case OPC_DEC:  return "DEC";
-        case OPC_BNE:  return "BNE";
-        case OPC_HLT:  return "HLT";
-        case OPC_NOP:  return "NOP";
-        default:       return "???";
-    }
-}
+// Bubbles injected by IF when there is nothing (more) to fetch
+static const DecodedInstr NOP_DECODED = { .raw = OPC_NOP << 12, .opcode = OPC_NOP };
+static const DecodedInstr HLT_DECODED = { .raw = OPC_HLT << 12, .opcode = OPC_HLT };
 
 void init_pipe_cpu(PipeCpu *cpu) {
     init_cpu(&cpu->core);
     cpu->cycle = 0;
+    cpu->stalled = 0;
+    memset(&cpu->ctr, 0, sizeof(cpu->ctr));
+    bp_reset(&cpu->bp);
+    memset(cpu->crypto, 0, sizeof(cpu->crypto));
+    cache_reset(&cpu->dcache);
+    cpu->dcache_wait = 0;
+    cpu->dcache_done = false;
 
     cpu->if_id.instr = (OPC_NOP << 12);
     cpu->if_id.pc    = 0;
+    cpu->if_id.d     = NOP_DECODED;
+    cpu->if_id.pred_taken = false;
+    cpu->if_id.loop_end = false;
 
     cpu->id_ex.d.opcode  = OPC_NOP;
     cpu->id_ex.pc        = 0;
     cpu->id_ex.rs_val    = 0;
     cpu->id_ex.rs2_val   = 0;
+    cpu->id_ex.pred_taken = false;
 
     cpu->ex_mem.d.opcode = OPC_NOP;
     cpu->ex_mem.pc       = 0;
     cpu->ex_mem.alu_result = 0;
+    cpu->ex_mem.mem_addr   = 0;
     cpu->ex_mem.rs2_val    = 0;
+    cpu->ex_mem.base_val   = 0;
+    cpu->ex_mem.vl         = 0;
     cpu->ex_mem.branch_taken  = false;
     cpu->ex_mem.branch_target = 0;
 
     cpu->mem_wb.d.opcode = OPC_NOP;
     cpu->mem_wb.pc       = 0;
     cpu->mem_wb.write_val = 0;
+    cpu->mem_wb.base_val  = 0;
 }
 
 void print_pipe_state(const PipeCpu *cpu) {
     printf("Cycle %2d | IF: %-4s | ID: %-4s | EX: %-4s | MEM: %-4s | WB: %-4s\n",
            cpu->cycle,
-           opcode_name((cpu->if_id.instr >> 12) & 0xF),
+           opcode_name(cpu->if_id.d.opcode),
            opcode_name(cpu->id_ex.d.opcode),
            opcode_name(cpu->ex_mem.d.opcode),
            opcode_name(cpu->mem_wb.d.opcode),
            opcode_name(cpu->mem_wb.d.opcode));
 }
 
-static uint16_t forward_val(const PipeCpu *cpu, const EX_MEM *ex_mem, const MEM_WB *mem_wb, uint8_t reg) {
-    if ((ex_mem->d.opcode == OPC_ADDI || ex_mem->d.opcode == OPC_ENC || ex_mem->d.opcode == OPC_DEC) && ex_mem->d.f1 == reg) {
-        return ex_mem->alu_result;
+const char *crypto_unit_name(CryptoUnitKind kind) {
+    switch (kind) {
+        case CRYPTO_UNIT_PIPELINED: return "pipelined";
+        case CRYPTO_UNIT_ITERATIVE: return "iterative";
+        default:                    return "???";
     }
-    if ((mem_wb->d.opcode == OPC_LD || mem_wb->d.opcode == OPC_ADDI || mem_wb->d.opcode == OPC_ENC || mem_wb->d.opcode == OPC_DEC || mem_wb->d.opcode == OPC_LDK) && mem_wb->d.f1 == reg) {
-        return mem_wb->write_val;
+}
+
+int crypto_unit_parse(const char *name, CryptoUnitKind *out) {
+    for (int k = CRYPTO_UNIT_PIPELINED; k <= CRYPTO_UNIT_ITERATIVE; k++) {
+        if (strcmp(name, crypto_unit_name((CryptoUnitKind)k)) == 0) {
+            *out = (CryptoUnitKind)k;
+            return 1;
+        }
     }
-    return cpu->core.R[reg];
+    return 0;
 }
 
-void step_pipe(PipeCpu *cpu) {
-    cpu->cycle++;
+static bool crypto_idle(const CryptoSlot *crypto) {
+    for (int i = 0; i < CRYPTO_MAX_LATENCY; i++) {
+        if (crypto[i].left) return false;
+    }
+    return true;
+}
 
-    if (cpu->core.PC >= INSTR_MEM_SIZE) {
-        cpu->core.PC = INSTR_MEM_SIZE;
-        return;
+int pipeline_empty(const PipeCpu *p) {
+    uint8_t if_op = p->if_id.d.opcode;
+    return crypto_idle(p->crypto) && ((if_op == OPC_NOP || if_op == OPC_HLT) &&
+            (p->id_ex.d.opcode == OPC_NOP || p->id_ex.d.opcode == OPC_HLT) &&
+            (p->ex_mem.d.opcode == OPC_NOP || p->ex_mem.d.opcode == OPC_HLT) &&
+            (p->mem_wb.d.opcode == OPC_NOP || p->mem_wb.d.opcode == OPC_HLT));
+}
+
+static bool is_crypto(const DecodedInstr *d) {
+    return d->opcode == OPC_ENC || d->opcode == OPC_DEC ||
+           (d->opcode == OPC_VEC && (d->f3 == VOP_ENC || d->f3 == VOP_DEC));
+}
+
+// Vector register an instruction reads (VENC/VDEC in EX, VST in MEM), -1 if none
+static int vec_src(const DecodedInstr *d) {
+    if (d->opcode != OPC_VEC) return -1;
+    return (d->f3 == VOP_ST || d->f3 == VOP_ENC || d->f3 == VOP_DEC) ? d->f2 : -1;
+}
+
+// Vector register an instruction writes (VLD in MEM, VENC/VDEC leaving the crypto unit), -1 if none
+static int vec_dst(const DecodedInstr *d) {
+    if (d->opcode != OPC_VEC) return -1;
+    if (d->f3 == VOP_LD) return d->f2;
+    return (d->f3 == VOP_ENC || d->f3 == VOP_DEC) ? d->f1 : -1;
+}
+
+// Registers an instruction reads in ID (f3 overlaps imm6, so only ADD reads it)
+static int src_regs(const DecodedInstr *d, uint8_t src[2]) {
+    switch (d->opcode) {
+        case OPC_LD:
+        case OPC_LDK:
+        case OPC_ADDI:
+        case OPC_SETB:
+        case OPC_ENC:
+        case OPC_DEC:
+        case OPC_LDP:
+            src[0] = d->f2;
+            return 1;
+        case OPC_ST:                          // base, data
+        case OPC_STP:
+            src[0] = d->f2;
+            src[1] = d->f1;
+            return 2;
+        case OPC_ADD:
+        case OPC_XOR:
+            src[0] = d->f2;
+            src[1] = d->f3;
+            return 2;
+        case OPC_LOOP:                        // trip count
+            src[0] = d->f1;
+            return 1;
+        case OPC_BNE:
+            src[0] = d->f1;
+            src[1] = d->f2;
+            return 2;
+        case OPC_VEC:
+            if (d->f3 == VOP_SETVL) {
+                src[0] = d->f2;
+                return 1;
+            }
+            if (d->f3 == VOP_LD || d->f3 == VOP_ST || d->f3 == VOP_ADDVL) {
+                src[0] = d->f1;                // pointer, advanced by VL
+                return 1;
+            }
+            return 0;
+        default:
+            return 0;
     }
+}
 
-    MEM_WB mem_wb_prev = cpu->mem_wb;
-    EX_MEM ex_mem_prev = cpu->ex_mem;
+// Forwarding sources for a register read in ID: ex is an instruction that just
+// went through EX this cycle, mem one that just went through MEM (WB already
+// wrote the register file at the start of the cycle). A load in ex never gets
+// here (the consumer stalls instead).
+static bool fwd_from_ex(const EX_MEM *ex, uint8_t reg, uint16_t *val) {
+    if (writes_reg_file(&ex->d) && ex->d.f1 == reg) {
+        *val = ex->alu_result;
+        return true;
+    }
+    if (writes_base(&ex->d) && ex->d.f2 == reg) {
+        *val = ex->base_val;
+        return true;
+    }
+    return false;
+}
 
-    // WRITE-BACK
-    DecodedInstr wb = mem_wb_prev.d;
-    if (wb.opcode == OPC_LD || wb.opcode == OPC_ADDI || wb.opcode == OPC_ENC || wb.opcode == OPC_DEC) {
-        cpu->core.R[wb.f1] = mem_wb_prev.write_val;
-    } else if (wb.opcode == OPC_LDK) {
-        if (wb.f1 == 6) cpu->core.K0 = mem_wb_prev.write_val;
-        else if (wb.f1 == 7) cpu->core.K1 = mem_wb_prev.write_val;
+static bool fwd_from_mem(const MEM_WB *mem, uint8_t reg, uint16_t *val) {
+    if (writes_reg_file(&mem->d) && mem->d.f1 == reg) {
+        *val = mem->write_val;
+        return true;
+    }
+    if (writes_base(&mem->d) && mem->d.f2 == reg) {
+        *val = mem->base_val;
+        return true;
     }
+    return false;
+}
 
-    // MEM stage
-    MEM_WB next_wb = mem_wb_prev;
-    next_wb.d = ex_mem_prev.d;
-    next_wb.pc = ex_mem_prev.pc;
-    next_wb.write_val = 0;
+// Read a source register in ID, forwarding from any of the lanes of EX and MEM.
+// ID never lets two lanes of one stage write the same register.
+static uint16_t read_operand(const CpuState *core, PipeCounters *ctr, const EX_MEM *ex, const MEM_WB *mem,
+                             int lanes, uint8_t reg) {
+    uint16_t v;
+    for (int l = 0; l < lanes; l++) {
+        if (fwd_from_ex(&ex[l], reg, &v)) {
+            ctr->fwd_ex_mem++;
+            return v;
+        }
+    }
+    for (int l = 0; l < lanes; l++) {
+        if (fwd_from_mem(&mem[l], reg, &v)) {
+            ctr->fwd_mem_wb++;
+            return v;
+        }
+    }
+    return core->R[reg];
+}
+
+// True if the instruction in ID needs the result of the load now in EX
+static bool load_use(const DecodedInstr *id, const DecodedInstr *ex) {
+    if (ex->opcode == OPC_LDK) return is_crypto(id);                    // reads K in EX
+    if (ex->opcode == OPC_VEC && ex->f3 == VOP_LD)                      // VENC/VDEC read V in EX
+        return is_crypto(id) && vec_src(id) == ex->f2;
+    if (ex->opcode != OPC_LD && ex->opcode != OPC_LDP) return false;
+    uint8_t src[2];
+    int n = src_regs(id, src);
+    for (int i = 0; i < n; i++) {
+        if (src[i] == ex->f1) return true;
+    }
+    return false;
+}
+
+// Why the instruction in ID cannot leave next cycle because of the crypto unit.
+// Called after EX, so a slot with left == k finishes k cycles from now.
+#define CRYPTO_OK     0
+#define CRYPTO_DEP    1     // reads or writes a register (or V register) an in-flight ENC/DEC will write
+#define CRYPTO_STRUCT 2     // unit busy (iterative), or its next result claims EX/MEM
 
-    switch (ex_mem_prev.d.opcode) {
+// lane_left: an EX/MEM lane stays free next cycle for an op leaving the unit
+static int crypto_hazard(const Machine *m, const CryptoSlot *crypto, const DecodedInstr *id, bool lane_left) {
+    uint8_t op = id->opcode;
+    if (op == OPC_NOP) return CRYPTO_OK;
+    uint8_t src[2];
+    int n = src_regs(id, src);
+    int vsrc = vec_src(id), vdst = vec_dst(id);
+    bool completes_next = false, busy = false;
+    for (int i = 0; i < CRYPTO_MAX_LATENCY; i++) {
+        const CryptoSlot *s = &crypto[i];
+        if (!s->left) continue;
+        busy = true;
+        if (s->left == 1) completes_next = true;
+        if (s->out.d.opcode == OPC_VEC) {
+            if (vsrc == s->out.d.f1 || vdst == s->out.d.f1) return CRYPTO_DEP;
+            continue;
+        }
+        for (int j = 0; j < n; j++) {
+            if (src[j] == s->out.d.f1) return CRYPTO_DEP;
+        }
+        if (writes_reg_file(id) && id->f1 == s->out.d.f1) return CRYPTO_DEP;
+        if (writes_base(id) && id->f2 == s->out.d.f1) return CRYPTO_DEP;
+    }
+    if (is_crypto(id)) return (busy && m->crypto_kind == CRYPTO_UNIT_ITERATIVE) ? CRYPTO_STRUCT : CRYPTO_OK;
+    return (completes_next && !lane_left) ? CRYPTO_STRUCT : CRYPTO_OK;
+}
+
+// ---- Stages (step_pipe runs each once a cycle, step_dual_pipe once per lane) ----
+
+// WB. Returns true if an instruction retired.
+static bool stage_wb(CpuState *core, PipeCounters *ctr, const MEM_WB *in) {
+    const DecodedInstr *wb = &in->d;
+    if (writes_base(wb)) core->R[wb->f2] = in->base_val;
+    if (writes_reg_file(wb)) {
+        core->R[wb->f1] = in->write_val;
+    } else if (wb->opcode == OPC_LDK) {
+        cpu_load_key(core, wb->f1, in->write_val);
+    }
+    if (wb->opcode == OPC_NOP || wb->opcode == OPC_HLT) return false;
+    ctr->retired++;
+    ctr->retired_by_op[wb->opcode]++;
+    return true;
+}
+
+// MEM. Returns false on a memory fault.
+static bool stage_mem(Machine *m, CpuState *core, const EX_MEM *in, MEM_WB *out) {
+    out->d = in->d;
+    out->pc = in->pc;
+    out->write_val = 0;
+    out->base_val = in->base_val;
+
+    switch (in->d.opcode) {
         case OPC_LD:
         case OPC_LDK:
-            if (ex_mem_prev.alu_result >= DATA_MEM_SIZE) { cpu->core.PC = INSTR_MEM_SIZE; return; }
-            next_wb.write_val = data_mem[ex_mem_prev.alu_result];
+            if (!check_ea(m, in->mem_addr, in->d.opcode == OPC_LD ? "LD" : "LDK")) return false;
+            out->write_val = m->data_mem[in->mem_addr];
             break;
         case OPC_ST:
-            if (ex_mem_prev.alu_result >= DATA_MEM_SIZE) { cpu->core.PC = INSTR_MEM_SIZE; return; }
-            data_mem[ex_mem_prev.alu_result] = ex_mem_prev.rs2_val;
+            if (!check_ea(m, in->mem_addr, "ST")) return false;
+            m->data_mem[in->mem_addr] = in->rs2_val;
+            break;
+        case OPC_LDP:
+            if (!check_ea(m, in->mem_addr, "LDP")) return false;
+            out->write_val = m->data_mem[in->mem_addr];
+            break;
+        case OPC_STP:
+            if (!check_ea(m, in->mem_addr, "STP")) return false;
+            m->data_mem[in->mem_addr] = in->rs2_val;
             break;
+        case OPC_ADD:
+        case OPC_XOR:
         case OPC_ADDI:
         case OPC_ENC:
         case OPC_DEC:
-            next_wb.write_val = ex_mem_prev.alu_result;
+            out->write_val = in->alu_result;
             break;
+        case OPC_VEC: {
+            // VLD/VST move all their lanes through a VL-word port
+            uint8_t vop = in->d.f3;
+            uint32_t ea = in->mem_addr;
+            uint16_t vl = in->vl;
+            if (vop == VOP_LD || vop == VOP_ST) {
+                if (vl && !check_ea(m, ea + vl - 1, vop == VOP_LD ? "VLD" : "VST")) return false;
+                uint16_t *v = core->V[in->d.f2];
+                if (vop == VOP_LD) memcpy(v, &m->data_mem[ea], vl * sizeof(uint16_t));
+                else memcpy(&m->data_mem[ea], v, vl * sizeof(uint16_t));
+            }
+            out->write_val = in->alu_result;
+            break;
+        }
         default:
             break;
     }
-    cpu->mem_wb = next_wb;
+    return true;
+}
 
-    // EX stage
-    ID_EX prev_id = cpu->id_ex;
-    EX_MEM next_ex;
-    next_ex.d = prev_id.d;
-    next_ex.pc = prev_id.pc;
-    next_ex.rs2_val = prev_id.rs2_val;
-    next_ex.branch_taken = false;
-    next_ex.branch_target = cpu->core.PC;
-    next_ex.alu_result = 0;
-
-    switch (prev_id.d.opcode) {
+// Extra cycles the data cache (with its prefetcher and store buffer) adds to
+// the access in EX/MEM, looked up at cycle now
+static int dcache_latency(Machine *m, Cache *dc, const EX_MEM *in, uint64_t now) {
+    switch (in->d.opcode) {
+        case OPC_LD:
+        case OPC_LDK:
+        case OPC_LDP:
+            return cache_pipe_access(dc, &m->dcache, in->pc, in->mem_addr, 1, 0, now);
+        case OPC_ST:
+        case OPC_STP:
+            return cache_pipe_access(dc, &m->dcache, in->pc, in->mem_addr, 1, 1, now);
+        case OPC_VEC:
+            if (in->d.f3 != VOP_LD && in->d.f3 != VOP_ST) return 0;
+            return cache_pipe_access(dc, &m->dcache, in->pc, in->mem_addr, in->vl, in->d.f3 == VOP_ST, now);
+        default:
+            return 0;
+    }
+}
+
+// Runs before MEM: the first cycle an access sits in EX/MEM it is looked up,
+// and a miss then holds MEM for the latency. Returns true if this cycle stalls.
+static bool dcache_stall(Machine *m, Cache *dc, int *wait, bool *done, const EX_MEM *lanes, int n,
+                         PipeCounters *ctr) {
+    if (!cache_enabled(&m->dcache)) return false;
+    if (!*done) {
+        *done = true;
+        for (int l = 0; l < n; l++) *wait += dcache_latency(m, dc, &lanes[l], ctr->cycles);
+    }
+    if (*wait == 0) {
+        *done = false;      // MEM goes ahead and takes the next access
+        return false;
+    }
+    (*wait)--;
+    ctr->dcache_stalls++;
+    return true;
+}
+
+// EX. ENC/DEC leave for the crypto unit and put a bubble in *out. Returns true
+// if fetch went the wrong way and has to restart at *redirect_pc.
+static bool stage_ex(Machine *m, CpuState *core, CryptoSlot *crypto, BranchPredictor *bp, PipeCounters *ctr,
+                     const ID_EX *in, EX_MEM *out, uint16_t *redirect_pc) {
+    out->d = in->d;
+    out->pc = in->pc;
+    out->rs2_val = in->rs2_val;
+    out->base_val = 0;
+    out->vl = 0;
+    out->branch_taken = false;
+    out->branch_target = core->PC;
+    out->alu_result = 0;
+    out->mem_addr = 0;
+
+    switch (in->d.opcode) {
         case OPC_LD:
         case OPC_ST:
-        case OPC_ADDI:
         case OPC_LDK:
-            next_ex.alu_result = (uint16_t)(prev_id.rs_val + prev_id.d.imm6);
+            out->alu_result = (uint16_t)(in->rs_val + in->d.imm6);
+            out->mem_addr = PHYS_ADDR(core->DB, out->alu_result);
+            break;
+        case OPC_ADDI:
+            out->alu_result = (uint16_t)(in->rs_val + in->d.imm6);
+            break;
+        case OPC_ADD:
+            out->alu_result = (uint16_t)(in->rs_val + in->rs2_val);
+            break;
+        case OPC_XOR:
+            out->alu_result = (uint16_t)(in->rs_val ^ in->rs2_val);
+            break;
+        case OPC_LDP:
+        case OPC_STP:
+            // Address is the base itself; the incremented base forwards from here
+            out->mem_addr = PHYS_ADDR(core->DB, in->rs_val);
+            out->base_val = (uint16_t)(in->rs_val + in->d.imm6);
+            break;
+        case OPC_SETB:
+            // Bank switch takes effect in EX so the next LD/ST's address already uses it
+            core->DB = (uint16_t)(in->rs_val + in->d.imm6);
             break;
         case OPC_ENC:
-            next_ex.alu_result = enc_func(prev_id.rs_val, cpu->core.K0, cpu->core.K1);
+        case OPC_DEC: {
+            // Issue to the crypto unit (round keys are read now); EX/MEM gets a bubble
+            // unless the result is ready this cycle
+            CryptoSlot *slot = crypto;
+            while (slot->left) slot++;      // ID never lets more than the latency in
+            slot->out = *out;
+            slot->out.alu_result = in->d.opcode == OPC_ENC
+                ? codebook_enc(&m->codebook, in->rs_val, &core->ks)
+                : codebook_dec(&m->codebook, in->rs_val, &core->ks);
+            slot->left = m->crypto_latency;
+            out->d = NOP_DECODED;
             break;
-        case OPC_DEC:
-            next_ex.alu_result = dec_func(prev_id.rs_val, cpu->core.K0, cpu->core.K1);
+        }
+        case OPC_VEC:
+            switch (in->d.f3) {
+                case VOP_SETVL:
+                    // VL is set in EX (like DB) so the vector ops right behind see it
+                    core->VL = in->rs_val < m->vlen ? in->rs_val : (uint16_t)m->vlen;
+                    out->alu_result = (uint16_t)(in->rs_val - core->VL);
+                    break;
+                case VOP_LD:
+                case VOP_ST:
+                    out->mem_addr = PHYS_ADDR(core->DB, in->rs_val);
+                    out->vl = core->VL;
+                    out->alu_result = (uint16_t)(in->rs_val + core->VL);
+                    break;
+                case VOP_ADDVL:
+                    out->alu_result = (uint16_t)(in->rs_val + core->VL);
+                    break;
+                case VOP_ENC:
+                case VOP_DEC: {
+                    // All lanes go through the crypto unit side by side, as one op
+                    CryptoSlot *slot = crypto;
+                    while (slot->left) slot++;
+                    const uint16_t *src = core->V[in->d.f2];
+                    slot->out = *out;
+                    slot->lanes = core->VL;
+                    for (int i = 0; i < slot->lanes; i++) {
+                        slot->vout[i] = in->d.f3 == VOP_ENC
+                            ? codebook_enc(&m->codebook, src[i], &core->ks)
+                            : codebook_dec(&m->codebook, src[i], &core->ks);
+                    }
+                    slot->left = m->crypto_latency;
+                    out->d = NOP_DECODED;
+                    break;
+                }
+                default:
+                    break;
+            }
             break;
         case OPC_BNE:
-            if (prev_id.rs_val != prev_id.rs2_val) {
-                next_ex.branch_taken = true;
-                next_ex.branch_target = (uint16_t)(prev_id.pc + 1 + prev_id.d.imm6); // PC+1 semantics
+            // Targets are PC-relative, so a predicted-taken fetch already went to the
+            // right place: only the direction can be wrong
+            out->branch_taken = in->rs_val != in->rs2_val;
+            out->branch_target = (uint16_t)(in->pc + 1 + in->d.imm6); // PC+1 semantics
+            ctr->branches++;
+            bp_update(bp, m->bp_kind, in->pc, out->branch_taken, out->branch_target);
+            if (out->branch_taken != in->pred_taken) {
+                ctr->mispredicts++;
+                ctr->flushes++;
+                *redirect_pc = out->branch_taken ? out->branch_target : (uint16_t)(in->pc + 1);
+                return true;
             }
             break;
         case OPC_HLT:
-            next_ex.branch_taken = true;
-            next_ex.branch_target = INSTR_MEM_SIZE;
-            break;
+            out->branch_taken = true;
+            out->branch_target = INSTR_MEM_SIZE;
+            *redirect_pc = INSTR_MEM_SIZE;
+            return true;
         default:
             break;
     }
+    return false;
+}
 
-    if (next_ex.branch_taken) {
-        cpu->core.PC = next_ex.branch_target;
+// Advance the crypto unit a cycle. The op finishing its last stage takes a
+// free EX/MEM lane (ID kept one free for it).
+static void crypto_advance(CpuState *core, CryptoSlot *crypto, PipeCounters *ctr, EX_MEM *lanes, int n) {
+    bool busy = false;
+    for (int i = 0; i < CRYPTO_MAX_LATENCY; i++) {
+        CryptoSlot *slot = &crypto[i];
+        if (!slot->left) continue;
+        busy = true;
+        if (--slot->left == 0) {
+            int l = 0;
+            while (l < n - 1 && lanes[l].d.opcode != OPC_NOP) l++;
+            lanes[l] = slot->out;
+            if (slot->out.d.opcode == OPC_VEC)
+                memcpy(core->V[slot->out.d.f1], slot->vout, slot->lanes * sizeof(uint16_t));
+        }
     }
+    if (busy) ctr->crypto_busy++;
+}
+
+static void id_bubble(ID_EX *out, uint16_t pc) {
+    out->d = NOP_DECODED;
+    out->pc = pc;
+    out->rs_val = 0;
+    out->rs2_val = 0;
+    out->pred_taken = false;
+}
+
+// ID for an instruction that is leaving IF/ID this cycle: operands are read
+// (and forwarded) now, and a LOOP sets up the hardware loop before IF runs
+static void stage_id(CpuState *core, PipeCounters *ctr, const IF_ID *in, ID_EX *out,
+                     const EX_MEM *ex, const MEM_WB *mem, int lanes) {
+    if (in->d.opcode == OPC_NOP) {
+        id_bubble(out, in->pc);
+        return;
+    }
+    const DecodedInstr d = in->d;
+    uint8_t src[2] = {0, 0};
+    int n = src_regs(&d, src);
+    out->d = d;
+    out->pc = in->pc;
+    out->pred_taken = in->pred_taken;
+    // rs_val: base / ALU operand (BNE: first compare operand); rs2_val: store data / second compare operand
+    out->rs_val  = n > 0 ? read_operand(core, ctr, ex, mem, lanes, src[0]) : 0;
+    out->rs2_val = n > 1 ? read_operand(core, ctr, ex, mem, lanes, src[1]) : 0;
+    if (d.opcode == OPC_LOOP) {
+        // IF is fetching the body start this cycle (or the end of a one-instruction
+        // body); an empty loop skips the body instead
+        core->LC = out->rs_val;
+        core->LS = (uint16_t)(in->pc + 1);
+        core->LE = (uint16_t)(in->pc + d.imm6);
+        if (core->LC == 0) core->PC = (uint16_t)(core->LE + 1);
+    }
+}
+
+// IF: one instruction at PC, following the predictor and the hardware loop
+static IF_ID fetch(const Machine *m, CpuState *core, const BranchPredictor *bp) {
+    IF_ID f;
+    f.pc = core->PC;
+    f.pred_taken = false;
+    f.loop_end = false;
+    if (core->PC >= INSTR_MEM_SIZE) {
+        f.instr = (OPC_HLT << 12);
+        f.d     = HLT_DECODED;
+        return f;
+    }
+    uint16_t target;
+    f.instr = m->instr_mem[core->PC];
+    f.d     = m->decoded_mem[core->PC];
+    if (f.d.opcode == OPC_BNE && bp_predict(bp, m->bp_kind, core->PC, &f.d, &target)) {
+        f.pred_taken = true;
+        core->PC = target;
+    } else {
+        core->PC++;
+    }
+    if (core->LC && f.pc == core->LE) {
+        f.loop_end = true;
+        if (--core->LC) core->PC = core->LS;
+    }
+    return f;
+}
+
+// A squashed fetch that counted the hardware loop down gives the iteration back
+static void squash(CpuState *core, PipeCounters *ctr, const IF_ID *f) {
+    if (f->d.opcode != OPC_NOP && f->d.opcode != OPC_HLT) ctr->squashed++;
+    if (f->loop_end) core->LC++;
+}
+
+// Memory fault: stop fetching and drop everything in flight
+static void pipe_fault(PipeCpu *cpu) {
+    memset(cpu->crypto, 0, sizeof(cpu->crypto));
+    cpu->core.PC = INSTR_MEM_SIZE;
+    cpu->if_id.d = HLT_DECODED;
+    cpu->id_ex.d = NOP_DECODED;
+    cpu->ex_mem.d = NOP_DECODED;
+    cpu->mem_wb.d = NOP_DECODED;
+}
+
+void step_pipe(Machine *m, PipeCpu *cpu) {
+    cpu->cycle++;
+    cpu->stalled = 0;
+    cpu->ctr.cycles++;
+
+    // WRITE-BACK
+    if (!stage_wb(&cpu->core, &cpu->ctr, &cpu->mem_wb)) cpu->ctr.bubbles++;
+
+    // A data cache miss freezes MEM and everything behind it; WB gets bubbles
+    if (dcache_stall(m, &cpu->dcache, &cpu->dcache_wait, &cpu->dcache_done, &cpu->ex_mem, 1, &cpu->ctr)) {
+        cpu->mem_wb.d = NOP_DECODED;
+        return;
+    }
+
+    // MEM stage
+    MEM_WB next_wb;
+    if (!stage_mem(m, &cpu->core, &cpu->ex_mem, &next_wb)) {
+        pipe_fault(cpu);
+        return;
+    }
+    cpu->mem_wb = next_wb;
+
+    // EX stage; the crypto op finishing its last stage takes EX/MEM (ID kept it free)
+    ID_EX prev_id = cpu->id_ex;
+    EX_MEM next_ex;
+    uint16_t redirect_pc = 0;
+    bool redirect = stage_ex(m, &cpu->core, cpu->crypto, &cpu->bp, &cpu->ctr, &prev_id, &next_ex, &redirect_pc);
+    crypto_advance(&cpu->core, cpu->crypto, &cpu->ctr, &next_ex, 1);
     cpu->ex_mem = next_ex;
 
-    // Hazard detection (load-use)
-    bool stall = false;
+    // A mispredicted branch (or HLT) squashes the instruction fetched behind it
+    // (now in IF/ID) and fetch restarts on the right path this cycle
     IF_ID prev_if = cpu->if_id;
-    if (!is_nop_instr(prev_if.instr)) {
-        DecodedInstr idd = decode(prev_if.instr);
-        uint8_t s1 = idd.f2;
-        uint8_t s2 = idd.f3;
-        if (idd.opcode == OPC_BNE) { s1 = idd.f1; s2 = idd.f2; }
-        if (ex_mem_prev.d.opcode == OPC_LD) {
-            uint8_t ld_rd = ex_mem_prev.d.f1;
-            if (ld_rd == s1 || ld_rd == s2) stall = true;
-        }
+    bool flush = redirect;
+    if (flush) {
+        cpu->core.PC = redirect_pc;
+        squash(&cpu->core, &cpu->ctr, &prev_if);
+    }
+
+    // Hazard detection: load-use, then the crypto unit
+    bool stall = false;
+    if (!flush && load_use(&prev_if.d, &prev_id.d)) {
+        stall = true;
+        cpu->stalled = 1;
+        cpu->ctr.load_use_stalls++;
+    } else if (!flush) {
+        int h = crypto_hazard(m, cpu->crypto, &prev_if.d, false);
+        if (h == CRYPTO_DEP) cpu->ctr.crypto_dep_stalls++;
+        else if (h == CRYPTO_STRUCT) cpu->ctr.crypto_struct_stalls++;
+        stall = h != CRYPTO_OK;
     }
 
     // ID stage
-    ID_EX next_id = cpu->id_ex;
-    if (stall) {
-        next_id.d.opcode = OPC_NOP;
-        next_id.rs_val = 0;
-        next_id.rs2_val = 0;
-        next_id.pc = prev_if.pc;
-    } else {
-        if (is_nop_instr(prev_if.instr)) {
-            next_id.d.opcode = OPC_NOP;
-            next_id.rs_val = 0;
-            next_id.rs2_val = 0;
-            next_id.pc = prev_if.pc;
+    if (stall || flush) id_bubble(&cpu->id_ex, prev_if.pc);
+    else stage_id(&cpu->core, &cpu->ctr, &prev_if, &cpu->id_ex, &next_ex, &next_wb, 1);
+
+    // IF stage
+    if (stall) return;
+    cpu->if_id = fetch(m, &cpu->core, &cpu->bp);
+}
+
+// ---- Dual issue ----
+
+void init_dual_pipe_cpu(DualPipeCpu *cpu) {
+    memset(cpu, 0, sizeof(*cpu));
+    init_cpu(&cpu->core);
+    bp_reset(&cpu->bp);
+    for (int l = 0; l < ISSUE_WIDTH_MAX; l++) {
+        cpu->if_id[l].instr = (OPC_NOP << 12);
+        cpu->if_id[l].d = NOP_DECODED;
+        cpu->id_ex[l].d = NOP_DECODED;
+        cpu->ex_mem[l].d = NOP_DECODED;
+        cpu->mem_wb[l].d = NOP_DECODED;
+    }
+}
+
+static bool idle_op(uint8_t op) {
+    return op == OPC_NOP || op == OPC_HLT;
+}
+
+int dual_pipeline_empty(const DualPipeCpu *p) {
+    if (!crypto_idle(p->crypto)) return 0;
+    for (int l = 0; l < ISSUE_WIDTH_MAX; l++) {
+        if (!idle_op(p->if_id[l].d.opcode) || !idle_op(p->id_ex[l].d.opcode) ||
+            !idle_op(p->ex_mem[l].d.opcode) || !idle_op(p->mem_wb[l].d.opcode)) return 0;
+    }
+    return 1;
+}
+
+static bool uses_mem_port(const DecodedInstr *d) {
+    switch (d->opcode) {
+        case OPC_LD:
+        case OPC_ST:
+        case OPC_LDK:
+        case OPC_LDP:
+        case OPC_STP:
+            return true;
+        case OPC_VEC:
+            return d->f3 == VOP_LD || d->f3 == VOP_ST;
+        default:
+            return false;
+    }
+}
+
+static bool writes_reg(const DecodedInstr *d, uint8_t reg) {
+    return (writes_reg_file(d) && d->f1 == reg) || (writes_base(d) && d->f2 == reg);
+}
+
+#define PAIR_OK     0
+#define PAIR_DEP    1
+#define PAIR_STRUCT 2
+#define PAIR_CTRL   3
+#define PAIR_STALL  4
+
+// Can b leave ID together with a (the older of the two, already cleared to issue)?
+static int pair_check(const Machine *m, const DualPipeCpu *cpu, const DecodedInstr *a, const DecodedInstr *b) {
+    if (b->opcode == OPC_NOP) return PAIR_OK;
+    if (a->opcode == OPC_BNE || a->opcode == OPC_LOOP || a->opcode == OPC_HLT) return PAIR_CTRL;
+
+    // Nothing forwards between the two lanes of a pair
+    uint8_t src[2];
+    int n = src_regs(b, src);
+    for (int i = 0; i < n; i++) {
+        if (writes_reg(a, src[i])) return PAIR_DEP;
+    }
+    if ((writes_reg_file(b) && writes_reg(a, b->f1)) || (writes_base(b) && writes_reg(a, b->f2))) return PAIR_DEP;
+    if (a->opcode == OPC_LDK && is_crypto(b)) return PAIR_DEP;
+    int adst = vec_dst(a), asrc = vec_src(a);
+    if (adst >= 0 && (adst == vec_src(b) || adst == vec_dst(b))) return PAIR_DEP;
+    if (asrc >= 0 && asrc == vec_dst(b)) return PAIR_DEP;   // VST reads in MEM, after a fast VENC wrote
+
+    if (uses_mem_port(a) && uses_mem_port(b)) return PAIR_STRUCT;
+    if (is_crypto(a) && is_crypto(b)) return PAIR_STRUCT;
+
+    // Older instructions in flight, as for a
+    for (int l = 0; l < ISSUE_WIDTH_MAX; l++) {
+        if (load_use(b, &cpu->id_ex[l].d)) return PAIR_STALL;
+    }
+    int h = crypto_hazard(m, cpu->crypto, b, is_crypto(a));
+    if (h == CRYPTO_DEP || (h == CRYPTO_STRUCT && is_crypto(b))) return PAIR_STALL;
+    if (h == CRYPTO_STRUCT) return PAIR_STRUCT;    // the unit's next result needs b's lane
+    return PAIR_OK;
+}
+
+static void dual_fault(DualPipeCpu *cpu) {
+    memset(cpu->crypto, 0, sizeof(cpu->crypto));
+    cpu->core.PC = INSTR_MEM_SIZE;
+    for (int l = 0; l < ISSUE_WIDTH_MAX; l++) {
+        cpu->if_id[l].d = HLT_DECODED;
+        cpu->id_ex[l].d = NOP_DECODED;
+        cpu->ex_mem[l].d = NOP_DECODED;
+        cpu->mem_wb[l].d = NOP_DECODED;
+    }
+    cpu->if_n = ISSUE_WIDTH_MAX;
+}
+
+void step_dual_pipe(Machine *m, DualPipeCpu *cpu) {
+    enum { W = ISSUE_WIDTH_MAX };
+    cpu->cycle++;
+    cpu->stalled = 0;
+    cpu->ctr.cycles++;
+
+    // WRITE-BACK (ID never lets two lanes of a stage write the same register)
+    bool retired = false;
+    for (int l = 0; l < W; l++) retired |= stage_wb(&cpu->core, &cpu->ctr, &cpu->mem_wb[l]);
+    if (!retired) cpu->ctr.bubbles++;
+
+    if (dcache_stall(m, &cpu->dcache, &cpu->dcache_wait, &cpu->dcache_done, cpu->ex_mem, W, &cpu->ctr)) {
+        for (int l = 0; l < W; l++) cpu->mem_wb[l].d = NOP_DECODED;
+        return;
+    }
+
+    // MEM: at most one lane has an access
+    MEM_WB next_wb[W];
+    for (int l = 0; l < W; l++) {
+        if (!stage_mem(m, &cpu->core, &cpu->ex_mem[l], &next_wb[l])) {
+            dual_fault(cpu);
+            return;
+        }
+    }
+    memcpy(cpu->mem_wb, next_wb, sizeof(next_wb));
+
+    // EX, older lane first so a SETB or VSETVL reaches the lane behind it.
+    // Only the younger lane can redirect (BNE and HLT close a pair).
+    ID_EX prev_id[W];
+    EX_MEM next_ex[W];
+    memcpy(prev_id, cpu->id_ex, sizeof(prev_id));
+    uint16_t redirect_pc = 0;
+    bool redirect = false;
+    for (int l = 0; l < W; l++) {
+        redirect |= stage_ex(m, &cpu->core, cpu->crypto, &cpu->bp, &cpu->ctr, &prev_id[l], &next_ex[l], &redirect_pc);
+    }
+    crypto_advance(&cpu->core, cpu->crypto, &cpu->ctr, next_ex, W);
+    memcpy(cpu->ex_mem, next_ex, sizeof(next_ex));
+
+    // A redirect squashes the whole fetch buffer
+    if (redirect) {
+        cpu->core.PC = redirect_pc;
+        for (int i = 0; i < cpu->if_n; i++) squash(&cpu->core, &cpu->ctr, &cpu->if_id[i]);
+        cpu->if_n = 0;
+    }
+
+    // ID: the oldest entry under the scalar rules, then the next one if it pairs
+    int issued = 0;
+    ID_EX next_id[W];
+    for (int l = 0; l < W; l++) id_bubble(&next_id[l], cpu->if_id[l].pc);
+    if (cpu->if_n > 0) {
+        const DecodedInstr *a = &cpu->if_id[0].d;
+        bool lu = false;
+        for (int l = 0; l < W; l++) lu |= load_use(a, &prev_id[l].d);
+        int h = lu ? CRYPTO_OK : crypto_hazard(m, cpu->crypto, a, true);
+        if (lu) {
+            cpu->stalled = 1;
+            cpu->ctr.load_use_stalls++;
+        } else if (h == CRYPTO_DEP) {
+            cpu->ctr.crypto_dep_stalls++;
+        } else if (h == CRYPTO_STRUCT) {
+            cpu->ctr.crypto_struct_stalls++;
         } else {
-            DecodedInstr d = decode(prev_if.instr);
-            next_id.d = d;
-            next_id.pc = prev_if.pc;
-            if (d.opcode == OPC_BNE) {
-                next_id.rs_val  = forward_val(cpu, &ex_mem_prev, &mem_wb_prev, d.f1);
-                next_id.rs2_val = forward_val(cpu, &ex_mem_prev, &mem_wb_prev, d.f2);
-            } else if (d.opcode == OPC_ST) {
-                next_id.rs_val  = forward_val(cpu, &ex_mem_prev, &mem_wb_prev, d.f2);
-                next_id.rs2_val = forward_val(cpu, &ex_mem_prev, &mem_wb_prev, d.f1);
-            } else {
-                next_id.rs_val  = forward_val(cpu, &ex_mem_prev, &mem_wb_prev, d.f2);
-                next_id.rs2_val = forward_val(cpu, &ex_mem_prev, &mem_wb_prev, d.f3);
+            issued = 1;
+            if (cpu->if_n > 1) {
+                const DecodedInstr *b = &cpu->if_id[1].d;
+                int why = pair_check(m, cpu, a, b);
+                bool counted = !idle_op(a->opcode) && !idle_op(b->opcode);
+                if (why == PAIR_OK) {
+                    issued = 2;
+                    if (counted) cpu->ctr.issue_pairs++;
+                } else if (counted) {
+                    if (why == PAIR_DEP) cpu->ctr.pair_dep_fails++;
+                    else if (why == PAIR_STRUCT) cpu->ctr.pair_struct_fails++;
+                    else if (why == PAIR_CTRL) cpu->ctr.pair_ctrl_fails++;
+                    else cpu->ctr.pair_stall_fails++;
+                }
             }
         }
     }
-    cpu->id_ex = next_id;
+    // In order, so a LOOP in the younger lane sees the older lane's PC effects
+    for (int l = 0; l < issued; l++) {
+        stage_id(&cpu->core, &cpu->ctr, &cpu->if_id[l], &next_id[l], next_ex, next_wb, W);
+    }
+    memcpy(cpu->id_ex, next_id, sizeof(next_id));
 
-    // IF stage
-    IF_ID next_if;
-    next_if.pc = cpu->core.PC;
-    if (cpu->core.PC >= INSTR_MEM_SIZE) {
-        next_if.instr = (OPC_HLT << 12);
-    } else {
-        next_if.instr = instr_mem[cpu->core.PC];
+    // Drain the fetch buffer, then refill it
+    for (int i = issued; i < cpu->if_n; i++) cpu->if_id[i - issued] = cpu->if_id[i];
+    cpu->if_n -= issued;
+    for (int i = cpu->if_n; i < W; i++) {
+        cpu->if_id[i].d = NOP_DECODED;
+        cpu->if_id[i].loop_end = false;
     }
 
-    if (!stall) {
-        cpu->if_id = next_if;
-        cpu->core.PC++;
+    // IF: up to W more. A LOOP's body is not fetched until ID has set the loop up.
+    // A fetch group also ends where fetch jumps (predicted-taken BNE, loop-back).
+    while (cpu->if_n < W) {
+        if (cpu->if_n > 0 && cpu->if_id[cpu->if_n - 1].d.opcode == OPC_LOOP) break;
+        IF_ID f = fetch(m, &cpu->core, &cpu->bp);
+        cpu->if_id[cpu->if_n++] = f;
+        if (f.pred_taken || (f.loop_end && cpu->core.LC)) break;
     }
 }
-
@@ -3,6 +3,9 @@
 
 #include <stdbool.h>
 #include "isa.h"
+#include "perf.h"
+#include "bp.h"
+#include "cache.h"
 
 // ---- Pipeline register structs ----
 
@@ -10,6 +13,9 @@
 typedef struct {
     uint16_t instr;  // raw 16-bit instruction
     uint16_t pc;     // PC of this instruction
+    DecodedInstr d;  // pre-decoded form of instr (from decoded_mem)
+    bool pred_taken; // fetch followed the predicted-taken target of this BNE
+    bool loop_end;   // fetch counted the hardware loop down here (undone if squashed)
 } IF_ID;
 
 // ID/EX: carries decoded instruction + operand values
@@ -18,6 +24,7 @@ typedef struct {
     uint16_t pc;     // PC of this instruction
     uint16_t rs_val;   // value of rs    (f2)
     uint16_t rs2_val;  // value of rs2   (f3) - for ST/BNE
+    bool pred_taken;   // carried from IF/ID, checked when a BNE resolves
 } ID_EX;
 
 // EX/MEM: carries ALU results, branch info, and store data
@@ -25,7 +32,10 @@ typedef struct {
     DecodedInstr d;
     uint16_t pc;
     uint16_t alu_result;    // EA for LD/ST, result for ADDI/ENC/DEC/LDK
-    uint16_t rs2_val;       // store data for ST
+    uint32_t mem_addr;      // physical address (DB applied) for LD/ST/LDK
+    uint16_t rs2_val;       // store data for ST/STP
+    uint16_t base_val;      // post-incremented base for LDP/STP
+    uint16_t vl;            // lanes moved by VLD/VST
     bool     branch_taken;
     uint16_t branch_target;
 } EX_MEM;
@@ -35,8 +45,30 @@ typedef struct {
     DecodedInstr d;
     uint16_t pc;
     uint16_t write_val;   // value to write back to reg / key
+    uint16_t base_val;    // post-incremented base for LDP/STP
 } MEM_WB;
 
+// ---- ENC/DEC functional unit ----
+
+#define CRYPTO_MAX_LATENCY 8
+
+typedef enum {
+    CRYPTO_UNIT_PIPELINED = 0,  // one stage per cycle of latency, accepts an op every cycle
+    CRYPTO_UNIT_ITERATIVE = 1   // one op at a time, busy for its whole latency
+} CryptoUnitKind;
+
+// An ENC/DEC in the unit. The result is computed at issue and released from
+// the last stage into EX/MEM, where it is forwarded like any EX result.
+typedef struct {
+    EX_MEM out;
+    uint16_t vout[VLEN_MAX];    // VENC/VDEC: lanes written to V[out.d.f1] on the way out
+    uint16_t lanes;
+    int    left;    // cycles until it leaves the unit (0 = free slot)
+} CryptoSlot;
+
+const char *crypto_unit_name(CryptoUnitKind kind);
+int crypto_unit_parse(const char *name, CryptoUnitKind *out);
+
 // Full pipelined CPU state
 typedef struct {
     CpuState core;  // architectural state: regs, keys, PC
@@ -47,15 +79,76 @@ typedef struct {
     MEM_WB mem_wb;
 
     int cycle;      // current cycle number (for printing)
+    int stalled;    // last step held IF/ID for a load-use hazard
+    PipeCounters ctr;
+    BranchPredictor bp;
+    CryptoSlot crypto[CRYPTO_MAX_LATENCY];
+    Cache dcache;       // L1D tags (geometry and policy: Machine.dcache)
+    int   dcache_wait;  // cycles MEM still has to wait on a miss
+    bool  dcache_done;  // the access in EX/MEM has been looked up
 } PipeCpu;
 
 // Initialise pipeline CPU (clear registers + pipeline regs)
 void init_pipe_cpu(PipeCpu *cpu);
 
-// Simulate one pipeline clock cycle
-void step_pipe(PipeCpu *cpu);
+// Simulate one pipeline clock cycle. Operands are read in ID, forwarded from
+// the instructions in EX and MEM; a consumer right behind a load stalls one
+// cycle. IF follows m->bp_kind's prediction for each BNE; the branch resolves
+// in EX and a misprediction squashes the instruction fetched behind it.
+// LOOP sets up the hardware loop in ID and IF jumps back from the body's end.
+// ENC/DEC leave EX for the crypto unit (m->crypto_kind, m->crypto_latency)
+// so later independent instructions keep flowing; ID holds anything that
+// needs an in-flight result or a unit slot the crypto unit has claimed.
+// With a data cache (m->dcache) a miss in MEM freezes MEM and every stage
+// behind it, the crypto unit included, for the miss latency.
+void step_pipe(Machine *m, PipeCpu *cpu);
 
 // Print which instruction is in IF/ID/EX/MEM/WB for this cycle
 void print_pipe_state(const PipeCpu *cpu);
 
+// True once every pipeline register holds a NOP/HLT bubble
+int pipeline_empty(const PipeCpu *cpu);
+
+// ---- Dual-issue variant (Machine.issue_width == 2) ----
+
+#define ISSUE_WIDTH_MAX 2
+
+// Same five stages, two lanes each; lane 0 holds the older instruction of a
+// pair. IF/ID is a two-entry fetch buffer that IF refills as ID drains it.
+typedef struct {
+    CpuState core;
+
+    IF_ID  if_id[ISSUE_WIDTH_MAX];   // oldest first
+    int    if_n;                     // valid if_id entries
+    ID_EX  id_ex[ISSUE_WIDTH_MAX];
+    EX_MEM ex_mem[ISSUE_WIDTH_MAX];
+    MEM_WB mem_wb[ISSUE_WIDTH_MAX];
+
+    int cycle;
+    int stalled;    // last step held the whole fetch buffer for a load-use hazard
+    PipeCounters ctr;
+    BranchPredictor bp;
+    CryptoSlot crypto[CRYPTO_MAX_LATENCY];
+    Cache dcache;
+    int   dcache_wait;
+    bool  dcache_done;
+} DualPipeCpu;
+
+void init_dual_pipe_cpu(DualPipeCpu *cpu);
+
+// One clock of the 2-wide in-order pipeline. ID issues the oldest buffered
+// instruction under the scalar hazard rules, and the next one with it unless:
+//   - it reads or writes a register (or V register) the first writes (no
+//     forwarding within a pair), or the first is an LDK and it an ENC/DEC;
+//   - both use the data memory port, or both the crypto unit, or the crypto
+//     unit's next result needs the second EX/MEM lane;
+//   - the first is BNE, LOOP or HLT, which always close a pair;
+//   - it waits on an older instruction still in flight.
+// Results forward to both lanes from both lanes of EX/MEM and MEM/WB. IF stops
+// a fetch group at a predicted-taken branch or loop-back, and fetches nothing
+// past a LOOP until ID has set the loop up. Data cache misses stall as in step_pipe.
+void step_dual_pipe(Machine *m, DualPipeCpu *cpu);
+
+int dual_pipeline_empty(const DualPipeCpu *cpu);
+
 #endif // CPU_PIPE_H
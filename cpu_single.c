@@ -1,16 +1,21 @@
 #include <stdio.h>
+#include <string.h>
 #include "isa.h"
 #include "memory.h"
-#include "crypto.h"
-extern int program_size;
+#include "codebook.h"
 
 void init_cpu(CpuState *cpu) {
     cpu->PC = 0;
     cpu->K0 = 0;
     cpu->K1 = 0;
+    key_schedule_init(&cpu->ks, 0, 0);
+    cpu->DB = 0;
+    cpu->LC = cpu->LS = cpu->LE = 0;
     for (int i = 0; i < NUM_REGS; i++) {
         cpu->R[i] = 0;
     }
+    cpu->VL = 0;
+    memset(cpu->V, 0, sizeof(cpu->V));
 }
 
 DecodedInstr decode(uint16_t raw) {
@@ -22,63 +27,141 @@ DecodedInstr decode(uint16_t raw) {
     d.f3     = (raw >> 3) & 0x7;
     uint8_t imm6 = raw & 0x3F;
     d.imm6 = (imm6 & 0x20) ? (int8_t)(imm6 | 0xC0) : (int8_t)imm6;
+    d.handler = NULL;
     return d;
 }
 
-static int check_ea(uint16_t ea, const char *op) {
-    if (ea >= DATA_MEM_SIZE) {
-        fprintf(stderr, "Memory OOB in %s: EA=0x%04X (limit %d)\n", op, ea, DATA_MEM_SIZE);
+// Bounds-check a physical data address (shared with the pipeline's MEM stage)
+int check_ea(const Machine *m, uint32_t ea, const char *op) {
+    if (ea >= m->data_mem_size) {
+        fprintf(stderr, "Memory OOB in %s: EA=0x%05X (limit %u)\n", op, (unsigned)ea, (unsigned)m->data_mem_size);
         return 0;
     }
     return 1;
 }
 
-void step_single(CpuState *cpu) {
-    if (cpu->PC >= INSTR_MEM_SIZE || cpu->PC >= program_size) {
+// Data cache timing for n words at ea; the stall cycles add up in m->cpu_dcache's stats
+static inline void dcache_touch(Machine *m, uint32_t ea, uint32_t n, int write) {
+    if (cache_enabled(&m->dcache)) cache_access_range(&m->cpu_dcache, &m->dcache, ea, n, write);
+}
+
+// One OPC_VEC instruction (PC already advanced). Returns 0 on a memory fault.
+static int step_vec(Machine *m, CpuState *cpu, const DecodedInstr *d) {
+    switch (d->f3) {
+        case VOP_SETVL: {
+            uint16_t n = cpu->R[d->f2];
+            cpu->VL = n < m->vlen ? n : (uint16_t)m->vlen;
+            cpu->R[d->f1] = (uint16_t)(n - cpu->VL);
+            break;
+        }
+        case VOP_LD:
+        case VOP_ST: {
+            uint32_t ea = PHYS_ADDR(cpu->DB, cpu->R[d->f1]);
+            if (cpu->VL && !check_ea(m, ea + cpu->VL - 1, d->f3 == VOP_LD ? "VLD" : "VST")) return 0;
+            dcache_touch(m, ea, cpu->VL, d->f3 == VOP_ST);
+            if (d->f3 == VOP_LD) memcpy(cpu->V[d->f2], &m->data_mem[ea], cpu->VL * sizeof(uint16_t));
+            else memcpy(&m->data_mem[ea], cpu->V[d->f2], cpu->VL * sizeof(uint16_t));
+            cpu->R[d->f1] = (uint16_t)(cpu->R[d->f1] + cpu->VL);
+            break;
+        }
+        case VOP_ENC:
+            for (int i = 0; i < cpu->VL; i++)
+                cpu->V[d->f1][i] = codebook_enc(&m->codebook, cpu->V[d->f2][i], &cpu->ks);
+            break;
+        case VOP_DEC:
+            for (int i = 0; i < cpu->VL; i++)
+                cpu->V[d->f1][i] = codebook_dec(&m->codebook, cpu->V[d->f2][i], &cpu->ks);
+            break;
+        case VOP_ADDVL:
+            cpu->R[d->f1] = (uint16_t)(cpu->R[d->f1] + cpu->VL);
+            break;
+        default:
+            break;
+    }
+    return 1;
+}
+
+void step_single(Machine *m, CpuState *cpu) {
+    if (cpu->PC >= INSTR_MEM_SIZE || cpu->PC >= m->program_size) {
         cpu->PC = INSTR_MEM_SIZE;
         return;
     }
 
-    uint16_t raw = instr_mem[cpu->PC];
-    DecodedInstr d = decode(raw);
+    const uint16_t pc = cpu->PC;
+    const DecodedInstr *d = &m->decoded_mem[pc];
 
     cpu->PC++;
 
-    switch (d.opcode) {
+    switch (d->opcode) {
         case OPC_LD: {
-            uint16_t ea = (uint16_t)(cpu->R[d.f2] + d.imm6);
-            if (!check_ea(ea, "LD")) { cpu->PC = INSTR_MEM_SIZE; return; }
-            cpu->R[d.f1] = data_mem[ea];
+            uint32_t ea = PHYS_ADDR(cpu->DB, cpu->R[d->f2] + d->imm6);
+            if (!check_ea(m, ea, "LD")) { cpu->PC = INSTR_MEM_SIZE; return; }
+            dcache_touch(m, ea, 1, 0);
+            cpu->R[d->f1] = m->data_mem[ea];
             break;
         }
         case OPC_ST: {
-            uint16_t ea = (uint16_t)(cpu->R[d.f2] + d.imm6);
-            if (!check_ea(ea, "ST")) { cpu->PC = INSTR_MEM_SIZE; return; }
-            data_mem[ea] = cpu->R[d.f1];
+            uint32_t ea = PHYS_ADDR(cpu->DB, cpu->R[d->f2] + d->imm6);
+            if (!check_ea(m, ea, "ST")) { cpu->PC = INSTR_MEM_SIZE; return; }
+            dcache_touch(m, ea, 1, 1);
+            m->data_mem[ea] = cpu->R[d->f1];
             break;
         }
         case OPC_ADDI:
-            cpu->R[d.f1] = (uint16_t)(cpu->R[d.f2] + d.imm6);
+            cpu->R[d->f1] = (uint16_t)(cpu->R[d->f2] + d->imm6);
             break;
         case OPC_LDK: {
-            uint16_t ea = (uint16_t)(cpu->R[d.f2] + d.imm6);
-            if (!check_ea(ea, "LDK")) { cpu->PC = INSTR_MEM_SIZE; return; }
-            uint16_t key_val = data_mem[ea];
-            if (d.f1 == 6) cpu->K0 = key_val;
-            else if (d.f1 == 7) cpu->K1 = key_val;
+            uint32_t ea = PHYS_ADDR(cpu->DB, cpu->R[d->f2] + d->imm6);
+            if (!check_ea(m, ea, "LDK")) { cpu->PC = INSTR_MEM_SIZE; return; }
+            dcache_touch(m, ea, 1, 0);
+            cpu_load_key(cpu, d->f1, m->data_mem[ea]);
             break;
         }
         case OPC_ENC:
-            cpu->R[d.f1] = enc_func(cpu->R[d.f2], cpu->K0, cpu->K1);
+            cpu->R[d->f1] = codebook_enc(&m->codebook, cpu->R[d->f2], &cpu->ks);
             break;
         case OPC_DEC:
-            cpu->R[d.f1] = dec_func(cpu->R[d.f2], cpu->K0, cpu->K1);
+            cpu->R[d->f1] = codebook_dec(&m->codebook, cpu->R[d->f2], &cpu->ks);
             break;
         case OPC_BNE:
-            if (cpu->R[d.f1] != cpu->R[d.f2]) {
-                cpu->PC = (uint16_t)(cpu->PC + d.imm6); // PC already incremented (PC+1 semantics)
+            if (cpu->R[d->f1] != cpu->R[d->f2]) {
+                cpu->PC = (uint16_t)(cpu->PC + d->imm6); // PC already incremented (PC+1 semantics)
             }
             break;
+        case OPC_SETB:
+            cpu->DB = (uint16_t)(cpu->R[d->f2] + d->imm6);
+            break;
+        case OPC_ADD:
+            cpu->R[d->f1] = (uint16_t)(cpu->R[d->f2] + cpu->R[d->f3]);
+            break;
+        case OPC_XOR:
+            cpu->R[d->f1] = (uint16_t)(cpu->R[d->f2] ^ cpu->R[d->f3]);
+            break;
+        case OPC_LDP: {
+            uint32_t ea = PHYS_ADDR(cpu->DB, cpu->R[d->f2]);
+            if (!check_ea(m, ea, "LDP")) { cpu->PC = INSTR_MEM_SIZE; return; }
+            dcache_touch(m, ea, 1, 0);
+            cpu->R[d->f2] = (uint16_t)(cpu->R[d->f2] + d->imm6);
+            cpu->R[d->f1] = m->data_mem[ea];
+            break;
+        }
+        case OPC_STP: {
+            uint32_t ea = PHYS_ADDR(cpu->DB, cpu->R[d->f2]);
+            if (!check_ea(m, ea, "STP")) { cpu->PC = INSTR_MEM_SIZE; return; }
+            dcache_touch(m, ea, 1, 1);
+            m->data_mem[ea] = cpu->R[d->f1];
+            cpu->R[d->f2] = (uint16_t)(cpu->R[d->f2] + d->imm6);
+            break;
+        }
+        case OPC_LOOP:
+            cpu->LC = cpu->R[d->f1];
+            cpu->LS = cpu->PC;
+            cpu->LE = (uint16_t)(pc + d->imm6);
+            if (cpu->LC == 0) cpu->PC = (uint16_t)(cpu->LE + 1);
+            return;
+        case OPC_VEC:
+            if (!step_vec(m, cpu, d)) { cpu->PC = INSTR_MEM_SIZE; return; }
+            break;
         case OPC_HLT:
             cpu->PC = INSTR_MEM_SIZE;
             return;
@@ -86,4 +169,7 @@ void step_single(CpuState *cpu) {
         default:
             break;
     }
+
+    // End of a hardware loop body: go round again (costs no cycle)
+    if (cpu->LC && pc == cpu->LE && --cpu->LC) cpu->PC = cpu->LS;
 }
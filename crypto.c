@@ -1,3 +1,5 @@
+#include <string.h>
+#include <pthread.h>
 #include "crypto.h"
 
 // Rotate left 16 bits
@@ -44,9 +46,84 @@ static uint16_t sbox16_inv(uint16_t x) {
     return out;
 }
 
-// Encrypt one 16-bit block
-uint16_t enc_func(uint16_t block, uint16_t k0, uint16_t k1) {
-    uint16_t state = block;
+// ---- Precomputed tables ----
+
+// Byte layout: both nibbles of a byte substituted in one lookup
+static uint8_t SBOX8[256];
+static uint8_t SBOX8_INV[256];
+
+// Word layout: rotl16(.,3) then S-box for encrypt, inverse S-box then rotr16(.,3) for decrypt
+static uint16_t ENC_T[65536];
+static uint16_t DEC_T[65536];
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+static SboxLayout layout = CRYPTO_SBOX_LAYOUT;
+
+static void build_tables(void) {
+    for (int b = 0; b < 256; b++) {
+        SBOX8[b]     = (uint8_t)((SBOX[b >> 4] << 4) | SBOX[b & 0xF]);
+        SBOX8_INV[b] = (uint8_t)((SBOX_INV[b >> 4] << 4) | SBOX_INV[b & 0xF]);
+    }
+    for (uint32_t x = 0; x < 65536; x++) {
+        ENC_T[x] = sbox16(rotl16((uint16_t)x, 3));
+        DEC_T[x] = rotr16(sbox16_inv((uint16_t)x), 3);
+    }
+}
+
+void crypto_init(void) {
+    pthread_once(&tables_once, build_tables);
+}
+
+void crypto_set_layout(SboxLayout l) {
+    crypto_init();
+    layout = l;
+}
+
+SboxLayout crypto_get_layout(void) {
+    return layout;
+}
+
+const char *crypto_layout_name(SboxLayout l) {
+    switch (l) {
+        case SBOX_LAYOUT_NIBBLE: return "nibble";
+        case SBOX_LAYOUT_BYTE:   return "byte";
+        case SBOX_LAYOUT_WORD:   return "word";
+        default:                 return "???";
+    }
+}
+
+int crypto_parse_layout(const char *name, SboxLayout *out) {
+    for (int l = 0; l < SBOX_LAYOUT_COUNT; l++) {
+        if (strcmp(name, crypto_layout_name((SboxLayout)l)) == 0) {
+            *out = (SboxLayout)l;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint16_t sbox16_byte(uint16_t x) {
+    return (uint16_t)((SBOX8[x >> 8] << 8) | SBOX8[x & 0xFF]);
+}
+
+static uint16_t sbox16_inv_byte(uint16_t x) {
+    return (uint16_t)((SBOX8_INV[x >> 8] << 8) | SBOX8_INV[x & 0xFF]);
+}
+
+// ---- Key schedule ----
+
+void key_schedule_init(KeySchedule *ks, uint16_t k0, uint16_t k1) {
+    ks->k0 = k0;
+    ks->k1 = k1;
+    ks->rk[0] = k0;
+    for (int r = 1; r < CRYPTO_ROUNDS; r++) ks->rk[r] = (uint16_t)(k0 ^ k1);
+    ks->rk[CRYPTO_ROUNDS] = k1;
+}
+
+// ---- Per-layout round functions ----
+
+// Reference: the cipher as specified, both keys every round
+static uint16_t enc_nibble(uint16_t state, uint16_t k0, uint16_t k1) {
     for (int r = 0; r < 4; r++) {
         state ^= k0;
         state  = rotl16(state, 3);
@@ -56,9 +133,7 @@ uint16_t enc_func(uint16_t block, uint16_t k0, uint16_t k1) {
     return state;
 }
 
-// Decrypt one 16-bit block (inverse of above)
-uint16_t dec_func(uint16_t block, uint16_t k0, uint16_t k1) {
-    uint16_t state = block;
+static uint16_t dec_nibble(uint16_t state, uint16_t k0, uint16_t k1) {
     for (int r = 0; r < 4; r++) {
         state ^= k1;
         state  = sbox16_inv(state);
@@ -67,3 +142,98 @@ uint16_t dec_func(uint16_t block, uint16_t k0, uint16_t k1) {
     }
     return state;
 }
+
+static uint16_t enc_nibble_ks(uint16_t state, const uint16_t *rk) {
+    for (int r = 0; r < CRYPTO_ROUNDS; r++) state = sbox16(rotl16(state ^ rk[r], 3));
+    return state ^ rk[CRYPTO_ROUNDS];
+}
+
+static uint16_t dec_nibble_ks(uint16_t state, const uint16_t *rk) {
+    for (int r = CRYPTO_ROUNDS; r > 0; r--) state = rotr16(sbox16_inv(state ^ rk[r]), 3);
+    return state ^ rk[0];
+}
+
+static uint16_t enc_byte(uint16_t state, const uint16_t *rk) {
+    for (int r = 0; r < CRYPTO_ROUNDS; r++) state = sbox16_byte(rotl16(state ^ rk[r], 3));
+    return state ^ rk[CRYPTO_ROUNDS];
+}
+
+static uint16_t dec_byte(uint16_t state, const uint16_t *rk) {
+    for (int r = CRYPTO_ROUNDS; r > 0; r--) state = rotr16(sbox16_inv_byte(state ^ rk[r]), 3);
+    return state ^ rk[0];
+}
+
+static uint16_t enc_word(uint16_t state, const uint16_t *rk) {
+    state = ENC_T[state ^ rk[0]];
+    state = ENC_T[state ^ rk[1]];
+    state = ENC_T[state ^ rk[2]];
+    state = ENC_T[state ^ rk[3]];
+    return state ^ rk[4];
+}
+
+static uint16_t dec_word(uint16_t state, const uint16_t *rk) {
+    state = DEC_T[state ^ rk[4]];
+    state = DEC_T[state ^ rk[3]];
+    state = DEC_T[state ^ rk[2]];
+    state = DEC_T[state ^ rk[1]];
+    return state ^ rk[0];
+}
+
+// Encrypt one 16-bit block
+uint16_t enc_func_ks(uint16_t block, const KeySchedule *ks) {
+    crypto_init();
+    switch (layout) {
+        case SBOX_LAYOUT_WORD: return enc_word(block, ks->rk);
+        case SBOX_LAYOUT_BYTE: return enc_byte(block, ks->rk);
+        default:               return enc_nibble_ks(block, ks->rk);
+    }
+}
+
+// Decrypt one 16-bit block (inverse of above)
+uint16_t dec_func_ks(uint16_t block, const KeySchedule *ks) {
+    crypto_init();
+    switch (layout) {
+        case SBOX_LAYOUT_WORD: return dec_word(block, ks->rk);
+        case SBOX_LAYOUT_BYTE: return dec_byte(block, ks->rk);
+        default:               return dec_nibble_ks(block, ks->rk);
+    }
+}
+
+uint16_t enc_func(uint16_t block, uint16_t k0, uint16_t k1) {
+    KeySchedule ks;
+    key_schedule_init(&ks, k0, k1);
+    return enc_func_ks(block, &ks);
+}
+
+uint16_t dec_func(uint16_t block, uint16_t k0, uint16_t k1) {
+    KeySchedule ks;
+    key_schedule_init(&ks, k0, k1);
+    return dec_func_ks(block, &ks);
+}
+
+long crypto_self_test(void) {
+    static const uint16_t keys[][2] = {
+        {0x0000, 0x0000}, {0x7368, 0x0000}, {0x1234, 0xABCD}, {0xFFFF, 0x5A5A}
+    };
+    long bad = 0;
+    crypto_init();
+    for (uint32_t i = 0; i < 65536; i++) {
+        uint16_t x = (uint16_t)i;
+        // Substitution layer on its own
+        if (sbox16_byte(x) != sbox16(x)) bad++;
+        if (sbox16_inv_byte(x) != sbox16_inv(x)) bad++;
+        if (ENC_T[x] != sbox16(rotl16(x, 3))) bad++;
+        if (DEC_T[x] != rotr16(sbox16_inv(x), 3)) bad++;
+        // Full cipher: every layout, on the folded key schedule, against the nibble loop
+        for (unsigned k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+            uint16_t k0 = keys[k][0], k1 = keys[k][1];
+            KeySchedule ks;
+            key_schedule_init(&ks, k0, k1);
+            uint16_t ref = enc_nibble(x, k0, k1);
+            if (enc_nibble_ks(x, ks.rk) != ref || enc_byte(x, ks.rk) != ref || enc_word(x, ks.rk) != ref) bad++;
+            if (dec_nibble(ref, k0, k1) != x || dec_nibble_ks(ref, ks.rk) != x || dec_byte(ref, ks.rk) != x ||
+                dec_word(ref, ks.rk) != x) bad++;
+        }
+    }
+    return bad;
+}
@@ -2,8 +2,110 @@
 #define CRYPTO_H
 
 #include <stdint.h>
+#include <stddef.h>
 
+// Layout of the precomputed substitution layer used by enc_func/dec_func
+typedef enum {
+    SBOX_LAYOUT_NIBBLE = 0,  // 4 x 16-entry nibble lookups per word (reference)
+    SBOX_LAYOUT_BYTE   = 1,  // 2 x 256-entry byte lookups per word
+    SBOX_LAYOUT_WORD   = 2   // 1 x 64K-entry lookup per word, rotate folded in
+} SboxLayout;
+
+#define SBOX_LAYOUT_COUNT 3
+
+// Compile-time default, override with -DCRYPTO_SBOX_LAYOUT=SBOX_LAYOUT_BYTE etc.
+#ifndef CRYPTO_SBOX_LAYOUT
+#define CRYPTO_SBOX_LAYOUT SBOX_LAYOUT_WORD
+#endif
+
+// ---- Key schedule ----
+
+#define CRYPTO_ROUNDS 4
+
+// Round keys for one (K0, K1) pair, derived once per key. A round is
+// "xor k0, rotl 3, S-box, xor k1", so the k1 ending one round and the k0
+// starting the next fold into a single key:
+//   enc: x = T(x ^ rk[0]); x = T(x ^ rk[1]); ... x = T(x ^ rk[3]); x ^= rk[4]
+// with rk = { k0, k0^k1, k0^k1, k0^k1, k1 }. Decryption runs the keys backwards.
+typedef struct {
+    uint16_t k0, k1;                    // the pair rk was derived from
+    uint16_t rk[CRYPTO_ROUNDS + 1];
+} KeySchedule;
+
+void key_schedule_init(KeySchedule *ks, uint16_t k0, uint16_t k1);
+
+// Same cipher as enc_func/dec_func, nothing derived per block
+uint16_t enc_func_ks(uint16_t block, const KeySchedule *ks);
+uint16_t dec_func_ks(uint16_t block, const KeySchedule *ks);
+
+// One-off blocks: derive the schedule and run it
 uint16_t enc_func(uint16_t block, uint16_t k0, uint16_t k1);
 uint16_t dec_func(uint16_t block, uint16_t k0, uint16_t k1);
 
+// Build lookup tables (called lazily by enc_func/dec_func; safe to call twice or from several threads)
+void crypto_init(void);
+
+// Select the S-box layout at startup
+void crypto_set_layout(SboxLayout layout);
+SboxLayout crypto_get_layout(void);
+const char *crypto_layout_name(SboxLayout layout);
+int crypto_parse_layout(const char *name, SboxLayout *out);
+
+// Check every layout against the nibble loop for all 65,536 inputs.
+// Returns number of mismatches (0 = pass).
+long crypto_self_test(void);
+
+// ---- Batch API (crypto_simd.c) ----
+
+// Batch kernels, narrowest to widest. The widest one the CPU supports is picked once,
+// at first use from any thread.
+typedef enum {
+    CRYPTO_IMPL_SCALAR = 0,  // enc_func/dec_func per block
+    CRYPTO_IMPL_SSSE3  = 1,  // 8 blocks per 128-bit vector, pshufb nibble S-box
+    CRYPTO_IMPL_AVX2   = 2   // 32 blocks per iteration (2 x 256-bit vectors)
+} CryptoImpl;
+
+#define CRYPTO_IMPL_COUNT 3
+
+// Encrypt/decrypt n independent blocks; bit-identical to enc_func/dec_func. in and out may alias.
+void enc_blocks(const uint16_t *in, uint16_t *out, size_t n, uint16_t k0, uint16_t k1);
+void dec_blocks(const uint16_t *in, uint16_t *out, size_t n, uint16_t k0, uint16_t k1);
+void enc_blocks_ks(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks);
+void dec_blocks_ks(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks);
+
+// Key-agile batches: consecutive runs of blocks, each under its own
+// precomputed schedule (one per message, say). A run only costs its round
+// keys' broadcast on top of the fixed-key kernel.
+typedef struct {
+    const KeySchedule *ks;
+    size_t n;
+} KeySpan;
+
+void enc_blocks_spans(const uint16_t *in, uint16_t *out, const KeySpan *spans, size_t count);
+void dec_blocks_spans(const uint16_t *in, uint16_t *out, const KeySpan *spans, size_t count);
+
+int crypto_impl_supported(CryptoImpl impl);
+const char *crypto_impl_name(CryptoImpl impl);
+CryptoImpl crypto_batch_impl(void);
+// Force a kernel (returns 0 if the CPU lacks it). Not synchronised with callers on
+// other threads: set it before they start.
+int crypto_set_batch_impl(CryptoImpl impl);
+
+// Check every supported kernel against enc_func/dec_func for all 65,536 inputs,
+// and the key-agile entry points. Returns number of mismatches (0 = pass).
+long crypto_batch_self_test(void);
+
+// ---- Counter mode (crypto_simd.c) ----
+
+// out[i] = in[i] ^ enc_func(ctr + i, k0, k1), counter wrapping at 16 bits. The same
+// call encrypts and decrypts, and block j of a stream started at counter c can be
+// processed on its own by passing c + j. The keystream repeats every 65,536 blocks.
+// Uses the batch kernel crypto_batch_impl() selects. in and out may alias.
+void ctr_blocks(const uint16_t *in, uint16_t *out, size_t n, uint16_t k0, uint16_t k1, uint16_t ctr);
+void ctr_blocks_ks(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks, uint16_t ctr);
+
+// Check every supported kernel's ctr_blocks against enc_func, including split
+// (seeked) runs and counter wrap. Returns number of mismatches (0 = pass).
+long crypto_ctr_self_test(void);
+
 #endif // CRYPTO_H
@@ -0,0 +1,407 @@
+#include <stddef.h>
+#include <pthread.h>
+#include "crypto.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRYPTO_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+// ---- Scalar fallback ----
+
+static void enc_blocks_scalar(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks) {
+    for (size_t i = 0; i < n; i++) out[i] = enc_func_ks(in[i], ks);
+}
+
+static void dec_blocks_scalar(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks) {
+    for (size_t i = 0; i < n; i++) out[i] = dec_func_ks(in[i], ks);
+}
+
+static void ctr_blocks_scalar(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks, uint16_t ctr) {
+    for (size_t i = 0; i < n; i++) out[i] = (uint16_t)(in[i] ^ enc_func_ks((uint16_t)(ctr + i), ks));
+}
+
+#ifdef CRYPTO_HAVE_X86
+
+// Nibble S-boxes as pshufb tables: *_LO substitutes the low nibble of each byte,
+// *_HI the high nibble (result pre-shifted into bits 7:4).
+#define SBOX_BYTES     0xC, 0x5, 0x6, 0xB, 0x9, 0x0, 0xA, 0xD, 0x3, 0xE, 0xF, 0x8, 0x4, 0x7, 0x1, 0x2
+#define SBOX_HI_BYTES  0xC0,0x50,0x60,0xB0,0x90,0x00,0xA0,0xD0,0x30,0xE0,0xF0,0x80,0x40,0x70,0x10,0x20
+#define SBOXI_BYTES    0x5, 0xE, 0xF, 0x8, 0xC, 0x1, 0x2, 0xD, 0xB, 0x4, 0x6, 0x3, 0x0, 0x7, 0x9, 0xA
+#define SBOXI_HI_BYTES 0x50,0xE0,0xF0,0x80,0xC0,0x10,0x20,0xD0,0xB0,0x40,0x60,0x30,0x00,0x70,0x90,0xA0
+
+// ---- SSSE3: 8 blocks per 128-bit vector ----
+
+__attribute__((target("ssse3")))
+static inline __m128i sub_sse(__m128i x, __m128i lo_t, __m128i hi_t) {
+    const __m128i m = _mm_set1_epi8(0x0F);
+    __m128i lo = _mm_and_si128(x, m);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), m);
+    return _mm_or_si128(_mm_shuffle_epi8(lo_t, lo), _mm_shuffle_epi8(hi_t, hi));
+}
+
+__attribute__((target("ssse3")))
+static void enc_blocks_ssse3(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks) {
+    const __m128i lo_t = _mm_setr_epi8(SBOX_BYTES);
+    const __m128i hi_t = _mm_setr_epi8(SBOX_HI_BYTES);
+    __m128i rk[CRYPTO_ROUNDS + 1];
+    for (int r = 0; r <= CRYPTO_ROUNDS; r++) rk[r] = _mm_set1_epi16((short)ks->rk[r]);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        for (int r = 0; r < CRYPTO_ROUNDS; r++) {
+            x = _mm_xor_si128(x, rk[r]);
+            x = _mm_or_si128(_mm_slli_epi16(x, 3), _mm_srli_epi16(x, 13));
+            x = sub_sse(x, lo_t, hi_t);
+        }
+        x = _mm_xor_si128(x, rk[CRYPTO_ROUNDS]);
+        _mm_storeu_si128((__m128i *)(out + i), x);
+    }
+    enc_blocks_scalar(in + i, out + i, n - i, ks);
+}
+
+__attribute__((target("ssse3")))
+static void dec_blocks_ssse3(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks) {
+    const __m128i lo_t = _mm_setr_epi8(SBOXI_BYTES);
+    const __m128i hi_t = _mm_setr_epi8(SBOXI_HI_BYTES);
+    __m128i rk[CRYPTO_ROUNDS + 1];
+    for (int r = 0; r <= CRYPTO_ROUNDS; r++) rk[r] = _mm_set1_epi16((short)ks->rk[r]);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        for (int r = CRYPTO_ROUNDS; r > 0; r--) {
+            x = _mm_xor_si128(x, rk[r]);
+            x = sub_sse(x, lo_t, hi_t);
+            x = _mm_or_si128(_mm_srli_epi16(x, 3), _mm_slli_epi16(x, 13));
+        }
+        x = _mm_xor_si128(x, rk[0]);
+        _mm_storeu_si128((__m128i *)(out + i), x);
+    }
+    dec_blocks_scalar(in + i, out + i, n - i, ks);
+}
+
+// Counter blocks are built in the register (lane j = ctr + i + j), so only the
+// data is loaded
+__attribute__((target("ssse3")))
+static void ctr_blocks_ssse3(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks, uint16_t ctr) {
+    const __m128i lo_t = _mm_setr_epi8(SBOX_BYTES);
+    const __m128i hi_t = _mm_setr_epi8(SBOX_HI_BYTES);
+    __m128i rk[CRYPTO_ROUNDS + 1];
+    for (int r = 0; r <= CRYPTO_ROUNDS; r++) rk[r] = _mm_set1_epi16((short)ks->rk[r]);
+    const __m128i step = _mm_set1_epi16(8);
+    __m128i c = _mm_add_epi16(_mm_set1_epi16((short)ctr), _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = c;
+        for (int r = 0; r < CRYPTO_ROUNDS; r++) {
+            x = _mm_xor_si128(x, rk[r]);
+            x = _mm_or_si128(_mm_slli_epi16(x, 3), _mm_srli_epi16(x, 13));
+            x = sub_sse(x, lo_t, hi_t);
+        }
+        x = _mm_xor_si128(x, rk[CRYPTO_ROUNDS]);
+        x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i *)(in + i)));
+        _mm_storeu_si128((__m128i *)(out + i), x);
+        c = _mm_add_epi16(c, step);
+    }
+    ctr_blocks_scalar(in + i, out + i, n - i, ks, (uint16_t)(ctr + i));
+}
+
+// ---- AVX2: 16 blocks per 256-bit vector, two vectors (32 blocks) per iteration ----
+
+__attribute__((target("avx2")))
+static inline __m256i sub_avx2(__m256i x, __m256i lo_t, __m256i hi_t) {
+    const __m256i m = _mm256_set1_epi8(0x0F);
+    __m256i lo = _mm256_and_si256(x, m);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), m);
+    return _mm256_or_si256(_mm256_shuffle_epi8(lo_t, lo), _mm256_shuffle_epi8(hi_t, hi));
+}
+
+__attribute__((target("avx2")))
+static void enc_blocks_avx2(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks) {
+    const __m256i lo_t = _mm256_setr_epi8(SBOX_BYTES, SBOX_BYTES);
+    const __m256i hi_t = _mm256_setr_epi8(SBOX_HI_BYTES, SBOX_HI_BYTES);
+    __m256i rk[CRYPTO_ROUNDS + 1];
+    for (int r = 0; r <= CRYPTO_ROUNDS; r++) rk[r] = _mm256_set1_epi16((short)ks->rk[r]);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(in + i + 16));
+        for (int r = 0; r < CRYPTO_ROUNDS; r++) {
+            a = _mm256_xor_si256(a, rk[r]);
+            b = _mm256_xor_si256(b, rk[r]);
+            a = _mm256_or_si256(_mm256_slli_epi16(a, 3), _mm256_srli_epi16(a, 13));
+            b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 13));
+            a = sub_avx2(a, lo_t, hi_t);
+            b = sub_avx2(b, lo_t, hi_t);
+        }
+        a = _mm256_xor_si256(a, rk[CRYPTO_ROUNDS]);
+        b = _mm256_xor_si256(b, rk[CRYPTO_ROUNDS]);
+        _mm256_storeu_si256((__m256i *)(out + i), a);
+        _mm256_storeu_si256((__m256i *)(out + i + 16), b);
+    }
+    enc_blocks_ssse3(in + i, out + i, n - i, ks);
+}
+
+__attribute__((target("avx2")))
+static void dec_blocks_avx2(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks) {
+    const __m256i lo_t = _mm256_setr_epi8(SBOXI_BYTES, SBOXI_BYTES);
+    const __m256i hi_t = _mm256_setr_epi8(SBOXI_HI_BYTES, SBOXI_HI_BYTES);
+    __m256i rk[CRYPTO_ROUNDS + 1];
+    for (int r = 0; r <= CRYPTO_ROUNDS; r++) rk[r] = _mm256_set1_epi16((short)ks->rk[r]);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(in + i + 16));
+        for (int r = CRYPTO_ROUNDS; r > 0; r--) {
+            a = sub_avx2(_mm256_xor_si256(a, rk[r]), lo_t, hi_t);
+            b = sub_avx2(_mm256_xor_si256(b, rk[r]), lo_t, hi_t);
+            a = _mm256_or_si256(_mm256_srli_epi16(a, 3), _mm256_slli_epi16(a, 13));
+            b = _mm256_or_si256(_mm256_srli_epi16(b, 3), _mm256_slli_epi16(b, 13));
+        }
+        a = _mm256_xor_si256(a, rk[0]);
+        b = _mm256_xor_si256(b, rk[0]);
+        _mm256_storeu_si256((__m256i *)(out + i), a);
+        _mm256_storeu_si256((__m256i *)(out + i + 16), b);
+    }
+    dec_blocks_ssse3(in + i, out + i, n - i, ks);
+}
+
+__attribute__((target("avx2")))
+static void ctr_blocks_avx2(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks, uint16_t ctr) {
+    const __m256i lo_t = _mm256_setr_epi8(SBOX_BYTES, SBOX_BYTES);
+    const __m256i hi_t = _mm256_setr_epi8(SBOX_HI_BYTES, SBOX_HI_BYTES);
+    __m256i rk[CRYPTO_ROUNDS + 1];
+    for (int r = 0; r <= CRYPTO_ROUNDS; r++) rk[r] = _mm256_set1_epi16((short)ks->rk[r]);
+    const __m256i step = _mm256_set1_epi16(32);
+    __m256i ca = _mm256_add_epi16(_mm256_set1_epi16((short)ctr),
+                                  _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    __m256i cb = _mm256_add_epi16(ca, _mm256_set1_epi16(16));
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = ca, b = cb;
+        for (int r = 0; r < CRYPTO_ROUNDS; r++) {
+            a = _mm256_xor_si256(a, rk[r]);
+            b = _mm256_xor_si256(b, rk[r]);
+            a = _mm256_or_si256(_mm256_slli_epi16(a, 3), _mm256_srli_epi16(a, 13));
+            b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 13));
+            a = sub_avx2(a, lo_t, hi_t);
+            b = sub_avx2(b, lo_t, hi_t);
+        }
+        a = _mm256_xor_si256(a, rk[CRYPTO_ROUNDS]);
+        b = _mm256_xor_si256(b, rk[CRYPTO_ROUNDS]);
+        a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *)(in + i)));
+        b = _mm256_xor_si256(b, _mm256_loadu_si256((const __m256i *)(in + i + 16)));
+        _mm256_storeu_si256((__m256i *)(out + i), a);
+        _mm256_storeu_si256((__m256i *)(out + i + 16), b);
+        ca = _mm256_add_epi16(ca, step);
+        cb = _mm256_add_epi16(cb, step);
+    }
+    ctr_blocks_ssse3(in + i, out + i, n - i, ks, (uint16_t)(ctr + i));
+}
+
+#endif // CRYPTO_HAVE_X86
+
+// ---- Runtime dispatch ----
+
+typedef void (*BlockFn)(const uint16_t *, uint16_t *, size_t, const KeySchedule *);
+typedef void (*CtrFn)(const uint16_t *, uint16_t *, size_t, const KeySchedule *, uint16_t);
+
+// The default kernel is picked once, on first use from any thread
+static pthread_once_t impl_once = PTHREAD_ONCE_INIT;
+static CryptoImpl impl = CRYPTO_IMPL_SCALAR;
+static BlockFn enc_impl = enc_blocks_scalar;
+static BlockFn dec_impl = dec_blocks_scalar;
+static CtrFn ctr_impl = ctr_blocks_scalar;
+
+int crypto_impl_supported(CryptoImpl i) {
+    switch (i) {
+        case CRYPTO_IMPL_SCALAR: return 1;
+#ifdef CRYPTO_HAVE_X86
+        case CRYPTO_IMPL_SSSE3:  return __builtin_cpu_supports("ssse3");
+        case CRYPTO_IMPL_AVX2:   return __builtin_cpu_supports("avx2");
+#endif
+        default:                 return 0;
+    }
+}
+
+const char *crypto_impl_name(CryptoImpl i) {
+    switch (i) {
+        case CRYPTO_IMPL_SCALAR: return "scalar";
+        case CRYPTO_IMPL_SSSE3:  return "ssse3";
+        case CRYPTO_IMPL_AVX2:   return "avx2";
+        default:                 return "???";
+    }
+}
+
+static int set_impl(CryptoImpl i) {
+    if (!crypto_impl_supported(i)) return 0;
+    impl = i;
+    switch (i) {
+#ifdef CRYPTO_HAVE_X86
+        case CRYPTO_IMPL_AVX2:
+            enc_impl = enc_blocks_avx2;  dec_impl = dec_blocks_avx2;  ctr_impl = ctr_blocks_avx2;
+            break;
+        case CRYPTO_IMPL_SSSE3:
+            enc_impl = enc_blocks_ssse3; dec_impl = dec_blocks_ssse3; ctr_impl = ctr_blocks_ssse3;
+            break;
+#endif
+        default:
+            enc_impl = enc_blocks_scalar; dec_impl = dec_blocks_scalar; ctr_impl = ctr_blocks_scalar;
+            break;
+    }
+    return 1;
+}
+
+// Pick the widest kernel this CPU supports
+static void choose_impl(void) {
+    for (int i = CRYPTO_IMPL_COUNT - 1; i >= 0; i--) {
+        if (set_impl((CryptoImpl)i)) return;
+    }
+}
+
+int crypto_set_batch_impl(CryptoImpl i) {
+    pthread_once(&impl_once, choose_impl);
+    return set_impl(i);
+}
+
+CryptoImpl crypto_batch_impl(void) {
+    pthread_once(&impl_once, choose_impl);
+    return impl;
+}
+
+void enc_blocks_ks(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks) {
+    pthread_once(&impl_once, choose_impl);
+    enc_impl(in, out, n, ks);
+}
+
+void dec_blocks_ks(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks) {
+    pthread_once(&impl_once, choose_impl);
+    dec_impl(in, out, n, ks);
+}
+
+void ctr_blocks_ks(const uint16_t *in, uint16_t *out, size_t n, const KeySchedule *ks, uint16_t ctr) {
+    pthread_once(&impl_once, choose_impl);
+    ctr_impl(in, out, n, ks, ctr);
+}
+
+void enc_blocks(const uint16_t *in, uint16_t *out, size_t n, uint16_t k0, uint16_t k1) {
+    KeySchedule ks;
+    key_schedule_init(&ks, k0, k1);
+    enc_blocks_ks(in, out, n, &ks);
+}
+
+void dec_blocks(const uint16_t *in, uint16_t *out, size_t n, uint16_t k0, uint16_t k1) {
+    KeySchedule ks;
+    key_schedule_init(&ks, k0, k1);
+    dec_blocks_ks(in, out, n, &ks);
+}
+
+void ctr_blocks(const uint16_t *in, uint16_t *out, size_t n, uint16_t k0, uint16_t k1, uint16_t ctr) {
+    KeySchedule ks;
+    key_schedule_init(&ks, k0, k1);
+    ctr_blocks_ks(in, out, n, &ks, ctr);
+}
+
+void enc_blocks_spans(const uint16_t *in, uint16_t *out, const KeySpan *spans, size_t count) {
+    pthread_once(&impl_once, choose_impl);
+    for (size_t s = 0; s < count; s++) {
+        enc_impl(in, out, spans[s].n, spans[s].ks);
+        in += spans[s].n;
+        out += spans[s].n;
+    }
+}
+
+void dec_blocks_spans(const uint16_t *in, uint16_t *out, const KeySpan *spans, size_t count) {
+    pthread_once(&impl_once, choose_impl);
+    for (size_t s = 0; s < count; s++) {
+        dec_impl(in, out, spans[s].n, spans[s].ks);
+        in += spans[s].n;
+        out += spans[s].n;
+    }
+}
+
+long crypto_batch_self_test(void) {
+    static const uint16_t keys[][2] = {
+        {0x0000, 0x0000}, {0x7368, 0x0000}, {0x1234, 0xABCD}, {0xFFFF, 0x5A5A}
+    };
+    static uint16_t in[65536 + 1], ct[65536 + 1], pt[65536 + 1];
+    CryptoImpl saved = crypto_batch_impl();
+    long bad = 0;
+
+    for (uint32_t x = 0; x < 65536; x++) in[x + 1] = (uint16_t)x;
+    for (int i = 0; i < CRYPTO_IMPL_COUNT; i++) {
+        if (!crypto_set_batch_impl((CryptoImpl)i)) continue;
+        for (unsigned k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+            uint16_t k0 = keys[k][0], k1 = keys[k][1];
+            // Offset by one element so vector loads/stores are unaligned
+            enc_blocks(in + 1, ct + 1, 65536, k0, k1);
+            dec_blocks(ct + 1, pt + 1, 65536, k0, k1);
+            for (uint32_t x = 0; x < 65536; x++) {
+                if (ct[x + 1] != enc_func((uint16_t)x, k0, k1)) bad++;
+                if (pt[x + 1] != (uint16_t)x) bad++;
+            }
+            // Short and odd lengths exercise the tail paths
+            for (size_t n = 0; n < 70; n++) {
+                enc_blocks(in + 1 + 1000, ct, n, k0, k1);
+                for (size_t j = 0; j < n; j++) {
+                    if (ct[j] != enc_func(in[1 + 1000 + j], k0, k1)) bad++;
+                }
+            }
+        }
+        // Key-agile: runs of 0..96 blocks, cycling through the keys
+        enum { NKEYS = sizeof(keys) / sizeof(keys[0]) };
+        KeySchedule ks[NKEYS];
+        KeySpan spans[1400];
+        size_t count = 0, total = 0;
+        for (unsigned k = 0; k < NKEYS; k++) key_schedule_init(&ks[k], keys[k][0], keys[k][1]);
+        while (count < sizeof(spans) / sizeof(spans[0]) && total + 96 <= 65536) {
+            spans[count] = (KeySpan){ .ks = &ks[count % NKEYS], .n = (count * 37) % 97 };
+            total += spans[count++].n;
+        }
+        enc_blocks_spans(in + 1, ct + 1, spans, count);
+        dec_blocks_spans(ct + 1, pt + 1, spans, count);
+        for (size_t s = 0, x = 0; s < count; s++) {
+            for (size_t j = 0; j < spans[s].n; j++, x++) {
+                if (ct[x + 1] != enc_func_ks(in[x + 1], spans[s].ks)) bad++;
+                if (pt[x + 1] != in[x + 1]) bad++;
+            }
+        }
+    }
+    crypto_set_batch_impl(saved);
+    return bad;
+}
+
+long crypto_ctr_self_test(void) {
+    static const uint16_t keys[][3] = {   // k0, k1, first counter
+        {0x0000, 0x0000, 0x0000}, {0x7368, 0x0000, 0x0001}, {0x1234, 0xABCD, 0xFFF0}, {0xFFFF, 0x5A5A, 0x8000}
+    };
+    enum { N = 70000 };                   // longer than the counter period
+    static uint16_t in[N + 1], ct[N + 1], pt[N + 1], part[N + 1];
+    CryptoImpl saved = crypto_batch_impl();
+    long bad = 0;
+
+    for (uint32_t x = 0; x < N; x++) in[x + 1] = (uint16_t)(x * 40503u + 7);
+    for (int i = 0; i < CRYPTO_IMPL_COUNT; i++) {
+        if (!crypto_set_batch_impl((CryptoImpl)i)) continue;
+        for (unsigned k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+            uint16_t k0 = keys[k][0], k1 = keys[k][1], c0 = keys[k][2];
+            // Offset by one element so vector loads/stores are unaligned
+            ctr_blocks(in + 1, ct + 1, N, k0, k1, c0);
+            ctr_blocks(ct + 1, pt + 1, N, k0, k1, c0);
+            for (uint32_t x = 0; x < N; x++) {
+                if (ct[x + 1] != (uint16_t)(in[x + 1] ^ enc_func((uint16_t)(c0 + x), k0, k1))) bad++;
+                if (pt[x + 1] != in[x + 1]) bad++;
+            }
+            // Seek: odd-sized pieces started at their own counter match the whole run
+            for (size_t off = 0, len = 1; off < N; off += len, len = len * 3 + 1) {
+                if (len > N - off) len = N - off;
+                ctr_blocks(ct + 1 + off, part + off, len, k0, k1, (uint16_t)(c0 + off));
+            }
+            for (uint32_t x = 0; x < N; x++) {
+                if (part[x] != in[x + 1]) bad++;
+            }
+        }
+    }
+    crypto_set_batch_impl(saved);
+    return bad;
+}
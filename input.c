@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "input.h"
+
+#define INPUT_ALIGN 4096
+
+int input_open(InputSource *in, const char *path, InputMode mode) {
+    memset(in, 0, sizeof(*in));
+    in->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (in->fd < 0) return 0;
+
+    struct stat st;
+    int regular = fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode);
+    in->mode = INPUT_READ;
+    if (mode != INPUT_READ && regular) {
+        in->size = (size_t)st.st_size;
+        if (in->size == 0) {
+            in->mode = INPUT_MMAP;   // nothing to map; input_next reports EOF
+        } else {
+            void *p = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, in->size, MADV_SEQUENTIAL);
+                in->map = p;
+                in->mode = INPUT_MMAP;
+            }
+        }
+    }
+    if (mode == INPUT_MMAP && in->mode != INPUT_MMAP) {
+        input_close(in);
+        return 0;
+    }
+    if (in->mode == INPUT_READ && regular) {
+        posix_fadvise(in->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    return 1;
+}
+
+size_t input_next(InputSource *in, unsigned char *buf, size_t max, const unsigned char **data) {
+    if (in->mode == INPUT_MMAP) {
+        size_t n = in->size - in->pos;
+        if (n > max) n = max;
+        *data = in->map + in->pos;
+        in->pos += n;
+        return n;
+    }
+
+    // Keep reading until the span is full: pipes return short reads, and only
+    // the final span may end on an odd byte
+    size_t n = 0;
+    while (n < max && !in->eof) {
+        ssize_t r = read(in->fd, buf + n, max - n);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            in->error = 1;
+            in->eof = 1;
+            break;
+        }
+        if (r == 0) in->eof = 1;
+        n += (size_t)r;
+    }
+    in->pos += n;
+    *data = buf;
+    return n;
+}
+
+void input_close(InputSource *in) {
+    if (in->map) munmap((void *)in->map, in->size);
+    if (in->fd > STDIN_FILENO) close(in->fd);
+    in->map = NULL;
+    in->fd = -1;
+}
+
+unsigned char *input_alloc_buffer(size_t bytes) {
+    void *p = NULL;
+    if (posix_memalign(&p, INPUT_ALIGN, bytes ? bytes : 1) != 0) return NULL;
+    return p;
+}
+
+const char *input_mode_name(InputMode mode) {
+    switch (mode) {
+        case INPUT_AUTO: return "auto";
+        case INPUT_MMAP: return "mmap";
+        case INPUT_READ: return "read";
+        default:         return "???";
+    }
+}
+
+int input_parse_mode(const char *name, InputMode *out) {
+    for (int m = INPUT_AUTO; m <= INPUT_READ; m++) {
+        if (strcmp(name, input_mode_name((InputMode)m)) == 0) {
+            *out = (InputMode)m;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Plain loops over memcpy'd words: GCC turns the byte swap into pshufb/vpshufb
+static inline uint16_t be16(uint16_t w) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return w;
+#else
+    return __builtin_bswap16(w);
+#endif
+}
+
+size_t pack_be_words(const unsigned char *bytes, size_t len, uint16_t *out) {
+    size_t whole = len / 2;
+    for (size_t i = 0; i < whole; i++) {
+        uint16_t w;
+        memcpy(&w, bytes + 2 * i, 2);
+        out[i] = be16(w);
+    }
+    if (len & 1) out[whole++] = (uint16_t)(bytes[len - 1] << 8);
+    return whole;
+}
+
+void words_to_be(uint16_t *words, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        words[i] = be16(words[i]);
+    }
+}
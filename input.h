@@ -0,0 +1,49 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// How input bytes reach the simulators / bulk cipher
+typedef enum {
+    INPUT_AUTO = 0,  // mmap regular files, large reads for anything else (pipes, devices)
+    INPUT_MMAP = 1,  // map the whole file; spans point straight into the mapping
+    INPUT_READ = 2   // read() into caller buffers, page aligned, large requests
+} InputMode;
+
+typedef struct {
+    InputMode mode;              // mode in use after input_open (never INPUT_AUTO)
+    int fd;
+    const unsigned char *map;    // whole file (INPUT_MMAP)
+    size_t size;                 // file size (INPUT_MMAP)
+    size_t pos;                  // bytes handed out so far
+    int eof;
+    int error;                   // a read failed
+} InputSource;
+
+// Open path ("-" = stdin). Returns 0 on failure.
+int input_open(InputSource *in, const char *path, InputMode mode);
+
+// Hand out the next span of at most max bytes (max must be even). Every span
+// except the last has even length, so a 16-bit word never straddles two spans.
+// In INPUT_MMAP mode *data points into the mapping and buf is not touched;
+// otherwise the bytes are read into buf (max bytes, see input_alloc_buffer) and
+// *data == buf. Returns the span length, 0 at end of input or on error.
+size_t input_next(InputSource *in, unsigned char *buf, size_t max, const unsigned char **data);
+
+void input_close(InputSource *in);
+
+// Page-aligned buffer for INPUT_READ spans (free with free())
+unsigned char *input_alloc_buffer(size_t bytes);
+
+const char *input_mode_name(InputMode mode);
+int input_parse_mode(const char *name, InputMode *out);
+
+// Big-endian byte pairs -> words. An odd final byte becomes the high byte of a
+// zero-padded word. Returns the number of words written ((len + 1) / 2).
+size_t pack_be_words(const unsigned char *bytes, size_t len, uint16_t *out);
+
+// Convert words to big-endian byte order in place (ready for fwrite)
+void words_to_be(uint16_t *words, size_t count);
+
+#endif // INPUT_H
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "crypto.h"
 
 typedef enum {
     OPC_LD   = 0x0,
@@ -13,20 +14,70 @@ typedef enum {
     OPC_DEC  = 0x5,
     OPC_BNE  = 0x6,
     OPC_HLT  = 0x7,
+    OPC_ADD  = 0x8,   // R[rd] = R[rs] + R[rt] (rt in f3, low three bits zero)
+    OPC_LDP  = 0x9,   // R[rt] = mem[R[rs]]; R[rs] += imm6 (rt == rs: the loaded value wins)
+    OPC_STP  = 0xA,   // mem[R[rs]] = R[rt]; R[rs] += imm6
+    OPC_LOOP = 0xB,   // run the next imm6 instructions R[rt] times (see below)
+    OPC_VEC  = 0xC,   // vector extension, operation in f3 (VOP_*)
+    OPC_SETB = 0xD,   // DB = R[rs] + imm6 (select data bank)
+    OPC_XOR  = 0xE,   // R[rd] = R[rs] ^ R[rt] (same fields as ADD)
     OPC_NOP  = 0xF
 } Opcode;
 
 #define NUM_REGS       8
 #define INSTR_MEM_SIZE 256
-#define DATA_MEM_SIZE  1024
-// Base index in data_mem where plaintext starts (words)
-#define PLAIN_BASE     2
+
+// Hardware loop: LOOP loads LC = R[rt], LS = PC + 1, LE = PC + imm6 (skipping the
+// body if the count is 0). Each time the instruction at LE is fetched with LC != 0,
+// LC counts down and, unless it reached 0, fetch goes back to LS at no cost.
+// Loops do not nest, and the last body instruction must not be a branch.
+
+// Vector extension: NUM_VREGS registers of up to VLEN_MAX lanes. A machine has
+// vlen lanes (4, 8 or 16); VSETVL picks how many of them (VL) the following
+// vector instructions use, so loops strip-mine any block count.
+#define NUM_VREGS      8
+#define VLEN_MAX       16
+
+// OPC_VEC operations (f3); the low three bits are zero
+#define VOP_SETVL  0   // VL = min(R[f2], vlen); R[f1] = R[f2] - VL
+#define VOP_LD     1   // V[f2][i] = mem[PHYS_ADDR(DB, R[f1]) + i], i < VL; R[f1] += VL
+#define VOP_ST     2   // mem[PHYS_ADDR(DB, R[f1]) + i] = V[f2][i], i < VL; R[f1] += VL
+#define VOP_ENC    3   // V[f1][i] = ENC(V[f2][i]), i < VL
+#define VOP_DEC    4   // V[f1][i] = DEC(V[f2][i]), i < VL
+#define VOP_ADDVL  5   // R[f1] += VL
+
+// Data memory is allocated at runtime (see memory.h) and addressed in banks:
+// physical word address = DB * BANK_WORDS + 16-bit effective address.
+#define BANK_SHIFT     16
+#define BANK_WORDS     (1u << BANK_SHIFT)
+#define PHYS_ADDR(db, ea) (((uint32_t)(db) << BANK_SHIFT) + (uint32_t)(uint16_t)(ea))
+// Default data memory size in words (--mem-words overrides)
+#define DATA_MEM_DEFAULT_WORDS (1u << 22)
+
+// Per-bank window header: [0] K0 and [1] K1 (bank 0 only), [2] block count,
+// [3] 1 if another window follows, [4] CTR counter of the window's first block
+#define HDR_K0         0
+#define HDR_K1         1
+#define HDR_COUNT      2
+#define HDR_MORE       3
+#define HDR_CTR        4
+// Offset within a bank where plaintext starts (words); ciphertext follows the plaintext
+#define PLAIN_BASE     5
+// Blocks that fit in one bank (plaintext + ciphertext)
+#define WINDOW_BLOCKS  ((BANK_WORDS - PLAIN_BASE) / 2)
 
 typedef struct {
     uint16_t R[NUM_REGS];
     uint16_t K0;
     uint16_t K1;
+    KeySchedule ks;  // round keys for K0/K1, re-derived by every key load (not per ENC/DEC)
+    uint16_t DB;   // data bank register
     uint16_t PC;
+    uint16_t LC;   // hardware loop: iterations left (0 = no loop active)
+    uint16_t LS;   //   body start
+    uint16_t LE;   //   body end (last instruction)
+    uint16_t VL;   // active vector lanes
+    uint16_t V[NUM_VREGS][VLEN_MAX];
 } CpuState;
 
 typedef struct {
@@ -36,6 +87,40 @@ typedef struct {
     uint8_t  f2;
     uint8_t  f3;
     int8_t   imm6;
+    const void *handler;  // dispatch target resolved by an execution engine (NULL = not yet resolved)
 } DecodedInstr;
 
+// True if d writes R[d->f1]
+static inline bool writes_reg_file(const DecodedInstr *d) {
+    switch (d->opcode) {
+        case OPC_LD:
+        case OPC_ADDI:
+        case OPC_ENC:
+        case OPC_DEC:
+        case OPC_ADD:
+        case OPC_XOR:
+        case OPC_LDP:
+            return true;
+        case OPC_VEC:
+            return d->f3 != VOP_ENC && d->f3 != VOP_DEC;
+        default:
+            return false;
+    }
+}
+
+// True if d post-increments its base register R[d->f2]
+static inline bool writes_base(const DecodedInstr *d) {
+    return d->opcode == OPC_LDP || d->opcode == OPC_STP;
+}
+
+// LDK's register write: K0 (f1 = 6) or K1 (f1 = 7), then the crypto unit's round keys
+static inline void cpu_load_key(CpuState *cpu, uint8_t f1, uint16_t v) {
+    if (f1 == 6) cpu->K0 = v;
+    else if (f1 == 7) cpu->K1 = v;
+    key_schedule_init(&cpu->ks, cpu->K0, cpu->K1);
+}
+
+// Simulator instance (memories, program, CPUs); defined in machine.h
+typedef struct Machine Machine;
+
 #endif // ISA_H
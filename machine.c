@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include "machine.h"
+#include "memory.h"
+#include "crypto.h"
+
+extern void init_cpu(CpuState *cpu);
+extern void step_single(Machine *m, CpuState *cpu);
+
+Machine *machine_create(uint32_t data_words) {
+    // ENC/DEC tables are shared read-only by every Machine: build them before any can run
+    crypto_init();
+
+    Machine *m = calloc(1, sizeof(*m));
+    if (!m) return NULL;
+    m->fuse = 1;
+    m->bp_kind = BP_BIMODAL;
+    m->crypto_kind = CRYPTO_UNIT_PIPELINED;
+    m->crypto_latency = 4;
+    m->issue_width = 1;
+    m->vlen = 8;
+    m->dcache = (CacheConfig){ .words = 0, .ways = 2, .line_words = 8, .repl = CACHE_REPL_LRU,
+                               .write = CACHE_WRITE_BACK, .miss_latency = 10 };
+    m->fused_size = -1;
+    codebook_init(&m->codebook);
+    init_memory(m);
+    if (data_words && !resize_data_memory(m, data_words)) {
+        free(m);
+        return NULL;
+    }
+    machine_reset_cpus(m);
+    return m;
+}
+
+void machine_destroy(Machine *m) {
+    if (!m) return;
+    free_memory(m);
+    codebook_free(&m->codebook);
+    free(m);
+}
+
+void machine_reset_cpus(Machine *m) {
+    init_cpu(&m->cpu);
+    init_pipe_cpu(&m->pipe);
+    init_dual_pipe_cpu(&m->dual);
+    cache_reset(&m->cpu_dcache);
+}
+
+long machine_run_single(Machine *m, long max_cycles, SingleEngine engine, long *insts) {
+    init_cpu(&m->cpu);
+    cache_reset(&m->cpu_dcache);
+    if (engine == ENGINE_THREADED && !cache_enabled(&m->dcache)) {
+        long cycles = run_single_fast(m, &m->cpu, max_cycles);
+        if (insts) *insts = cycles;
+        return cycles;
+    }
+    long cycles = 0, n = 0;
+    while (m->cpu.PC < m->program_size && cycles < max_cycles) {
+        uint64_t stalls = m->cpu_dcache.st.stall_cycles;
+        step_single(m, &m->cpu);
+        cycles += 1 + (long)(m->cpu_dcache.st.stall_cycles - stalls);
+        n++;
+    }
+    if (insts) *insts = n;
+    return cycles;
+}
+
+long machine_run_pipeline(Machine *m, long max_cycles, long *retired) {
+    long cycles = 0;
+    if (m->issue_width == 2) {
+        init_dual_pipe_cpu(&m->dual);
+        while ((m->dual.core.PC < m->program_size || !dual_pipeline_empty(&m->dual)) && cycles < max_cycles) {
+            step_dual_pipe(m, &m->dual);
+            cycles++;
+        }
+        if (retired) *retired = (long)m->dual.ctr.retired;
+        return cycles;
+    }
+    init_pipe_cpu(&m->pipe);
+    while ((m->pipe.core.PC < m->program_size || !pipeline_empty(&m->pipe)) && cycles < max_cycles) {
+        step_pipe(m, &m->pipe);
+        cycles++;
+    }
+    if (retired) *retired = (long)m->pipe.ctr.retired;
+    return cycles;
+}
+
+const CpuState *machine_pipe_core(const Machine *m) {
+    return m->issue_width == 2 ? &m->dual.core : &m->pipe.core;
+}
+
+const PipeCounters *machine_pipe_counters(const Machine *m) {
+    return m->issue_width == 2 ? &m->dual.ctr : &m->pipe.ctr;
+}
+
+const Cache *machine_pipe_dcache(const Machine *m) {
+    return m->issue_width == 2 ? &m->dual.dcache : &m->pipe.dcache;
+}
@@ -0,0 +1,71 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdint.h>
+#include "isa.h"
+#include "codebook.h"
+#include "cpu_pipe.h"
+#include "cpu_fast.h"
+
+// One simulator instance: memories, the loaded program, both CPU models and
+// everything derived from them. The simulators only touch the Machine they are
+// handed, so any number of Machines can run side by side on separate threads.
+struct Machine {
+    uint16_t instr_mem[INSTR_MEM_SIZE];
+    // Pre-decoded copy of instr_mem, plus one guard entry past the end so an engine
+    // that runs off the last instruction lands on a decodable slot
+    DecodedInstr decoded_mem[INSTR_MEM_SIZE + 1];
+    unsigned long instr_mem_version;  // bumped on every instruction write
+    int program_size;                 // number of valid instructions
+
+    uint16_t *data_mem;               // data_mem_size words, allocated by resize_data_memory
+    uint32_t data_mem_size;
+
+    CpuState cpu;                     // single-cycle core
+    PipeCpu  pipe;                    // pipelined core
+    DualPipeCpu dual;                 // its dual-issue variant
+    int      issue_width;             // 1 = pipe, 2 = dual (default 1)
+    BpKind   bp_kind;                 // pipeline branch predictor (default bimodal)
+    CryptoUnitKind crypto_kind;       // pipeline ENC/DEC unit (default pipelined)
+    int      crypto_latency;          // its latency, 1..CRYPTO_MAX_LATENCY (default 4, a stage per round)
+    int      vlen;                    // vector lanes, 1..VLEN_MAX (default 8)
+    CacheConfig dcache;               // L1 data cache in front of data_mem (default off)
+    Cache    cpu_dcache;              // its tags for the single-cycle core (each pipeline has its own)
+
+    // Threaded engine: superinstruction scan of the loaded program
+    int fuse;                         // use fused handlers (default on)
+    uint8_t fuse_kind[INSTR_MEM_SIZE + 1];
+    unsigned long fused_version;
+    int fused_size;
+
+    CodebookCache codebook;           // ENC/DEC tables (used when enabled)
+};
+
+// Allocate a Machine with cleared memories and no program loaded. data_words
+// words of data memory are allocated up front (0 = none until a program loads
+// its data). Returns NULL on allocation failure.
+Machine *machine_create(uint32_t data_words);
+
+// Release a Machine and everything it owns (NULL is ignored)
+void machine_destroy(Machine *m);
+
+// Reset both CPUs to their power-on state (memories are left alone)
+void machine_reset_cpus(Machine *m);
+
+// Run the loaded program on the single-cycle core from reset until it halts or
+// max_cycles have elapsed. Returns cycles executed (data cache stalls included;
+// with a data cache the threaded engine is not used); *insts gets the
+// instructions executed.
+long machine_run_single(Machine *m, long max_cycles, SingleEngine engine, long *insts);
+
+// Run the loaded program on the pipelined core (the dual-issue one if
+// issue_width is 2) from reset until it drains or max_cycles have elapsed.
+// Returns cycles; *retired gets the instructions retired.
+long machine_run_pipeline(Machine *m, long max_cycles, long *retired);
+
+// Architectural state and counters of the pipelined core issue_width selects
+const CpuState *machine_pipe_core(const Machine *m);
+const PipeCounters *machine_pipe_counters(const Machine *m);
+const Cache *machine_pipe_dcache(const Machine *m);
+
+#endif // MACHINE_H
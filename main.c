@@ -3,211 +3,699 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include <limits.h>
 #include "isa.h"
 #include "memory.h"
 #include "crypto.h"
+#include "codebook.h"
 #include "cpu_pipe.h"
+#include "bench.h"
+#include "cpu_fast.h"
+#include "machine.h"
+#include "workpool.h"
+#include "input.h"
+#include "output.h"
+#include "trace.h"
+#include "perf.h"
+#include "cache.h"
 
 // External functions
 void init_cpu(CpuState *cpu);
-void step_single(CpuState *cpu);
-DecodedInstr decode(uint16_t raw);
-void build_streaming_program(void);
-int load_chunk_words(uint16_t key, const uint16_t *words, int blocks);
-extern int program_size;
-
-static const char *opcode_name(uint8_t op) {
-    switch (op) {
-        case OPC_LD:   return "LD";
-        case OPC_ST:   return "ST";
-        case OPC_ADDI: return "ADDI";
-        case OPC_LDK:  return "LDK";
-        case OPC_ENC:  return "ENC";
-        case OPC_DEC:  return "DEC";
-        case OPC_BNE:  return "BNE";
-        case OPC_HLT:  return "HLT";
-        case OPC_NOP:  return "NOP";
-        default:       return "???";
+void step_single(Machine *m, CpuState *cpu);
+void build_streaming_program(Machine *m);
+void build_vector_streaming_program(Machine *m);
+void build_ctr_streaming_program(Machine *m);
+void set_chunk_counters(Machine *m, int blocks, uint16_t ctr);
+int load_chunk_bytes(Machine *m, uint16_t k0, uint16_t k1, const unsigned char *bytes, size_t n,
+                     uint32_t mem_words);
+int chunk_capacity(uint32_t mem_words);
+uint32_t chunk_word_addr(int blocks, int i, int cipher);
+
+// "N", "N-M" or "N-" (open ended)
+static int parse_range(const char *s, long *lo, long *hi) {
+    char *end;
+    long a = strtol(s, &end, 0), b = a;
+    if (end == s || a < 0) return 0;
+    if (*end == '-') {
+        end++;
+        b = *end ? strtol(end, &end, 0) : LONG_MAX;
     }
+    if (*end != '\0' || b < a) return 0;
+    *lo = a;
+    *hi = b;
+    return 1;
 }
 
-static int read_key16(const char *path, uint16_t *out_key) {
+// K0 and K1 from the first four bytes of the key file, big-endian pairs.
+// A shorter file leaves the missing bytes 0 (a two-byte key means K1 = 0).
+static int read_key(const char *path, uint16_t *k0, uint16_t *k1) {
     FILE *f = fopen(path, "rb");
     if (!f) return 0;
-    unsigned char kbuf[2] = {0,0};
-    size_t n = fread(kbuf, 1, 2, f);
+    unsigned char kbuf[4] = {0, 0, 0, 0};
+    size_t n = fread(kbuf, 1, 4, f);
     fclose(f);
     if (n == 0) return 0;
-    *out_key = (uint16_t)((kbuf[0] << 8) | (n > 1 ? kbuf[1] : 0));
+    *k0 = (uint16_t)((kbuf[0] << 8) | kbuf[1]);
+    *k1 = (uint16_t)((kbuf[2] << 8) | kbuf[3]);
     return 1;
 }
 
-static int pack_words(const unsigned char *bytes, size_t len, uint16_t *out_words, int max_words) {
-    int blocks = 0;
-    size_t idx = 0;
-    while (idx < len && blocks < max_words) {
-        unsigned char b0 = bytes[idx++];
-        unsigned char b1 = (idx < len) ? bytes[idx++] : 0;
-        out_words[blocks++] = (uint16_t)((b0 << 8) | b1);
+// Copy a chunk's plaintext (cipher = 0) or ciphertext (cipher = 1) words out of banked data memory
+static void gather_words(const Machine *m, int blocks, int cipher, uint16_t *out) {
+    for (int i = 0; i < blocks; i++) {
+        out[i] = m->data_mem[chunk_word_addr(blocks, i, cipher)];
     }
-    return blocks;
 }
 
-static int pipeline_empty(const PipeCpu *p) {
-    uint8_t if_op = (p->if_id.instr >> 12) & 0xF;
-    return ((if_op == OPC_NOP || if_op == OPC_HLT) &&
-            (p->id_ex.d.opcode == OPC_NOP || p->id_ex.d.opcode == OPC_HLT) &&
-            (p->ex_mem.d.opcode == OPC_NOP || p->ex_mem.d.opcode == OPC_HLT) &&
-            (p->mem_wb.d.opcode == OPC_NOP || p->mem_wb.d.opcode == OPC_HLT));
+static double wall_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Cipher mode for --cipher: each block on its own, or XORed with the
+// encrypted block counter (build_ctr_streaming_program's output)
+typedef struct {
+    KeySchedule ks;          // derived once for the whole run
+    int ctr;
+    uint16_t iv;             // counter of the file's first block
+} NativeCipher;
+
+// One slice of the native path: packed into its own buffer and enciphered in place
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    uint16_t *words;
+    size_t blocks;
+    uint16_t ctr;            // counter of the slice's first block (CTR only)
+} NativeSlice;
+
+static void native_slice(NativeSlice *s, const NativeCipher *nc) {
+    s->blocks = pack_be_words(s->data, s->len, s->words);
+    if (nc->ctr) ctr_blocks_ks(s->words, s->words, s->blocks, &nc->ks, s->ctr);
+    else enc_blocks_ks(s->words, s->words, s->blocks, &nc->ks);
+}
+
+static void native_worker(void *job, void *arg) {
+    native_slice(job, arg);
+}
+
+// Bulk mode: stream the input through enc_blocks (or ctr_blocks) and write
+// ciphertext words, bypassing the ISA simulators. Output matches the ciphertext
+// region the streaming program (or the CTR one) leaves in data memory (odd tail
+// byte padded with 0).
+// Each input span is packed, encrypted and serialised in cache-sized slices, so
+// the bytes are touched once from the mapping (or read buffer) and once on output.
+// With threads > 1 the slices of a span run on a worker pool and are written in
+// order; a slice's counter follows from its offset, so CTR needs no hand-off
+// between them.
+static int run_native(InputSource *src, const char *input_path, const char *output_path, OutputFormat format,
+                      const NativeCipher *nc, int threads) {
+    const size_t span_bytes = (size_t)1 << 22;    // input request size (even)
+    const size_t slice_bytes = (size_t)1 << 16;   // pack/encrypt/write unit, stays in L2
+    const int depth = threads > 1 ? 2 * threads : 1;   // slices in flight
+    unsigned char *buf = src->mode == INPUT_MMAP ? NULL : input_alloc_buffer(span_bytes);
+    NativeSlice *slices = calloc((size_t)depth, sizeof(NativeSlice));
+    OutputSink out;
+    if (!output_open(&out, output_path, format)) {
+        fprintf(stderr, "Failed to open output %s\n", output_path);
+        free(buf); free(slices);
+        return 1;
+    }
+    int ok = (src->mode == INPUT_MMAP || buf) && slices;
+    for (int i = 0; ok && i < depth; i++) ok = (slices[i].words = malloc(slice_bytes)) != NULL;
+    WorkPool *pool = NULL;
+    if (ok && threads > 1) {
+        void **args = malloc((size_t)threads * sizeof(void *));
+        for (int i = 0; args && i < threads; i++) args[i] = (void *)nc;
+        pool = args ? workpool_create(threads, depth, native_worker, args) : NULL;
+        free(args);
+        if (!pool) {
+            fprintf(stderr, "Failed to start %d worker threads; running single-threaded\n", threads);
+            threads = 1;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Out of memory\n");
+        output_close(&out);
+        for (int i = 0; slices && i < depth; i++) free(slices[i].words);
+        free(buf); free(slices);
+        return 1;
+    }
+
+    size_t total_in = 0;
+    long next = 0;                                 // slices started
+    double t0 = wall_sec();
+    while (ok) {
+        const unsigned char *data;
+        size_t n = input_next(src, buf, span_bytes, &data);
+        if (n == 0) break;
+        for (size_t off = 0; ok && off < n; off += slice_bytes) {
+            // Slots are reused in submission order: a full pool's oldest slice is this slot
+            if (pool && workpool_outstanding(pool) == depth) {
+                NativeSlice *done = workpool_collect(pool);
+                ok = output_words_be(&out, done->words, done->blocks);
+            }
+            NativeSlice *s = &slices[next++ % depth];
+            s->data = data + off;
+            s->len = n - off < slice_bytes ? n - off : slice_bytes;
+            s->ctr = (uint16_t)(nc->iv + (total_in + off) / 2);
+            if (pool) {
+                workpool_submit(pool, s);
+            } else {
+                native_slice(s, nc);
+                ok = output_words_be(&out, s->words, s->blocks);
+            }
+        }
+        // The next input_next may reuse buf: finish this span first
+        NativeSlice *done;
+        while (pool && (done = workpool_collect(pool)) != NULL) {
+            if (ok) ok = output_words_be(&out, done->words, done->blocks);
+        }
+        total_in += n;
+    }
+    if (pool) workpool_destroy(pool);
+    if (src->error) ok = 0;
+    double secs = wall_sec() - t0;
+    if (!output_close(&out)) ok = 0;
+    size_t total_out = out.bytes;
+    for (int i = 0; i < depth; i++) free(slices[i].words);
+    free(buf);
+    free(slices);
+    if (!ok) {
+        fprintf(stderr, src->error ? "Failed reading %s\n" : "Failed writing %s\n", src->error ? input_path : output_path);
+        return 1;
+    }
+
+    char mode[32] = "ecb";
+    if (nc->ctr) snprintf(mode, sizeof(mode), "ctr iv=0x%04X", nc->iv);
+    printf("Native: %zu bytes from %s -> %zu bytes to %s (key=0x%04X%04X, cipher=%s, kernel=%s, input=%s, format=%s, threads=%d)\n",
+           total_in, input_path, total_out, format == OUTPUT_SUMMARY ? "(none)" : output_path, nc->ks.k0, nc->ks.k1, mode,
+           crypto_impl_name(crypto_batch_impl()), input_mode_name(src->mode), output_format_name(format), threads);
+    printf("Native: wall=%.6f s throughput=%.2f MB/s\n",
+           secs, secs > 0.0 ? (double)total_in / secs / 1e6 : 0.0);
+    return 0;
 }
 
-static void log_trace(FILE *fp, const char *sim, int chunk, int cycle, uint16_t pc, double t_ns,
-                      const char *if_s, const char *id_s, const char *ex_s, const char *mem_s, const char *wb_s,
-                      const char *extra) {
-    if (!fp) return;
-    fprintf(fp,
-            "{\"sim\":\"%s\",\"chunk\":%d,\"cycle\":%d,\"pc\":%u,\"t\":%.3f,\"if\":\"%s\",\"id\":\"%s\",\"ex\":\"%s\",\"mem\":\"%s\",\"wb\":\"%s\"%s}\n",
-            sim, chunk, cycle, pc, t_ns, if_s, id_s, ex_s, mem_s, wb_s, extra ? extra : "");
+// Record for one single-cycle or pipeline trace line; stages default to "-", no mem/wb effect
+static void trace_record_init(TraceRecord *r, uint8_t sim, int chunk, long cycle, uint16_t pc) {
+    memset(r, 0, sizeof(*r));
+    r->sim = sim;
+    r->chunk = (uint32_t)chunk;
+    r->cycle = (uint64_t)cycle;
+    r->pc = pc;
+    memset(r->stage, TRACE_STAGE_NONE, sizeof(r->stage));
+    r->mem_op = TRACE_STAGE_NONE;
 }
 
-static int run_single_cycle(int max_cycles, int verbose, int *inst_out, int chunk_idx, FILE *trace_fp, double t_clk_ns) {
-    CpuState cpu;
-    init_cpu(&cpu);
-    int cycles = 0;
-    int insts = 0;
-
-    while (cpu.PC < program_size && cycles < max_cycles) {
-        uint16_t pc_before = cpu.PC;
-        uint16_t raw = instr_mem[pc_before];
-        DecodedInstr d = decode(raw);
-        char extra[256]; extra[0] = '\0';
-        uint16_t ea = 0, before = 0, after = 0, wb_val = 0;
-        if (d.opcode == OPC_LD || d.opcode == OPC_ST || d.opcode == OPC_LDK) {
-            ea = (uint16_t)(cpu.R[d.f2] + d.imm6);
-            before = (ea < DATA_MEM_SIZE) ? data_mem[ea] : 0;
+static long run_single_cycle(Machine *m, long max_cycles, int verbose, long *inst_out, int chunk_idx, TraceWriter *trace,
+                             TraceFilter *tf, SingleEngine engine) {
+    CpuState *cpu = &m->cpu;
+    init_cpu(cpu);
+    cache_reset(&m->cpu_dcache);
+    long cycles = 0;
+    long insts = 0;
+
+    // Nothing to observe per instruction: let the threaded engine run the whole program
+    // (it has no data cache timing)
+    if (engine == ENGINE_THREADED && !trace && !verbose && !cache_enabled(&m->dcache)) {
+        cycles = machine_run_single(m, max_cycles, ENGINE_THREADED, &insts);
+    }
+
+    while (cpu->PC < m->program_size && cycles < max_cycles) {
+        uint16_t pc_before = cpu->PC;
+        DecodedInstr d = m->decoded_mem[pc_before];
+        uint32_t ea = 0;
+        uint16_t before = 0;
+        if (d.opcode == OPC_LD || d.opcode == OPC_ST || d.opcode == OPC_LDK || writes_base(&d)) {
+            ea = writes_base(&d) ? PHYS_ADDR(cpu->DB, cpu->R[d.f2]) : PHYS_ADDR(cpu->DB, cpu->R[d.f2] + d.imm6);
+            before = (ea < m->data_mem_size) ? m->data_mem[ea] : 0;
         }
         if (verbose) {
-            printf("[SC] cycle %3d PC=%3u OPC=%-4s\n", cycles, pc_before, opcode_name(d.opcode));
-        }
-        log_trace(trace_fp, "single", chunk_idx, cycles, pc_before, cycles * t_clk_ns,
-                  opcode_name(d.opcode), opcode_name(d.opcode), opcode_name(d.opcode), opcode_name(d.opcode), opcode_name(d.opcode),
-                  extra[0] ? extra : NULL);
-
-        step_single(&cpu);
-
-        switch (d.opcode) {
-            case OPC_LD:
-                after = (ea < DATA_MEM_SIZE) ? data_mem[ea] : 0;
-                wb_val = cpu.R[d.f1];
-                snprintf(extra, sizeof(extra),
-                         ",\"mem\":{\"op\":\"LD\",\"ea\":%u,\"before\":%u,\"after\":%u},\"wb\":{\"dest\":\"R%u\",\"val\":%u}",
-                         ea, before, after, d.f1, wb_val);
-                break;
-            case OPC_ST:
-                after = (ea < DATA_MEM_SIZE) ? data_mem[ea] : 0;
-                snprintf(extra, sizeof(extra),
-                         ",\"mem\":{\"op\":\"ST\",\"ea\":%u,\"before\":%u,\"after\":%u,\"val\":%u}",
-                         ea, before, after, cpu.R[d.f1]);
-                break;
-            case OPC_LDK:
-                after = (ea < DATA_MEM_SIZE) ? data_mem[ea] : 0;
-                wb_val = (d.f1 == 6) ? cpu.K0 : cpu.K1;
-                snprintf(extra, sizeof(extra),
-                         ",\"mem\":{\"op\":\"LDK\",\"ea\":%u,\"before\":%u},\"wb\":{\"dest\":\"K%u\",\"val\":%u}",
-                         ea, before, d.f1 - 6, wb_val);
-                break;
-            case OPC_ADDI:
-            case OPC_ENC:
-            case OPC_DEC:
-                wb_val = cpu.R[d.f1];
-                snprintf(extra, sizeof(extra),
-                         ",\"wb\":{\"dest\":\"R%u\",\"val\":%u}", d.f1, wb_val);
-                break;
-            default:
-                extra[0] = '\0';
-                break;
-        }
-        if (trace_fp && extra[0]) {
-            // Add a second log line capturing the effects (WB/memory) for this instruction.
-            log_trace(trace_fp, "single", chunk_idx, cycles, pc_before, cycles * t_clk_ns,
-                      opcode_name(d.opcode), "-", "-", "-", "-",
-                      extra);
+            printf("[SC] cycle %3ld PC=%3u OPC=%-4s\n", cycles, pc_before, opcode_name(d.opcode));
+        }
+        TraceRecord r;
+        uint64_t stalls = m->cpu_dcache.st.stall_cycles;
+        int keep = trace && trace_want(tf, TRACE_SIM_SINGLE, cycles, pc_before);
+        if (keep) {
+            trace_record_init(&r, TRACE_SIM_SINGLE, chunk_idx, cycles, pc_before);
+            memset(r.stage, d.opcode, sizeof(r.stage));
+            trace_emit(trace, &r);
+            tf->kept++;
+        }
+
+        step_single(m, cpu);
+
+        if (keep) {
+            // Second record with the instruction's effects (memory / writeback)
+            trace_record_init(&r, TRACE_SIM_SINGLE, chunk_idx, cycles, pc_before);
+            r.stage[0] = d.opcode;
+            switch (d.opcode) {
+                case OPC_LD:
+                case OPC_ST:
+                case OPC_LDK:
+                case OPC_LDP:
+                case OPC_STP:
+                    r.mem_op = d.opcode;
+                    r.mem_ea = ea;
+                    r.mem_before = before;
+                    if (d.opcode != OPC_LDK) {
+                        r.mem_flags = TRACE_MEM_AFTER;
+                        r.mem_after = (ea < m->data_mem_size) ? m->data_mem[ea] : 0;
+                    }
+                    if (d.opcode == OPC_ST || d.opcode == OPC_STP) {
+                        r.mem_flags |= TRACE_MEM_VAL;
+                        r.mem_val = cpu->R[d.f1];
+                    } else {
+                        r.wb_kind = d.opcode == OPC_LDK ? TRACE_WB_KEY : TRACE_WB_REG;
+                        r.wb_reg = d.f1;
+                        r.wb_val = d.opcode == OPC_LDK ? ((d.f1 == 6) ? cpu->K0 : cpu->K1) : cpu->R[d.f1];
+                    }
+                    break;
+                case OPC_ADDI:
+                case OPC_ADD:
+                case OPC_XOR:
+                case OPC_ENC:
+                case OPC_DEC:
+                    r.wb_kind = TRACE_WB_REG;
+                    r.wb_reg = d.f1;
+                    r.wb_val = cpu->R[d.f1];
+                    break;
+                case OPC_VEC:
+                    // Scalar side only (VL / pointer updates); lanes are not traced
+                    if (writes_reg_file(&d)) {
+                        r.wb_kind = TRACE_WB_REG;
+                        r.wb_reg = d.f1;
+                        r.wb_val = cpu->R[d.f1];
+                    }
+                    break;
+                default:
+                    break;
+            }
+            if (r.mem_op != TRACE_STAGE_NONE || r.wb_kind != TRACE_WB_NONE) {
+                trace_emit(trace, &r);
+                tf->kept++;
+            }
         }
         insts++;
-        cycles++;
+        cycles += 1 + (long)(m->cpu_dcache.st.stall_cycles - stalls);   // a miss stretches the instruction
     }
     if (inst_out) *inst_out = insts;
-    double cpi = insts > 0 ? (double)cycles / (double)insts : 0.0;
-    printf("Single-cycle: cycles=%d CPI=%.2f\n", cycles, cpi);
     return cycles;
 }
 
-static int run_pipeline(int max_cycles, int verbose, int *inst_out, int chunk_idx, FILE *trace_fp, double t_clk_ns) {
-    PipeCpu pcpu;
-    init_pipe_cpu(&pcpu);
-    int cycles = 0;
-    int retired = 0;
-
-    while ((pcpu.core.PC < program_size || !pipeline_empty(&pcpu)) && cycles < max_cycles) {
-        const char *if_s  = opcode_name((pcpu.if_id.instr >> 12) & 0xF);
-        const char *id_s  = opcode_name(pcpu.id_ex.d.opcode);
-        const char *ex_s  = opcode_name(pcpu.ex_mem.d.opcode);
-        const char *mem_s = opcode_name(pcpu.ex_mem.d.opcode);
-        const char *wb_s  = opcode_name(pcpu.mem_wb.d.opcode);
-
-        char extra[256];
-        extra[0] = '\0';
-        int off = 0;
-
-        // Mem stage effects (address computed in EX/MEM)
-        if (pcpu.ex_mem.d.opcode == OPC_LD || pcpu.ex_mem.d.opcode == OPC_ST || pcpu.ex_mem.d.opcode == OPC_LDK) {
-            uint16_t ea = pcpu.ex_mem.alu_result;
-            uint16_t before = (ea < DATA_MEM_SIZE) ? data_mem[ea] : 0;
-            if (pcpu.ex_mem.d.opcode == OPC_ST) {
-                uint16_t after = pcpu.ex_mem.rs2_val;
-                off += snprintf(extra + off, sizeof(extra) - off,
-                                 ",\"mem\":{\"op\":\"ST\",\"ea\":%u,\"before\":%u,\"after\":%u,\"val\":%u}",
-                                 ea, before, after, pcpu.ex_mem.rs2_val);
-            } else {
-                uint16_t after = before; // loads do not modify memory
-                off += snprintf(extra + off, sizeof(extra) - off,
-                                 ",\"mem\":{\"op\":\"%s\",\"ea\":%u,\"before\":%u,\"after\":%u}",
-                                 (pcpu.ex_mem.d.opcode == OPC_LD ? "LD" : "LDK"), ea, before, after);
-            }
+// Pipeline trace line for one lane: the opcode in each stage, the access MEM
+// is about to make (address computed in EX/MEM) and the write WB is about to make
+static void pipe_trace_lane(const Machine *m, TraceRecord *r, const IF_ID *fi, const ID_EX *id, const EX_MEM *ex,
+                            const MEM_WB *wbr) {
+    DecodedInstr wb = wbr->d;
+    r->stage[0] = fi->d.opcode;
+    r->stage[1] = id->d.opcode;
+    r->stage[2] = ex->d.opcode;
+    r->stage[3] = ex->d.opcode;
+    r->stage[4] = wb.opcode;
+
+    // Loads do not modify memory
+    uint8_t mop = ex->d.opcode;
+    if (mop == OPC_LD || mop == OPC_ST || mop == OPC_LDK || mop == OPC_LDP || mop == OPC_STP) {
+        uint32_t ea = ex->mem_addr;
+        r->mem_op = mop;
+        r->mem_ea = ea;
+        r->mem_before = (ea < m->data_mem_size) ? m->data_mem[ea] : 0;
+        r->mem_flags = TRACE_MEM_AFTER;
+        r->mem_after = r->mem_before;
+        if (mop == OPC_ST || mop == OPC_STP) {
+            r->mem_flags |= TRACE_MEM_VAL;
+            r->mem_after = r->mem_val = ex->rs2_val;
         }
+    }
 
-        // WB stage effects (writeback already computed in mem_wb)
-        DecodedInstr wb = pcpu.mem_wb.d;
-        if (wb.opcode == OPC_LD || wb.opcode == OPC_ADDI || wb.opcode == OPC_ENC || wb.opcode == OPC_DEC) {
-            off += snprintf(extra + off, sizeof(extra) - off,
-                             ",\"wb\":{\"dest\":\"R%u\",\"val\":%u}", wb.f1, pcpu.mem_wb.write_val);
-        } else if (wb.opcode == OPC_LDK) {
-            off += snprintf(extra + off, sizeof(extra) - off,
-                             ",\"wb\":{\"dest\":\"K%u\",\"val\":%u}", wb.f1 - 6, pcpu.mem_wb.write_val);
+    if (writes_reg_file(&wb)) {
+        r->wb_kind = TRACE_WB_REG;
+    } else if (wb.opcode == OPC_LDK) {
+        r->wb_kind = TRACE_WB_KEY;
+    }
+    r->wb_reg = wb.f1;
+    r->wb_val = wbr->write_val;
+}
+
+static long run_pipeline(Machine *m, long max_cycles, int verbose, long *inst_out, int chunk_idx, TraceWriter *trace,
+                         TraceFilter *tf) {
+    PipeCpu *pcpu = &m->pipe;
+    init_pipe_cpu(pcpu);
+    long cycles = 0;
+
+    while ((pcpu->core.PC < m->program_size || !pipeline_empty(pcpu)) && cycles < max_cycles) {
+        if (verbose) {
+            printf("[PL] cycle %3ld PC=%3u IF=%-4s ID=%-4s EX=%-4s MEM=%-4s WB=%-4s\n",
+                   cycles, pcpu->core.PC, opcode_name(pcpu->if_id.d.opcode), opcode_name(pcpu->id_ex.d.opcode),
+                   opcode_name(pcpu->ex_mem.d.opcode), opcode_name(pcpu->ex_mem.d.opcode),
+                   opcode_name(pcpu->mem_wb.d.opcode));
+        }
+
+        if (trace && trace_want(tf, TRACE_SIM_PIPELINE, cycles, pcpu->core.PC)) {
+            TraceRecord r;
+            trace_record_init(&r, TRACE_SIM_PIPELINE, chunk_idx, cycles, pcpu->core.PC);
+            pipe_trace_lane(m, &r, &pcpu->if_id, &pcpu->id_ex, &pcpu->ex_mem, &pcpu->mem_wb);
+            trace_emit(trace, &r);
+            tf->kept++;
         }
 
+        step_pipe(m, pcpu);
+        if (trace && tf->armed && pcpu->stalled) tf->armed = 0;   // trace from the bubble on
+        cycles++;
+    }
+    if (inst_out) *inst_out = (long)pcpu->ctr.retired;
+    return cycles;
+}
+
+// Same for the dual-issue pipeline: a trace line per lane, lane 0 first
+static long run_dual_pipeline(Machine *m, long max_cycles, int verbose, long *inst_out, int chunk_idx,
+                              TraceWriter *trace, TraceFilter *tf) {
+    DualPipeCpu *dcpu = &m->dual;
+    init_dual_pipe_cpu(dcpu);
+    long cycles = 0;
+
+    while ((dcpu->core.PC < m->program_size || !dual_pipeline_empty(dcpu)) && cycles < max_cycles) {
         if (verbose) {
-            printf("[PL] cycle %3d PC=%3u IF=%-4s ID=%-4s EX=%-4s MEM=%-4s WB=%-4s\n",
-                   cycles, pcpu.core.PC, if_s, id_s, ex_s, mem_s, wb_s);
+            printf("[PL] cycle %3ld PC=%3u", cycles, dcpu->core.PC);
+            const uint8_t ops[5][ISSUE_WIDTH_MAX] = {
+                { dcpu->if_id[0].d.opcode, dcpu->if_id[1].d.opcode },
+                { dcpu->id_ex[0].d.opcode, dcpu->id_ex[1].d.opcode },
+                { dcpu->ex_mem[0].d.opcode, dcpu->ex_mem[1].d.opcode },
+                { dcpu->ex_mem[0].d.opcode, dcpu->ex_mem[1].d.opcode },
+                { dcpu->mem_wb[0].d.opcode, dcpu->mem_wb[1].d.opcode },
+            };
+            static const char *const STAGES[] = { "IF", "ID", "EX", "MEM", "WB" };
+            for (int st = 0; st < 5; st++) {
+                printf(" %s=%-4s/%-4s", STAGES[st], opcode_name(ops[st][0]), opcode_name(ops[st][1]));
+            }
+            printf("\n");
         }
-        if (wb.opcode != OPC_NOP && wb.opcode != OPC_HLT) retired++;
 
-        log_trace(trace_fp, "pipeline", chunk_idx, cycles, pcpu.core.PC, cycles * t_clk_ns, if_s, id_s, ex_s, mem_s, wb_s,
-                  extra[0] ? extra : NULL);
+        if (trace && trace_want(tf, TRACE_SIM_PIPELINE, cycles, dcpu->core.PC)) {
+            for (int l = 0; l < ISSUE_WIDTH_MAX; l++) {
+                TraceRecord r;
+                trace_record_init(&r, TRACE_SIM_PIPELINE, chunk_idx, cycles, dcpu->core.PC);
+                r.slot = (uint8_t)l;
+                pipe_trace_lane(m, &r, &dcpu->if_id[l], &dcpu->id_ex[l], &dcpu->ex_mem[l], &dcpu->mem_wb[l]);
+                trace_emit(trace, &r);
+                tf->kept++;
+            }
+        }
 
-        step_pipe(&pcpu);
+        step_dual_pipe(m, dcpu);
+        if (trace && tf->armed && dcpu->stalled) tf->armed = 0;
         cycles++;
     }
-    if (inst_out) *inst_out = retired;
-    printf("Pipeline:     cycles=%d (retired=%d)\n", cycles, retired);
+    if (inst_out) *inst_out = (long)dcpu->ctr.retired;
     return cycles;
 }
 
+// Settings shared by every chunk of a simulation run (read-only once workers start)
+typedef struct {
+    uint16_t k0, k1;
+    uint32_t mem_words;
+    int max_blocks;          // blocks per chunk
+    SingleEngine engine;
+    int fuse;                // superinstruction fusion in the threaded engine
+    int verbose;
+    size_t dump_cap;         // bytes of each chunk to print as hex/text (0 = no dumps)
+    TraceWriter *trace;      // -t (NULL = off)
+    TraceFilter *tfilter;    // what -t keeps (updated as the run goes; tracing is single-threaded)
+    PerfDump *perf;          // --counters (NULL = off); written in report order
+    BpKind bp;               // pipeline branch predictor
+    CryptoUnitKind crypto_unit;   // pipeline ENC/DEC unit
+    int crypto_latency;
+    int issue_width;         // 1 = scalar pipeline, 2 = dual issue
+    int vlen;                // > 0: vectorised streaming program on this many lanes
+    int ctr;                 // CTR streaming program instead of ECB
+    uint16_t ctr_iv;         // counter of the input's first block
+    CacheConfig dcache;      // L1 data cache for both simulators (words == 0: none)
+} SimConfig;
+
+// One chunk of input plus everything its report needs. The reader fills in
+// idx/n/data, run_chunk the rest (on a worker thread when running in parallel).
+typedef struct {
+    int idx;
+    size_t n;                     // input bytes
+    const unsigned char *data;    // input bytes: into the file mapping, or buf
+    unsigned char *buf;           // read buffer (not used when the input is mapped)
+    uint16_t *words;              // decrypted text
+    uint16_t *ct;            // ciphertext left by the pipeline run
+    uint16_t *sc_ct;         // ciphertext left by the single-cycle run (only when written out)
+    int blocks;              // 0 if data memory could not be sized
+    int windows;
+    long c_sc, c_pl;
+    long inst_sc, inst_pl;
+    PipeCounters pl_ctr;
+    CacheStats sc_dcache, pl_dcache;
+} Chunk;
+
+// Per-thread simulator: its own Machine, so workers never share memories
+typedef struct {
+    Machine *m;
+    const SimConfig *cfg;
+} SimWorker;
+
+typedef struct {
+    size_t bytes;
+    long cycles_sc, cycles_pl;
+    long insts_sc, insts_pl;
+    PipeCounters pipe;
+    CacheStats dcache_sc, dcache_pl;
+} RunTotals;
+
+static void print_chunk_header(const Chunk *c) {
+    printf("\n--- Chunk %d: blocks=%d windows=%d bytes=%zu ---\n", c->idx, c->blocks, c->windows, c->n);
+}
+
+// Trace writer for one simulator on one chunk, or NULL if the filter would drop
+// every record (so that run takes the untraced path). The pipeline is traced
+// while a trigger is armed, since it is what fires it.
+static TraceWriter *chunk_trace(const SimConfig *cfg, int chunk, unsigned sim) {
+    const TraceFilter *tf = cfg->tfilter;
+    if (!cfg->trace || chunk < tf->chunk_lo || chunk > tf->chunk_hi) return NULL;
+    if (tf->max_records && tf->kept >= tf->max_records) return NULL;
+    if (tf->armed) return sim == TRACE_SIM_PIPELINE ? cfg->trace : NULL;
+    return (tf->sims & (1u << sim)) ? cfg->trace : NULL;
+}
+
+// Load one chunk into m and run both simulators on it
+static void run_chunk(Machine *m, const SimConfig *cfg, Chunk *c) {
+    c->blocks = load_chunk_bytes(m, cfg->k0, cfg->k1, c->data, c->n, cfg->mem_words);
+    if (c->blocks == 0) return;
+    if (cfg->ctr) set_chunk_counters(m, c->blocks, (uint16_t)(cfg->ctr_iv + (long)c->idx * cfg->max_blocks));
+    c->windows = (c->blocks + WINDOW_BLOCKS - 1) / WINDOW_BLOCKS;
+    // Each block is one iteration of the encrypt loop and one of the decrypt loop:
+    // 3 instructions each (LDP, ENC/DEC, STP), 5 with --cipher ctr (ENC, LDP, ADDI,
+    // XOR, STP), fewer with --vlen. Allow 16 cycles per iteration (all 5 stalled or
+    // flushed at 3 cycles each) plus the crypto unit's latency, and each window's
+    // setup code twice. Measured worst: 11 + latency (ECB pipeline).
+    long max_cycles = (32L + 2L * m->crypto_latency) * c->blocks + 2L * m->program_size * c->windows + 64;
+    // A data cache can make each of a block's four accesses miss and write back a dirty line
+    if (cache_enabled(&m->dcache)) max_cycles += (8L * c->blocks + 4L * c->windows + 8) * m->dcache.miss_latency;
+
+    // Per-cycle output only happens single-threaded, so it can be interleaved here
+    if (cfg->verbose) print_chunk_header(c);
+    c->c_sc = run_single_cycle(m, max_cycles, cfg->verbose, &c->inst_sc, c->idx,
+                             chunk_trace(cfg, c->idx, TRACE_SIM_SINGLE), cfg->tfilter, cfg->engine);
+    c->sc_dcache = m->cpu_dcache.st;
+    if (c->sc_ct) gather_words(m, c->blocks, 1, c->sc_ct);
+    c->c_pl = (m->issue_width == 2 ? run_dual_pipeline : run_pipeline)(m, max_cycles, cfg->verbose, &c->inst_pl, c->idx,
+                         chunk_trace(cfg, c->idx, TRACE_SIM_PIPELINE), cfg->tfilter);
+    c->pl_ctr = *machine_pipe_counters(m);
+    c->pl_dcache = machine_pipe_dcache(m)->st;
+    gather_words(m, c->blocks, 1, c->ct);
+    gather_words(m, c->blocks, 0, c->words);
+}
+
+static void chunk_worker(void *job, void *arg) {
+    SimWorker *w = arg;
+    run_chunk(w->m, w->cfg, job);
+}
+
+// Print a finished chunk, append its ciphertext to out and add it to the totals.
+// Chunks arrive here in input order. Returns 0 if the chunk failed.
+static int report_chunk(Chunk *c, const SimConfig *cfg, OutputSink *out, const char *output_path, RunTotals *tot) {
+    if (c->blocks == 0) {
+        fprintf(stderr, "Out of memory sizing data memory\n");
+        return 0;
+    }
+    int ok = 1;
+    tot->bytes += c->n;
+    if (!cfg->verbose) print_chunk_header(c);
+    printf("Single-cycle: cycles=%ld CPI=%.2f\n", c->c_sc,
+           c->inst_sc > 0 ? (double)c->c_sc / (double)c->inst_sc : 0.0);
+    if (cache_enabled(&cfg->dcache)) cache_print_stats(stdout, "  L1D:", &c->sc_dcache);
+    if (out && !output_words_be(out, c->sc_ct, (size_t)c->blocks)) {
+        fprintf(stderr, "Failed writing %s\n", output_path);
+        ok = 0;
+    }
+    printf("Pipeline:     cycles=%ld (retired=%ld)\n", c->c_pl, c->inst_pl);
+    pipe_counters_print(stdout, "  counters:", &c->pl_ctr);
+    if (cache_enabled(&cfg->dcache)) cache_print_stats(stdout, "  L1D:", &c->pl_dcache);
+    pipe_counters_add(&tot->pipe, &c->pl_ctr);
+    cache_add_stats(&tot->dcache_sc, &c->sc_dcache);
+    cache_add_stats(&tot->dcache_pl, &c->pl_dcache);
+    if (cfg->perf) perf_dump_chunk(cfg->perf, c->idx, &c->pl_ctr);
+    tot->cycles_sc += c->c_sc;
+    tot->cycles_pl += c->c_pl;
+    tot->insts_sc += c->inst_sc;
+    tot->insts_pl += c->inst_pl;
+
+    if (cfg->dump_cap > 0) {
+        dump_words(stdout, "Ciphertext (hex words): ", c->ct, c->n, cfg->dump_cap);
+        dump_hex(stdout, "Ciphertext bytes (hex): ", c->ct, c->n, cfg->dump_cap);
+        dump_text(stdout, "Ciphertext text     : ", c->ct, c->n, cfg->dump_cap, 1);
+        dump_hex(stdout, "Decrypted bytes (hex): ", c->words, c->n, cfg->dump_cap);
+        dump_text(stdout, "Decrypted text     : ", c->words, c->n, cfg->dump_cap, 0);
+    }
+    return ok;
+}
+
+static void free_chunks(Chunk *chunks, int count) {
+    for (int i = 0; chunks && i < count; i++) {
+        free(chunks[i].buf);
+        free(chunks[i].words);
+        free(chunks[i].ct);
+        free(chunks[i].sc_ct);
+    }
+    free(chunks);
+}
+
+// Simulate the whole input chunk by chunk. With threads > 1, chunks run on a
+// worker pool (one Machine per worker) and are reported in input order, so
+// the output and the cycle totals match a single-threaded run.
+static int run_sim(InputSource *src, OutputSink *out, const char *output_path, const SimConfig *cfg,
+                   int threads, int use_codebook, RunTotals *tot, CodebookStats *cb_stats) {
+    const size_t chunk_bytes = (size_t)cfg->max_blocks * 2;
+    const int depth = threads > 1 ? 2 * threads : 1;   // chunks in flight
+    int rc = 0;
+
+    SimWorker *workers = calloc((size_t)threads, sizeof(SimWorker));
+    void **worker_args = calloc((size_t)threads, sizeof(void *));
+    Chunk *chunks = calloc((size_t)depth, sizeof(Chunk));
+    if (!workers || !worker_args || !chunks) {
+        fprintf(stderr, "Out of memory\n");
+        free(workers); free(worker_args); free(chunks);
+        return 1;
+    }
+    for (int i = 0; i < depth; i++) {
+        Chunk *c = &chunks[i];
+        if (src->mode != INPUT_MMAP && !(c->buf = input_alloc_buffer(chunk_bytes))) rc = 1;
+        c->words = malloc((size_t)cfg->max_blocks * sizeof(uint16_t));
+        c->ct = malloc((size_t)cfg->max_blocks * sizeof(uint16_t));
+        if (out) c->sc_ct = malloc((size_t)cfg->max_blocks * sizeof(uint16_t));
+        if (!c->words || !c->ct || (out && !c->sc_ct)) rc = 1;
+    }
+    // The program is independent of the data, so each Machine builds it once for the whole run
+    for (int i = 0; i < threads && !rc; i++) {
+        workers[i].m = machine_create(0);
+        if (!workers[i].m) { rc = 1; break; }
+        codebook_set_enabled(&workers[i].m->codebook, use_codebook);
+        single_fast_set_fusion(workers[i].m, cfg->fuse);
+        workers[i].m->bp_kind = cfg->bp;
+        workers[i].m->crypto_kind = cfg->crypto_unit;
+        workers[i].m->crypto_latency = cfg->crypto_latency;
+        workers[i].m->issue_width = cfg->issue_width;
+        workers[i].m->dcache = cfg->dcache;
+        if (cfg->vlen) {
+            workers[i].m->vlen = cfg->vlen;
+            build_vector_streaming_program(workers[i].m);
+        } else if (cfg->ctr) {
+            build_ctr_streaming_program(workers[i].m);
+        } else {
+            build_streaming_program(workers[i].m);
+        }
+        workers[i].cfg = cfg;
+        worker_args[i] = &workers[i];
+    }
+    if (rc) fprintf(stderr, "Out of memory\n");
+
+    WorkPool *pool = NULL;
+    if (!rc && threads > 1) {
+        pool = workpool_create(threads, depth, chunk_worker, worker_args);
+        if (!pool) fprintf(stderr, "Failed to start %d worker threads; running single-threaded\n", threads);
+    }
+
+    int ok = !rc;
+    long seq = 0;
+    while (ok) {
+        if (pool && workpool_outstanding(pool) == depth) {
+            ok = report_chunk(workpool_collect(pool), cfg, out, output_path, tot);
+            if (!ok) break;
+        }
+        Chunk *c = &chunks[seq % depth];
+        c->n = input_next(src, c->buf, chunk_bytes, &c->data);
+        if (c->n == 0) break;
+        c->idx = (int)seq++;
+        if (pool) {
+            workpool_submit(pool, c);
+        } else {
+            run_chunk(workers[0].m, cfg, c);
+            ok = report_chunk(c, cfg, out, output_path, tot);
+        }
+    }
+    if (pool) {
+        Chunk *c;
+        while ((c = workpool_collect(pool)) != NULL) {
+            if (ok) ok = report_chunk(c, cfg, out, output_path, tot);
+        }
+        workpool_destroy(pool);
+    }
+    if (!ok) rc = 1;
+    if (src->error) {
+        fprintf(stderr, "Failed reading input\n");
+        rc = 1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        if (!workers[i].m) continue;
+        CodebookStats st;
+        codebook_get_stats(&workers[i].m->codebook, &st);
+        codebook_add_stats(cb_stats, &st);
+        machine_destroy(workers[i].m);
+    }
+    free_chunks(chunks, depth);
+    free(workers);
+    free(worker_args);
+    return rc;
+}
+
 int main(int argc, char **argv) {
     const char *key_path = "key.txt";
     const char *input_path = "input.txt";
     const char *trace_path = NULL;
+    TraceFormat trace_format = TRACE_BIN;
+    TraceFilter tfilter;
+    trace_filter_init(&tfilter);
+    const char *bench_name = NULL;
+    long bench_max_mb = 1024;  // --bench-max-mb: largest file the input benchmark writes
+    const char *output_path = NULL;
+    const char *counters_path = NULL;  // --counters: per-chunk pipeline counters (.csv = CSV, else JSON)
+    int native = 0;
+    SingleEngine engine = single_fast_available() ? ENGINE_THREADED : ENGINE_SWITCH;
+    uint32_t mem_words = DATA_MEM_DEFAULT_WORDS;
     int verbose = 0;
+    int threads = 1;          // -j: simulator worker threads (0 = one per CPU)
+    int chunk_blocks = 0;     // --chunk-blocks: blocks per chunk (0 = as many as data memory holds)
+    int use_codebook = 0;
+    int fuse = 1;
+    BpKind bp = BP_BIMODAL;
+    CryptoUnitKind crypto_unit = CRYPTO_UNIT_PIPELINED;
+    int crypto_latency = 4;
+    int issue_width = 1;
+    int vlen = 0;
+    NativeCipher cipher = { .ctr = 0, .iv = 0 };   // --cipher / --ctr-iv, both modes
+    // --dcache-words enables the L1 data cache; the other --dcache-* options shape it,
+    // --prefetch and --store-buffer add units in front of it in the pipeline's MEM stage
+    CacheConfig dcache = { .words = 0, .ways = 2, .line_words = 8, .repl = CACHE_REPL_LRU,
+                           .write = CACHE_WRITE_BACK, .miss_latency = 10 };
+    InputMode input_mode = INPUT_AUTO;
+    OutputFormat out_format = OUTPUT_BIN;
+    size_t dump_cap = 0;      // --dump: bytes of each chunk printed to the console (0 = none)
     double t_single_ns = 5.0; // assumed single-cycle clock period (ns)
     double t_pipe_ns   = 1.0; // assumed pipeline clock period (ns)
 
@@ -215,125 +703,313 @@ int main(int argc, char **argv) {
         if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) key_path = argv[++i];
         else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) input_path = argv[++i];
         else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) trace_path = argv[++i];
+        else if (strcmp(argv[i], "--trace-chunks") == 0 && i + 1 < argc) {
+            if (!parse_range(argv[++i], &tfilter.chunk_lo, &tfilter.chunk_hi)) {
+                fprintf(stderr, "Bad chunk range %s (N, N-M or N-)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--trace-sim") == 0 && i + 1 < argc) {
+            const char *v = argv[++i];
+            if (strcmp(v, "single") == 0) tfilter.sims = 1u << TRACE_SIM_SINGLE;
+            else if (strcmp(v, "pipeline") == 0) tfilter.sims = 1u << TRACE_SIM_PIPELINE;
+            else if (strcmp(v, "both") == 0) tfilter.sims = (1u << TRACE_SIM_SINGLE) | (1u << TRACE_SIM_PIPELINE);
+            else {
+                fprintf(stderr, "Unknown trace sim %s (single|pipeline|both)\n", v);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--trace-every") == 0 && i + 1 < argc) tfilter.every = strtol(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--trace-pc") == 0 && i + 1 < argc) {
+            // PC or PC:R (window of R instructions either side)
+            char *end;
+            long pc = strtol(argv[++i], &end, 0), r = 0;
+            if (*end == ':') r = strtol(end + 1, &end, 0);
+            if (*end != '\0' || pc < 0 || r < 0) {
+                fprintf(stderr, "Bad PC window %s (PC or PC:R)\n", argv[i]);
+                return 1;
+            }
+            tfilter.pc_lo = pc - r;
+            tfilter.pc_hi = pc + r;
+        }
+        else if (strcmp(argv[i], "--trace-trigger") == 0 && i + 1 < argc) {
+            const char *v = argv[++i];
+            if (strcmp(v, "load-use") == 0) tfilter.trigger = TRACE_TRIGGER_LOAD_USE;
+            else if (strcmp(v, "none") == 0) tfilter.trigger = TRACE_TRIGGER_NONE;
+            else {
+                fprintf(stderr, "Unknown trace trigger %s (load-use|none)\n", v);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--trace-max") == 0 && i + 1 < argc) tfilter.max_records = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--trace-format") == 0 && i + 1 < argc) {
+            if (!trace_parse_format(argv[++i], &trace_format)) {
+                fprintf(stderr, "Unknown trace format %s (bin|jsonl)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) output_path = argv[++i];
+        else if (strcmp(argv[i], "--counters") == 0 && i + 1 < argc) counters_path = argv[++i];
         else if (strcmp(argv[i], "-v") == 0) verbose = 1;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (strncmp(argv[i], "--mode=", 7) == 0) {
+            if (strcmp(argv[i] + 7, "native") == 0) native = 1;
+            else if (strcmp(argv[i] + 7, "sim") == 0) native = 0;
+            else {
+                fprintf(stderr, "Unknown mode %s (sim|native)\n", argv[i] + 7);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--cipher") == 0 && i + 1 < argc) {
+            const char *v = argv[++i];
+            if (strcmp(v, "ecb") == 0) cipher.ctr = 0;
+            else if (strcmp(v, "ctr") == 0) cipher.ctr = 1;
+            else {
+                fprintf(stderr, "Unknown cipher mode %s (ecb|ctr)\n", v);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--ctr-iv") == 0 && i + 1 < argc) cipher.iv = (uint16_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--codebook") == 0) use_codebook = 1;
+        else if (strcmp(argv[i], "--bp") == 0 && i + 1 < argc) {
+            if (!bp_parse_kind(argv[++i], &bp)) {
+                fprintf(stderr, "Unknown branch predictor %s (none|btfn|bimodal|btb)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--crypto-unit") == 0 && i + 1 < argc) {
+            if (!crypto_unit_parse(argv[++i], &crypto_unit)) {
+                fprintf(stderr, "Unknown crypto unit %s (pipelined|iterative)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--crypto-latency") == 0 && i + 1 < argc) {
+            crypto_latency = atoi(argv[++i]);
+            if (crypto_latency < 1 || crypto_latency > CRYPTO_MAX_LATENCY) {
+                fprintf(stderr, "--crypto-latency must be 1..%d\n", CRYPTO_MAX_LATENCY);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--issue-width") == 0 && i + 1 < argc) {
+            issue_width = atoi(argv[++i]);
+            if (issue_width < 1 || issue_width > ISSUE_WIDTH_MAX) {
+                fprintf(stderr, "--issue-width must be 1..%d\n", ISSUE_WIDTH_MAX);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--dcache-words") == 0 && i + 1 < argc) dcache.words = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--dcache-ways") == 0 && i + 1 < argc) dcache.ways = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dcache-line") == 0 && i + 1 < argc) dcache.line_words = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dcache-miss") == 0 && i + 1 < argc) dcache.miss_latency = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dcache-repl") == 0 && i + 1 < argc) {
+            if (!cache_repl_parse(argv[++i], &dcache.repl)) {
+                fprintf(stderr, "Unknown replacement policy %s (lru|plru)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            if (!cache_prefetch_parse(argv[++i], &dcache.prefetch)) {
+                fprintf(stderr, "Unknown prefetcher %s (none|next-line|stride)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--store-buffer") == 0 && i + 1 < argc) dcache.store_buffer = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dcache-write") == 0 && i + 1 < argc) {
+            if (!cache_write_parse(argv[++i], &dcache.write)) {
+                fprintf(stderr, "Unknown write policy %s (wb|wt)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--no-fuse") == 0) fuse = 0;
+        else if (strcmp(argv[i], "--vlen") == 0 && i + 1 < argc) {
+            vlen = atoi(argv[++i]);
+            if (vlen < 1 || vlen > VLEN_MAX) {
+                fprintf(stderr, "--vlen must be 1..%d\n", VLEN_MAX);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            const char *e = argv[++i];
+            if (strcmp(e, "switch") == 0) engine = ENGINE_SWITCH;
+            else if (strcmp(e, "threaded") == 0 && single_fast_available()) engine = ENGINE_THREADED;
+            else {
+                fprintf(stderr, "Unknown or unavailable engine %s (switch|threaded)\n", e);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--mem-words") == 0 && i + 1 < argc) mem_words = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--chunk-blocks") == 0 && i + 1 < argc) chunk_blocks = atoi(argv[++i]);
         else if (strcmp(argv[i], "--t-single") == 0 && i + 1 < argc) t_single_ns = strtod(argv[++i], NULL);
         else if (strcmp(argv[i], "--t-pipe") == 0 && i + 1 < argc)   t_pipe_ns   = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)    bench_name  = argv[++i];
+        else if (strcmp(argv[i], "--bench-max-mb") == 0 && i + 1 < argc) bench_max_mb = strtol(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            if (!input_parse_mode(argv[++i], &input_mode)) {
+                fprintf(stderr, "Unknown input mode %s (auto|mmap|read)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (!output_parse_format(argv[++i], &out_format)) {
+                fprintf(stderr, "Unknown output format %s (bin|hex|summary)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) dump_cap = (size_t)strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--sbox") == 0 && i + 1 < argc) {
+            SboxLayout layout;
+            if (!crypto_parse_layout(argv[++i], &layout)) {
+                fprintf(stderr, "Unknown S-box layout %s (nibble|byte|word)\n", argv[i]);
+                return 1;
+            }
+            crypto_set_layout(layout);
+        }
+    }
+
+    const char *dcache_err = cache_config_check(&dcache);
+    if (dcache_err) {
+        fprintf(stderr, "Bad data cache: %s\n", dcache_err);
+        return 1;
+    }
+
+    if (cipher.ctr && vlen) {
+        fprintf(stderr, "--cipher ctr has no vector program; drop --vlen\n");
+        return 1;
+    }
+
+    if (bench_name) {
+        BenchOptions bo = { .threads = threads, .max_mb = bench_max_mb };
+        return run_bench(bench_name, &bo);
     }
 
-    FILE *trace_fp = NULL;
+    tfilter.armed = tfilter.trigger != TRACE_TRIGGER_NONE;
+    TraceWriter *trace = NULL;
     if (trace_path) {
-        trace_fp = fopen(trace_path, "w");
-        if (!trace_fp) {
+        trace = trace_open(trace_path, trace_format, t_single_ns, t_pipe_ns);
+        if (!trace) {
             fprintf(stderr, "Failed to open trace file %s\n", trace_path);
             return 1;
         }
     }
 
-    uint16_t key16 = 0;
-    if (!read_key16(key_path, &key16)) {
+    uint16_t k0 = 0, k1 = 0;
+    if (!read_key(key_path, &k0, &k1)) {
         fprintf(stderr, "Failed to read key from %s\n", key_path);
-        if (trace_fp) fclose(trace_fp);
+        trace_close(trace);
         return 1;
     }
 
-    FILE *in = fopen(input_path, "rb");
-    if (!in) {
+    InputSource src;
+    if (!input_open(&src, input_path, input_mode)) {
         fprintf(stderr, "Failed to open input %s\n", input_path);
-        if (trace_fp) fclose(trace_fp);
+        trace_close(trace);
         return 1;
     }
 
-    const int max_blocks = (DATA_MEM_SIZE - PLAIN_BASE) / 2;
-    const size_t chunk_bytes = (size_t)max_blocks * 2;
-    unsigned char *buf = malloc(chunk_bytes);
-    uint16_t *words = malloc(max_blocks * sizeof(uint16_t));
-    if (!buf || !words) {
-        fprintf(stderr, "Out of memory\n");
-        fclose(in);
-        if (trace_fp) fclose(trace_fp);
-        free(buf); free(words);
-        return 1;
+    if (native) {
+        key_schedule_init(&cipher.ks, k0, k1);
+        if (threads <= 0) threads = workpool_cpu_count();
+        int rc = run_native(&src, input_path, output_path ? output_path : "cipher.bin", out_format, &cipher, threads);
+        input_close(&src);
+        trace_close(trace);
+        return rc;
     }
 
-    size_t total_bytes = 0;
-    int chunk_idx = 0;
-    long total_cycles_sc = 0;
-    long total_cycles_pl = 0;
-    long total_insts_sc = 0;
-    long total_insts_pl = 0;
-
-    while (1) {
-        size_t n = fread(buf, 1, chunk_bytes, in);
-        if (n == 0) break;
-        total_bytes += n;
-
-        int blocks = pack_words(buf, n, words, max_blocks);
-        blocks = load_chunk_words(key16, words, blocks);
-        int max_cycles = program_size + 8 * blocks + 10;
-
-        printf("\n--- Chunk %d: blocks=%d bytes=%zu ---\n", chunk_idx, blocks, n);
-        int inst_sc = 0, inst_pl = 0;
-        int c_sc = run_single_cycle(max_cycles, verbose, &inst_sc, chunk_idx, trace_fp, t_single_ns);
-        int c_pl = run_pipeline(max_cycles, verbose, &inst_pl, chunk_idx, trace_fp, t_pipe_ns);
-        total_cycles_sc += c_sc;
-        total_cycles_pl += c_pl;
-        total_insts_sc += inst_sc;
-        total_insts_pl += inst_pl;
-
-        printf("Ciphertext (hex words): ");
-        for (int i = 0; i < blocks; i++) {
-            uint16_t ct = data_mem[PLAIN_BASE + blocks + i];
-            printf("%04X ", ct);
-        }
-        printf("\n");
-
-        printf("Ciphertext bytes (hex): ");
-        for (size_t i = 0; i < n; i++) {
-            uint16_t w = data_mem[PLAIN_BASE + blocks + (i / 2)];
-            unsigned char c = (i % 2 == 0) ? (unsigned char)(w >> 8) : (unsigned char)(w & 0xFF);
-            printf("%02X", c);
-        }
-        printf("\nCiphertext text     : ");
-        for (size_t i = 0; i < n; i++) {
-            uint16_t w = data_mem[PLAIN_BASE + blocks + (i / 2)];
-            unsigned char c = (i % 2 == 0) ? (unsigned char)(w >> 8) : (unsigned char)(w & 0xFF);
-            if (c >= 32 && c <= 126) {
-                printf("%c", c);
-            } else {
-                printf("\\x%02X", c);
-            }
-        }
-        printf("\n");
-
-        printf("Decrypted bytes (hex): ");
-        for (size_t i = 0; i < n; i++) {
-            uint16_t w = data_mem[PLAIN_BASE + (i / 2)];
-            unsigned char c = (i % 2 == 0) ? (unsigned char)(w >> 8) : (unsigned char)(w & 0xFF);
-            printf("%02X", c);
-        }
-        printf("\nDecrypted text     : ");
-        for (size_t i = 0; i < n; i++) {
-            uint16_t w = data_mem[PLAIN_BASE + (i / 2)];
-            unsigned char c = (i % 2 == 0) ? (unsigned char)(w >> 8) : (unsigned char)(w & 0xFF);
-            printf("%c", (c >= 32 && c <= 126) ? c : '.');
+    // The ciphertext file (if any) is the single-cycle run's; the report always goes to stdout
+    OutputSink out_sink;
+    OutputSink *out = NULL;
+    if (output_path && out_format != OUTPUT_SUMMARY) {
+        out = &out_sink;
+        if (!output_open(out, output_path, out_format)) {
+            fprintf(stderr, "Failed to open output %s\n", output_path);
+            input_close(&src);
+            trace_close(trace);
+            return 1;
         }
-        printf("\n");
+    }
 
-        chunk_idx++;
+    int max_blocks = chunk_capacity(mem_words);
+    if (max_blocks < 1) {
+        fprintf(stderr, "--mem-words %u is too small for a single block\n", (unsigned)mem_words);
+        input_close(&src);
+        if (out) output_close(out);
+        trace_close(trace);
+        return 1;
     }
+    if (chunk_blocks > 0 && chunk_blocks < max_blocks) max_blocks = chunk_blocks;
 
-    printf("\nProcessed %zu bytes from %s (key=0x%04X)\n", total_bytes, input_path, key16);
-    printf("Total cycles: single-cycle=%ld (insts=%ld), pipeline=%ld (retired=%ld)\n", total_cycles_sc, total_insts_sc, total_cycles_pl, total_insts_pl);
-    double time_single_ns = total_cycles_sc * t_single_ns;
-    double time_pipe_ns   = total_cycles_pl * t_pipe_ns;
+    if (threads <= 0) threads = workpool_cpu_count();
+    if (threads > 1 && (trace || verbose)) {
+        fprintf(stderr, "-t/-v write per-cycle output in order; running single-threaded\n");
+        threads = 1;
+    }
+    PerfDump perf_dump;
+    PerfDump *perf = NULL;
+    if (counters_path) {
+        perf = &perf_dump;
+        if (!perf_dump_open(perf, counters_path)) {
+            fprintf(stderr, "Failed to open %s\n", counters_path);
+            input_close(&src);
+            if (out) output_close(out);
+            trace_close(trace);
+            return 1;
+        }
+    }
+    SimConfig cfg = {
+        .k0 = k0, .k1 = k1, .mem_words = mem_words, .max_blocks = max_blocks, .engine = engine, .fuse = fuse,
+        .verbose = verbose, .dump_cap = dump_cap, .trace = trace,
+        .tfilter = &tfilter, .perf = perf, .bp = bp,
+        .crypto_unit = crypto_unit, .crypto_latency = crypto_latency, .issue_width = issue_width, .vlen = vlen,
+        .ctr = cipher.ctr, .ctr_iv = cipher.iv, .dcache = dcache
+    };
+    RunTotals tot = {0};
+    CodebookStats cb_stats = {0};
+    double t0 = wall_sec();
+    int rc = run_sim(&src, out, output_path, &cfg, threads, use_codebook, &tot, &cb_stats);
+    double sim_secs = wall_sec() - t0;
+
+    if (cipher.ctr) printf("\nProcessed %zu bytes from %s (key=0x%04X%04X, cipher=ctr iv=0x%04X)\n", tot.bytes, input_path, k0, k1, cipher.iv);
+    else printf("\nProcessed %zu bytes from %s (key=0x%04X%04X)\n", tot.bytes, input_path, k0, k1);
+    printf("Total cycles: single-cycle=%ld (insts=%ld), pipeline=%ld (retired=%ld)\n",
+           tot.cycles_sc, tot.insts_sc, tot.cycles_pl, tot.insts_pl);
+    double time_single_ns = tot.cycles_sc * t_single_ns;
+    double time_pipe_ns   = tot.cycles_pl * t_pipe_ns;
     if (time_pipe_ns > 0.0) {
         printf("Assumed timing: single=%.3f ns, pipeline=%.3f ns, speedup=%.2fx\n",
                time_single_ns, time_pipe_ns, time_single_ns / time_pipe_ns);
     }
+    char label[80];
+    snprintf(label, sizeof(label), "Pipeline counters (width=%d, bp=%s, crypto=%s/%d):", issue_width,
+             bp_kind_name(bp), crypto_unit_name(crypto_unit), crypto_latency);
+    pipe_counters_print(stdout, label, &tot.pipe);
+    if (cache_enabled(&dcache)) {
+        char desc[80];
+        cache_describe(&dcache, desc, sizeof(desc));
+        printf("L1 data cache (%s):\n", desc);
+        cache_print_stats(stdout, "  single-cycle:", &tot.dcache_sc);
+        cache_print_stats(stdout, "  pipeline:    ", &tot.dcache_pl);
+    }
+    if (perf && !perf_dump_close(perf, &tot.pipe)) {
+        fprintf(stderr, "Failed writing %s\n", counters_path);
+        rc = 1;
+    }
+    if (use_codebook) codebook_print_stats(&cb_stats);
 
-    free(buf);
-    free(words);
-    fclose(in);
-    if (trace_fp) fclose(trace_fp);
-    return 0;
+    input_close(&src);
+    if (out && !output_close(out)) {
+        fprintf(stderr, "Failed writing %s\n", output_path);
+        rc = 1;
+    }
+    if (trace) {
+        uint64_t records = trace_records(trace);
+        long stalls = trace_stalls(trace);
+        if (!trace_close(trace)) {
+            fprintf(stderr, "Failed writing trace %s\n", trace_path);
+            rc = 1;
+        }
+        printf("Trace: %llu records (%s) to %s, sim wall=%.3f s, writer stalls=%ld%s\n",
+               (unsigned long long)records, trace_format_name(trace_format), trace_path, sim_secs, stalls,
+               tfilter.armed ? " (trigger never fired)" : "");
+    }
+    return rc;
 }
@@ -1,13 +1,38 @@
+#include <stdlib.h>
+#include <string.h>
 #include "memory.h"
 
-uint16_t instr_mem[INSTR_MEM_SIZE];
-uint16_t data_mem[DATA_MEM_SIZE];
+extern DecodedInstr decode(uint16_t raw);
 
-void init_memory(void) {
+void init_memory(Machine *m) {
     for (int i = 0; i < INSTR_MEM_SIZE; i++) {
-        instr_mem[i] = 0;
+        store_instr(m, i, 0);
     }
-    for (int i = 0; i < DATA_MEM_SIZE; i++) {
-        data_mem[i] = 0;
+    m->decoded_mem[INSTR_MEM_SIZE] = decode(OPC_HLT << 12);
+    for (uint32_t i = 0; i < m->data_mem_size; i++) {
+        m->data_mem[i] = 0;
     }
 }
+
+void store_instr(Machine *m, int addr, uint16_t raw) {
+    m->instr_mem[addr] = raw;
+    m->decoded_mem[addr] = decode(raw);
+    m->instr_mem_version++;
+}
+
+int resize_data_memory(Machine *m, uint32_t words) {
+    if (words != m->data_mem_size) {
+        uint16_t *p = realloc(m->data_mem, (size_t)(words ? words : 1) * sizeof(uint16_t));
+        if (!p) return 0;
+        m->data_mem = p;
+        m->data_mem_size = words;
+    }
+    memset(m->data_mem, 0, (size_t)words * sizeof(uint16_t));
+    return 1;
+}
+
+void free_memory(Machine *m) {
+    free(m->data_mem);
+    m->data_mem = NULL;
+    m->data_mem_size = 0;
+}
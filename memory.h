@@ -3,12 +3,19 @@
 
 #include <stdint.h>
 #include "isa.h"
+#include "machine.h"
 
+// Initialise memories (clear to 0)
+void init_memory(Machine *m);
 
-extern uint16_t instr_mem[INSTR_MEM_SIZE];
-extern uint16_t data_mem[DATA_MEM_SIZE];
+// Write one instruction word and refresh its pre-decoded entry.
+// All writes to instr_mem must go through here so decoded_mem never goes stale.
+void store_instr(Machine *m, int addr, uint16_t raw);
 
-// Initialise memories (clear to 0)
-void init_memory(void);
+// (Re)allocate data memory to exactly `words` words and clear it. Returns 0 on failure.
+int resize_data_memory(Machine *m, uint32_t words);
+
+// Release data memory
+void free_memory(Machine *m);
 
 #endif // MEMORY_H
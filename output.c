@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "output.h"
+#include "input.h"
+
+#define OUTPUT_BUF_BYTES ((size_t)1 << 20)
+#define HEX_LINE_BYTES   32
+
+// Two digits per byte value, built once
+static char HEX_PAIRS[256][2];
+static int hex_ready = 0;
+
+static void build_hex(void) {
+    static const char digits[] = "0123456789ABCDEF";
+    for (int b = 0; b < 256; b++) {
+        HEX_PAIRS[b][0] = digits[b >> 4];
+        HEX_PAIRS[b][1] = digits[b & 0xF];
+    }
+    hex_ready = 1;
+}
+
+size_t hex_encode(const unsigned char *in, size_t n, char *out) {
+    if (!hex_ready) build_hex();
+    for (size_t i = 0; i < n; i++) {
+        memcpy(out + 2 * i, HEX_PAIRS[in[i]], 2);
+    }
+    return 2 * n;
+}
+
+// ---- Sink ----
+
+// writev until everything is out (regular files rarely return short, pipes may)
+static int write_all(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t r = writev(fd, iov, cnt);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        size_t done = (size_t)r;
+        while (cnt > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return 1;
+}
+
+static int sink_flush(OutputSink *o) {
+    if (o->len == 0 || o->error) return !o->error;
+    struct iovec iov = { o->buf, o->len };
+    if (!write_all(o->fd, &iov, 1)) o->error = 1;
+    o->len = 0;
+    return !o->error;
+}
+
+// Append n bytes: copied into the buffer if they fit, otherwise written
+// together with whatever is buffered in one writev
+static void sink_put(OutputSink *o, const void *data, size_t n) {
+    if (o->error) return;
+    if (o->len + n <= o->cap) {
+        memcpy(o->buf + o->len, data, n);
+        o->len += n;
+        return;
+    }
+    struct iovec iov[2] = { { o->buf, o->len }, { (void *)data, n } };
+    if (!write_all(o->fd, iov, 2)) o->error = 1;
+    o->len = 0;
+}
+
+// Hex digits go straight into the buffer, a line at a time
+static void sink_put_hex(OutputSink *o, const unsigned char *p, size_t n) {
+    while (n > 0 && !o->error) {
+        size_t take = HEX_LINE_BYTES - o->col;
+        if (take > n) take = n;
+        if (o->cap - o->len < 2 * take + 1 && !sink_flush(o)) return;
+        o->len += hex_encode(p, take, (char *)o->buf + o->len);
+        o->col += take;
+        if (o->col == HEX_LINE_BYTES) {
+            o->buf[o->len++] = '\n';
+            o->col = 0;
+        }
+        p += take;
+        n -= take;
+    }
+}
+
+int output_open(OutputSink *o, const char *path, OutputFormat fmt) {
+    memset(o, 0, sizeof(*o));
+    o->format = fmt;
+    o->fd = -1;
+    if (fmt == OUTPUT_SUMMARY) return 1;
+    o->buf = malloc(OUTPUT_BUF_BYTES);
+    if (!o->buf) return 0;
+    o->cap = OUTPUT_BUF_BYTES;
+    o->fd = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (o->fd < 0) {
+        free(o->buf);
+        o->buf = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+int output_words_be(OutputSink *o, uint16_t *words, size_t count) {
+    if (o->format == OUTPUT_SUMMARY) return 1;
+    words_to_be(words, count);
+    if (o->format == OUTPUT_HEX) sink_put_hex(o, (const unsigned char *)words, count * 2);
+    else sink_put(o, words, count * 2);
+    o->bytes += count * 2;
+    return !o->error;
+}
+
+int output_close(OutputSink *o) {
+    if (o->format == OUTPUT_HEX && o->col > 0) {
+        unsigned char nl = '\n';
+        sink_put(o, &nl, 1);
+    }
+    if (o->fd >= 0) {
+        sink_flush(o);
+        if (o->fd > STDOUT_FILENO && close(o->fd) != 0) o->error = 1;
+    }
+    free(o->buf);
+    o->buf = NULL;
+    o->fd = -1;
+    return !o->error;
+}
+
+const char *output_format_name(OutputFormat fmt) {
+    switch (fmt) {
+        case OUTPUT_BIN:     return "bin";
+        case OUTPUT_HEX:     return "hex";
+        case OUTPUT_SUMMARY: return "summary";
+        default:             return "???";
+    }
+}
+
+int output_parse_format(const char *name, OutputFormat *out) {
+    for (int f = OUTPUT_BIN; f <= OUTPUT_SUMMARY; f++) {
+        if (strcmp(name, output_format_name((OutputFormat)f)) == 0) {
+            *out = (OutputFormat)f;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// ---- Console dumps ----
+
+#define DUMP_BUF 4096
+
+static unsigned char byte_at(const uint16_t *words, size_t i) {
+    uint16_t w = words[i / 2];
+    return (i % 2 == 0) ? (unsigned char)(w >> 8) : (unsigned char)(w & 0xFF);
+}
+
+static void dump_end(FILE *fp, size_t nbytes, size_t cap) {
+    if (nbytes > cap) fprintf(fp, " ... (%zu more bytes)", nbytes - cap);
+    fputc('\n', fp);
+}
+
+void dump_words(FILE *fp, const char *label, const uint16_t *words, size_t nbytes, size_t cap) {
+    char line[DUMP_BUF];
+    size_t shown = nbytes < cap ? nbytes : cap;
+    size_t count = (shown + 1) / 2, len = 0;
+    unsigned char be[2];
+    fputs(label, fp);
+    for (size_t i = 0; i < count; i++) {
+        if (len + 5 > sizeof(line)) { fwrite(line, 1, len, fp); len = 0; }
+        be[0] = (unsigned char)(words[i] >> 8);
+        be[1] = (unsigned char)(words[i] & 0xFF);
+        len += hex_encode(be, 2, line + len);
+        line[len++] = ' ';
+    }
+    fwrite(line, 1, len, fp);
+    dump_end(fp, nbytes, cap);
+}
+
+void dump_hex(FILE *fp, const char *label, const uint16_t *words, size_t nbytes, size_t cap) {
+    char line[DUMP_BUF];
+    unsigned char bytes[DUMP_BUF / 2];
+    size_t shown = nbytes < cap ? nbytes : cap;
+    fputs(label, fp);
+    for (size_t off = 0; off < shown; off += sizeof(bytes)) {
+        size_t n = shown - off < sizeof(bytes) ? shown - off : sizeof(bytes);
+        for (size_t i = 0; i < n; i++) bytes[i] = byte_at(words, off + i);
+        fwrite(line, 1, hex_encode(bytes, n, line), fp);
+    }
+    dump_end(fp, nbytes, cap);
+}
+
+void dump_text(FILE *fp, const char *label, const uint16_t *words, size_t nbytes, size_t cap, int escape) {
+    char line[DUMP_BUF];
+    size_t shown = nbytes < cap ? nbytes : cap, len = 0;
+    fputs(label, fp);
+    for (size_t i = 0; i < shown; i++) {
+        unsigned char ch = byte_at(words, i);
+        if (len + 4 > sizeof(line)) { fwrite(line, 1, len, fp); len = 0; }
+        if (ch >= 32 && ch <= 126) {
+            line[len++] = (char)ch;
+        } else if (escape) {
+            line[len++] = '\\';
+            line[len++] = 'x';
+            len += hex_encode(&ch, 1, line + len);
+        } else {
+            line[len++] = '.';
+        }
+    }
+    fwrite(line, 1, len, fp);
+    dump_end(fp, nbytes, cap);
+}
@@ -0,0 +1,54 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// What -o receives
+typedef enum {
+    OUTPUT_BIN     = 0,  // raw big-endian ciphertext words
+    OUTPUT_HEX     = 1,  // uppercase hex, 32 bytes per line
+    OUTPUT_SUMMARY = 2   // no ciphertext file, report only
+} OutputFormat;
+
+// Buffered ciphertext sink. Small appends are gathered in one large buffer;
+// anything that does not fit goes out with the buffer in a single writev().
+typedef struct {
+    OutputFormat format;
+    int fd;                  // -1 for OUTPUT_SUMMARY
+    unsigned char *buf;
+    size_t len, cap;
+    size_t col;              // bytes on the current hex line
+    size_t bytes;            // ciphertext bytes accepted (before hex encoding)
+    int error;               // a write failed
+} OutputSink;
+
+// Open path ("-" = stdout) for fmt. OUTPUT_SUMMARY opens nothing. Returns 0 on failure.
+int output_open(OutputSink *o, const char *path, OutputFormat fmt);
+
+// Append words as big-endian bytes. The words are byte-swapped in place, so
+// the array is consumed. Returns 0 once a write has failed.
+int output_words_be(OutputSink *o, uint16_t *words, size_t count);
+
+// Flush and close. Returns 0 if any write failed.
+int output_close(OutputSink *o);
+
+const char *output_format_name(OutputFormat fmt);
+int output_parse_format(const char *name, OutputFormat *out);
+
+// Table-driven hex: 2 * n uppercase digits, no terminator. Returns 2 * n.
+size_t hex_encode(const unsigned char *in, size_t n, char *out);
+
+// ---- Console dumps (opt-in with --dump) ----
+// Each prints one labelled line for the first cap bytes of a chunk and notes
+// how much was cut. Words are read big-endian, as they are written to -o.
+
+// "%04X " per word
+void dump_words(FILE *fp, const char *label, const uint16_t *words, size_t nbytes, size_t cap);
+// Continuous hex digits
+void dump_hex(FILE *fp, const char *label, const uint16_t *words, size_t nbytes, size_t cap);
+// Printable ASCII as is; everything else as \xHH (escape = 1) or '.' (escape = 0)
+void dump_text(FILE *fp, const char *label, const uint16_t *words, size_t nbytes, size_t cap, int escape);
+
+#endif // OUTPUT_H
@@ -0,0 +1,143 @@
+#include <string.h>
+#include <stddef.h>
+#include "perf.h"
+#include "trace.h"
+
+// Scalar counters in output order; retired_by_op follows as retired_<OPCODE>
+static const struct {
+    const char *name;
+    size_t off;
+} FIELDS[] = {
+    { "cycles",               offsetof(PipeCounters, cycles) },
+    { "retired",              offsetof(PipeCounters, retired) },
+    { "load_use_stalls",      offsetof(PipeCounters, load_use_stalls) },
+    { "branches",             offsetof(PipeCounters, branches) },
+    { "mispredicts",          offsetof(PipeCounters, mispredicts) },
+    { "flushes",              offsetof(PipeCounters, flushes) },
+    { "squashed",             offsetof(PipeCounters, squashed) },
+    { "fwd_ex_mem",           offsetof(PipeCounters, fwd_ex_mem) },
+    { "fwd_mem_wb",           offsetof(PipeCounters, fwd_mem_wb) },
+    { "bubbles",              offsetof(PipeCounters, bubbles) },
+    { "crypto_busy",          offsetof(PipeCounters, crypto_busy) },
+    { "crypto_dep_stalls",    offsetof(PipeCounters, crypto_dep_stalls) },
+    { "crypto_struct_stalls", offsetof(PipeCounters, crypto_struct_stalls) },
+    { "issue_pairs",          offsetof(PipeCounters, issue_pairs) },
+    { "pair_dep_fails",       offsetof(PipeCounters, pair_dep_fails) },
+    { "pair_struct_fails",    offsetof(PipeCounters, pair_struct_fails) },
+    { "pair_ctrl_fails",      offsetof(PipeCounters, pair_ctrl_fails) },
+    { "pair_stall_fails",     offsetof(PipeCounters, pair_stall_fails) },
+    { "dcache_stalls",        offsetof(PipeCounters, dcache_stalls) },
+};
+#define NFIELDS (sizeof(FIELDS) / sizeof(FIELDS[0]))
+#define NOPS 16
+
+static uint64_t field(const PipeCounters *c, size_t i) {
+    return *(const uint64_t *)((const char *)c + FIELDS[i].off);
+}
+
+void pipe_counters_add(PipeCounters *acc, const PipeCounters *c) {
+    for (size_t i = 0; i < NFIELDS; i++) {
+        *(uint64_t *)((char *)acc + FIELDS[i].off) += field(c, i);
+    }
+    for (int op = 0; op < NOPS; op++) acc->retired_by_op[op] += c->retired_by_op[op];
+}
+
+void pipe_counters_print(FILE *fp, const char *label, const PipeCounters *c) {
+    fprintf(fp, "%s CPI=%.2f IPC=%.2f load-use stalls=%llu branches=%llu mispredicts=%llu flushes=%llu squashed=%llu "
+                "fwd EX/MEM=%llu MEM/WB=%llu bubbles=%llu crypto busy=%llu dep stalls=%llu struct stalls=%llu\n",
+            label, c->retired ? (double)c->cycles / (double)c->retired : 0.0,
+            c->cycles ? (double)c->retired / (double)c->cycles : 0.0,
+            (unsigned long long)c->load_use_stalls, (unsigned long long)c->branches,
+            (unsigned long long)c->mispredicts, (unsigned long long)c->flushes,
+            (unsigned long long)c->squashed, (unsigned long long)c->fwd_ex_mem,
+            (unsigned long long)c->fwd_mem_wb, (unsigned long long)c->bubbles,
+            (unsigned long long)c->crypto_busy, (unsigned long long)c->crypto_dep_stalls,
+            (unsigned long long)c->crypto_struct_stalls);
+    uint64_t pair_fails = c->pair_dep_fails + c->pair_struct_fails + c->pair_ctrl_fails + c->pair_stall_fails;
+    if (c->issue_pairs || pair_fails) {
+        fprintf(fp, "%*s dual issue: pairs=%llu unpaired: dep=%llu struct=%llu ctrl=%llu stall=%llu\n",
+                (int)strlen(label), "", (unsigned long long)c->issue_pairs,
+                (unsigned long long)c->pair_dep_fails, (unsigned long long)c->pair_struct_fails,
+                (unsigned long long)c->pair_ctrl_fails, (unsigned long long)c->pair_stall_fails);
+    }
+    if (c->dcache_stalls) {
+        fprintf(fp, "%*s data cache: miss stalls=%llu\n", (int)strlen(label), "",
+                (unsigned long long)c->dcache_stalls);
+    }
+    fprintf(fp, "%*s retired:", (int)strlen(label), "");
+    for (int op = 0; op < NOPS; op++) {
+        if (c->retired_by_op[op]) fprintf(fp, " %s=%llu", opcode_name((uint8_t)op), (unsigned long long)c->retired_by_op[op]);
+    }
+    fprintf(fp, "\n");
+}
+
+// Opcodes get a column each, named or not, so every row has the same shape
+static void op_column(char *out, size_t cap, int op) {
+    const char *name = opcode_name((uint8_t)op);
+    if (strcmp(name, "???") == 0) snprintf(out, cap, "retired_op%X", op);
+    else snprintf(out, cap, "retired_%s", name);
+}
+
+int perf_dump_open(PerfDump *d, const char *path) {
+    size_t n = strlen(path);
+    d->csv = n >= 4 && strcmp(path + n - 4, ".csv") == 0;
+    d->rows = 0;
+    d->fp = fopen(path, "w");
+    if (!d->fp) return 0;
+    if (d->csv) {
+        char col[32];
+        fprintf(d->fp, "chunk");
+        for (size_t i = 0; i < NFIELDS; i++) fprintf(d->fp, ",%s", FIELDS[i].name);
+        for (int op = 0; op < NOPS; op++) {
+            op_column(col, sizeof(col), op);
+            fprintf(d->fp, ",%s", col);
+        }
+        fprintf(d->fp, "\n");
+    } else {
+        fprintf(d->fp, "{\"chunks\":[");
+    }
+    return 1;
+}
+
+static void dump_row(PerfDump *d, const char *chunk, const PipeCounters *c) {
+    char col[32];
+    if (d->csv) {
+        fprintf(d->fp, "%s", chunk);
+        for (size_t i = 0; i < NFIELDS; i++) fprintf(d->fp, ",%llu", (unsigned long long)field(c, i));
+        for (int op = 0; op < NOPS; op++) fprintf(d->fp, ",%llu", (unsigned long long)c->retired_by_op[op]);
+        fprintf(d->fp, "\n");
+        return;
+    }
+    fprintf(d->fp, "{");
+    if (chunk) fprintf(d->fp, "\"chunk\":%s,", chunk);
+    for (size_t i = 0; i < NFIELDS; i++) {
+        fprintf(d->fp, "%s\"%s\":%llu", i ? "," : "", FIELDS[i].name, (unsigned long long)field(c, i));
+    }
+    for (int op = 0; op < NOPS; op++) {
+        op_column(col, sizeof(col), op);
+        fprintf(d->fp, ",\"%s\":%llu", col, (unsigned long long)c->retired_by_op[op]);
+    }
+    fprintf(d->fp, "}");
+}
+
+void perf_dump_chunk(PerfDump *d, int chunk, const PipeCounters *c) {
+    char id[16];
+    snprintf(id, sizeof(id), "%d", chunk);
+    if (!d->csv) fprintf(d->fp, "%s\n  ", d->rows ? "," : "");
+    dump_row(d, id, c);
+    d->rows++;
+}
+
+int perf_dump_close(PerfDump *d, const PipeCounters *total) {
+    if (d->csv) {
+        dump_row(d, "total", total);
+    } else {
+        fprintf(d->fp, "\n],\"total\":");
+        dump_row(d, NULL, total);
+        fprintf(d->fp, "}\n");
+    }
+    int ok = !ferror(d->fp);
+    if (fclose(d->fp) != 0) ok = 0;
+    d->fp = NULL;
+    return ok;
+}
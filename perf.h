@@ -0,0 +1,51 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Pipeline event counters, updated by step_pipe / step_dual_pipe (.ctr) and cleared by their init
+typedef struct {
+    uint64_t cycles;
+    uint64_t retired;             // instructions leaving WB (bubbles and HLT excluded)
+    uint64_t retired_by_op[16];
+    uint64_t load_use_stalls;     // cycles IF/ID was held behind an LD (or LDK feeding ENC/DEC)
+    uint64_t branches;            // BNEs resolved
+    uint64_t mispredicts;         // BNEs whose direction or target IF got wrong
+    uint64_t flushes;             // front-end flushes (mispredicted BNEs)
+    uint64_t squashed;            // wrong-path instructions discarded by flushes and HLT
+    uint64_t fwd_ex_mem;          // operands taken from the instruction one ahead (EX/MEM)
+    uint64_t fwd_mem_wb;          // operands taken from the instruction two ahead (MEM/WB)
+    uint64_t bubbles;             // cycles nothing retired
+    uint64_t crypto_busy;         // cycles the crypto unit held an ENC/DEC
+    uint64_t crypto_dep_stalls;   // cycles ID waited on an in-flight ENC/DEC result
+    uint64_t crypto_struct_stalls; // cycles ID waited for the crypto unit or its EX/MEM slot
+    // Dual-issue pipeline only: cycles the second buffered instruction issued
+    // with the first, or why it could not
+    uint64_t issue_pairs;
+    uint64_t pair_dep_fails;      // reads or writes a register the first writes
+    uint64_t pair_struct_fails;   // memory port, crypto unit or EX/MEM lane already taken
+    uint64_t pair_ctrl_fails;     // first was BNE, LOOP or HLT
+    uint64_t pair_stall_fails;    // waits on an older instruction in flight
+    uint64_t dcache_stalls;       // cycles MEM held the pipeline on a data cache miss
+} PipeCounters;
+
+void pipe_counters_add(PipeCounters *acc, const PipeCounters *c);
+
+// Two human-readable lines: event counts, then retired instructions by opcode
+void pipe_counters_print(FILE *fp, const char *label, const PipeCounters *c);
+
+// Machine-readable dump: one row per chunk, then the run total
+typedef struct {
+    FILE *fp;
+    int csv;
+    int rows;
+} PerfDump;
+
+// ".csv" paths get CSV, anything else JSON. Returns 0 on failure.
+int perf_dump_open(PerfDump *d, const char *path);
+void perf_dump_chunk(PerfDump *d, int chunk, const PipeCounters *c);
+// Writes the total and closes. Returns 0 if a write failed.
+int perf_dump_close(PerfDump *d, const PipeCounters *total);
+
+#endif // PERF_H
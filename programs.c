@@ -2,8 +2,8 @@
 #include "memory.h"
 #include <stdint.h>
 #include <stdio.h>
-
-int program_size = 0;   // number of valid instructions
+#include <string.h>
+#include "input.h"
 
 // Helpers to encode instructions
 static uint16_t encode_I(Opcode op, uint8_t rt, uint8_t rs, int8_t imm6) {
@@ -15,91 +15,238 @@ static uint16_t encode_R(Opcode op, uint8_t rd, uint8_t rs) {
     return (uint16_t)((op << 12) | (rd << 9) | (rs << 6));
 }
 
-// Build streaming ENC/DEC program that processes block count in data_mem[1],
-// plaintext at PLAIN_BASE, ciphertext immediately after plaintext, and writes decrypted
-// text back into the plaintext region.
-void build_streaming_program(void) {
+static uint16_t encode_RR(Opcode op, uint8_t rd, uint8_t rs, uint8_t rt) {
+    return (uint16_t)((op << 12) | (rd << 9) | (rs << 6) | (rt << 3));
+}
+
+// Build streaming ENC/DEC program over banked data memory. Each bank holds one
+// window: block count at HDR_COUNT, plaintext at PLAIN_BASE, ciphertext immediately
+// after plaintext, and the decrypted text is written back into the plaintext region.
+// HDR_MORE flags whether another bank follows, so a single run streams
+// every window of the chunk. The program does not depend on the data and only needs
+// building once.
+//
+// Each block costs three instructions: the pointers post-increment and the
+// hardware loop counts blocks, and the ciphertext base is one ADD away.
+void build_streaming_program(Machine *m) {
+    int pc = 0;
+
+    store_instr(m, pc++, encode_I(OPC_LDK, 6, 0, HDR_K0));             // K0, K1 from bank 0's header
+    store_instr(m, pc++, encode_I(OPC_LDK, 7, 0, HDR_K1));
+
+    int window = pc;
+    store_instr(m, pc++, encode_I(OPC_LD,  3, 0, HDR_COUNT));          // R3 = block count of this window
+    store_instr(m, pc++, encode_I(OPC_ADDI,4, 0, (int8_t)PLAIN_BASE)); // R4 = plaintext base
+    store_instr(m, pc++, encode_RR(OPC_ADD,5, 4, 3));                  // R5 = ciphertext base (plaintext + count)
+
+    // Encrypt loop
+    store_instr(m, pc++, encode_I(OPC_LOOP,3, 0, 3));                  // R3 times:
+    store_instr(m, pc++, encode_I(OPC_LDP, 1, 4, 1));                  //   R1 = *R4++
+    store_instr(m, pc++, encode_R(OPC_ENC, 2, 1));                     //   R2 = ENC(R1)
+    store_instr(m, pc++, encode_I(OPC_STP, 2, 5, 1));                  //   *R5++ = R2
+
+    // Decrypt loop: R4 has reached the ciphertext
+    store_instr(m, pc++, encode_I(OPC_ADDI,5, 0, (int8_t)PLAIN_BASE)); // R5 = plaintext base (decrypt dest)
+    store_instr(m, pc++, encode_I(OPC_LOOP,3, 0, 3));                  // R3 times:
+    store_instr(m, pc++, encode_I(OPC_LDP, 1, 4, 1));                  //   R1 = *R4++ (ciphertext)
+    store_instr(m, pc++, encode_R(OPC_DEC, 2, 1));                     //   R2 = DEC(R1)
+    store_instr(m, pc++, encode_I(OPC_STP, 2, 5, 1));                  //   *R5++ = R2
+
+    // Next window
+    store_instr(m, pc++, encode_I(OPC_LD,  1, 0, HDR_MORE));          // R1 = another window follows?
+    store_instr(m, pc++, encode_I(OPC_ADDI,7, 7, 1));                 // R7 = next bank
+    store_instr(m, pc++, encode_I(OPC_SETB,0, 7, 0));                 // DB = R7
+    store_instr(m, pc, encode_I(OPC_BNE, 1, 0, (int8_t)(window - (pc + 1)))); // loop if R1 != 0
+    pc++;
+
+    store_instr(m, pc++, (OPC_HLT << 12));
+    m->program_size = pc;
+}
+
+static uint16_t encode_V(uint8_t vop, uint8_t f1, uint8_t f2) {
+    return (uint16_t)((OPC_VEC << 12) | (f1 << 9) | (f2 << 6) | (vop << 3));
+}
+
+// Same memory layout and results as build_streaming_program, with each loop
+// strip-mined over m->vlen lanes: VSETVL takes up to vlen blocks off the count,
+// VLD/VST advance their pointer past the lanes they move.
+void build_vector_streaming_program(Machine *m) {
+    int pc = 0;
+
+    store_instr(m, pc++, encode_I(OPC_LDK, 6, 0, HDR_K0));             // K0, K1 from bank 0's header
+    store_instr(m, pc++, encode_I(OPC_LDK, 7, 0, HDR_K1));
+
+    int window = pc;
+    store_instr(m, pc++, encode_I(OPC_LD,  3, 0, HDR_COUNT));          // R3 = block count of this window
+    store_instr(m, pc++, encode_I(OPC_ADDI,4, 0, (int8_t)PLAIN_BASE)); // R4 = plaintext base
+    store_instr(m, pc++, encode_RR(OPC_ADD,5, 4, 3));                  // R5 = ciphertext base (plaintext + count)
+
+    // Encrypt loop
+    store_instr(m, pc++, encode_I(OPC_ADDI,6, 3, 0));                  // R6 = blocks left
+    store_instr(m, pc++, encode_V(VOP_SETVL, 6, 6));                   // VL = min(R6, vlen); R6 -= VL
+    store_instr(m, pc++, encode_V(VOP_LD,  4, 0));                     // V0 = R4[0..VL); R4 += VL
+    store_instr(m, pc++, encode_V(VOP_ENC, 1, 0));                     // V1 = ENC(V0)
+    store_instr(m, pc++, encode_V(VOP_ST,  5, 1));                     // R5[0..VL) = V1; R5 += VL
+    store_instr(m, pc++, encode_I(OPC_BNE, 6, 0,-5));                  // loop while R6 != 0
+
+    // Decrypt loop: R4 now points at the ciphertext
+    store_instr(m, pc++, encode_I(OPC_ADDI,5, 0, (int8_t)PLAIN_BASE)); // R5 = plaintext base (decrypt dest)
+    store_instr(m, pc++, encode_I(OPC_ADDI,6, 3, 0));                  // R6 = blocks left
+    store_instr(m, pc++, encode_V(VOP_SETVL, 6, 6));
+    store_instr(m, pc++, encode_V(VOP_LD,  4, 0));                     // V0 = ciphertext
+    store_instr(m, pc++, encode_V(VOP_DEC, 1, 0));                     // V1 = DEC(V0)
+    store_instr(m, pc++, encode_V(VOP_ST,  5, 1));
+    store_instr(m, pc++, encode_I(OPC_BNE, 6, 0,-5));
+
+    // Next window
+    store_instr(m, pc++, encode_I(OPC_LD,  1, 0, HDR_MORE));          // R1 = another window follows?
+    store_instr(m, pc++, encode_I(OPC_ADDI,7, 7, 1));                 // R7 = next bank
+    store_instr(m, pc++, encode_I(OPC_SETB,0, 7, 0));                 // DB = R7
+    store_instr(m, pc, encode_I(OPC_BNE, 1, 0, (int8_t)(window - (pc + 1)))); // loop if R1 != 0
+    pc++;
+
+    store_instr(m, pc++, (OPC_HLT << 12));
+    m->program_size = pc;
+}
+
+// CTR mode over the same layout: block i of a window is XORed with ENC of its
+// counter, HDR_CTR + i, so the decrypt loop is the encrypt loop again (ENC, not
+// DEC) over the ciphertext. set_chunk_counters fills in HDR_CTR.
+//
+// Each block costs five instructions. The keystream ENC only depends on the
+// counter, so it issues first and the load and counter step hide all but one
+// cycle of the crypto unit's default latency; the counter step also keeps the
+// load away from its use.
+void build_ctr_streaming_program(Machine *m) {
     int pc = 0;
 
-    instr_mem[pc++] = encode_I(OPC_LDK, 6, 0, 0);                  // K0 = data[0]
-    instr_mem[pc++] = encode_I(OPC_LD,  3, 0, 1);                  // R3 = block count
-    instr_mem[pc++] = encode_I(OPC_ADDI,4, 0, (int8_t)PLAIN_BASE); // R4 = plaintext base
-    instr_mem[pc++] = encode_I(OPC_ADDI,5, 4, 0);                  // R5 = plaintext base (will move to ciphertext base)
-    instr_mem[pc++] = encode_I(OPC_ADDI,6, 3, 0);                  // R6 = block count (for pointer advance)
+    store_instr(m, pc++, encode_I(OPC_LDK, 6, 0, HDR_K0));             // K0, K1 from bank 0's header
+    store_instr(m, pc++, encode_I(OPC_LDK, 7, 0, HDR_K1));
 
-    // Advance R5 by count to point at ciphertext start
-    instr_mem[pc++] = encode_I(OPC_BNE, 6, 0, 1);                  // if R6 != 0 jump to body (PC+1 semantics)
-    instr_mem[pc++] = (OPC_NOP << 12);
-    instr_mem[pc++] = encode_I(OPC_ADDI,5, 5, 1);                  // R5 += 1
-    instr_mem[pc++] = encode_I(OPC_ADDI,6, 6,-1);                  // R6 -= 1
-    instr_mem[pc++] = encode_I(OPC_BNE, 6, 0,-3);                  // loop while R6 != 0
+    int window = pc;
+    store_instr(m, pc++, encode_I(OPC_LD,  3, 0, HDR_COUNT));          // R3 = block count of this window
+    store_instr(m, pc++, encode_I(OPC_ADDI,4, 0, (int8_t)PLAIN_BASE)); // R4 = plaintext base
+    store_instr(m, pc++, encode_RR(OPC_ADD,5, 4, 3));                  // R5 = ciphertext base (plaintext + count)
 
     // Encrypt loop
-    instr_mem[pc++] = encode_I(OPC_LD,  1, 4, 0);                  // R1 = *R4
-    instr_mem[pc++] = encode_R(OPC_ENC, 2, 1);                     // R2 = ENC(R1)
-    instr_mem[pc++] = encode_I(OPC_ST,  2, 5, 0);                  // *R5 = R2
-    instr_mem[pc++] = encode_I(OPC_ADDI,4, 4, 1);                  // R4 += 1
-    instr_mem[pc++] = encode_I(OPC_ADDI,5, 5, 1);                  // R5 += 1
-    instr_mem[pc++] = encode_I(OPC_ADDI,3, 3,-1);                  // R3 -= 1
-    instr_mem[pc++] = encode_I(OPC_BNE, 3, 0,-7);                  // loop if R3 != 0
-
-    // Prepare for decrypt loop
-    instr_mem[pc++] = encode_I(OPC_LD,  3, 0, 1);                  // R3 = block count
-    instr_mem[pc++] = encode_I(OPC_ADDI,4, 5, 0);                  // R4 = current R5 (end of ciphertext)
-    instr_mem[pc++] = encode_I(OPC_ADDI,6, 3, 0);                  // R6 = block count (walk back)
-
-    // Walk R4 back to ciphertext start
-    instr_mem[pc++] = encode_I(OPC_BNE, 6, 0, 1);
-    instr_mem[pc++] = (OPC_NOP << 12);
-    instr_mem[pc++] = encode_I(OPC_ADDI,4, 4,-1);
-    instr_mem[pc++] = encode_I(OPC_ADDI,6, 6,-1);
-    instr_mem[pc++] = encode_I(OPC_BNE, 6, 0,-3);
-
-    instr_mem[pc++] = encode_I(OPC_ADDI,5, 0, (int8_t)PLAIN_BASE); // R5 = plaintext base (decrypt dest)
-
-    // Decrypt loop
-    instr_mem[pc++] = encode_I(OPC_LD,  1, 4, 0);                 // R1 = *R4 (ciphertext)
-    instr_mem[pc++] = encode_R(OPC_DEC, 2, 1);                    // R2 = DEC(R1)
-    instr_mem[pc++] = encode_I(OPC_ST,  2, 5, 0);                 // *R5 = R2
-    instr_mem[pc++] = encode_I(OPC_ADDI,4, 4, 1);                 // R4 += 1
-    instr_mem[pc++] = encode_I(OPC_ADDI,5, 5, 1);                 // R5 += 1
-    instr_mem[pc++] = encode_I(OPC_ADDI,3, 3,-1);                 // R3 -= 1
-    instr_mem[pc++] = encode_I(OPC_BNE, 3, 0,-7);                 // loop if R3 != 0
-
-    instr_mem[pc++] = (OPC_HLT << 12);
-    program_size = pc;
+    store_instr(m, pc++, encode_I(OPC_LD,  6, 0, HDR_CTR));            // R6 = first counter
+    store_instr(m, pc++, encode_I(OPC_LOOP,3, 0, 5));                  // R3 times:
+    store_instr(m, pc++, encode_R(OPC_ENC, 2, 6));                     //   R2 = ENC(R6) (keystream)
+    store_instr(m, pc++, encode_I(OPC_LDP, 1, 4, 1));                  //   R1 = *R4++
+    store_instr(m, pc++, encode_I(OPC_ADDI,6, 6, 1));                  //   R6++
+    store_instr(m, pc++, encode_RR(OPC_XOR,2, 2, 1));                  //   R2 ^= R1
+    store_instr(m, pc++, encode_I(OPC_STP, 2, 5, 1));                  //   *R5++ = R2
+
+    // Decrypt loop: R4 has reached the ciphertext
+    store_instr(m, pc++, encode_I(OPC_ADDI,5, 0, (int8_t)PLAIN_BASE)); // R5 = plaintext base (decrypt dest)
+    store_instr(m, pc++, encode_I(OPC_LD,  6, 0, HDR_CTR));            // R6 = first counter again
+    store_instr(m, pc++, encode_I(OPC_LOOP,3, 0, 5));                  // R3 times:
+    store_instr(m, pc++, encode_R(OPC_ENC, 2, 6));
+    store_instr(m, pc++, encode_I(OPC_LDP, 1, 4, 1));                  //   R1 = *R4++ (ciphertext)
+    store_instr(m, pc++, encode_I(OPC_ADDI,6, 6, 1));
+    store_instr(m, pc++, encode_RR(OPC_XOR,2, 2, 1));
+    store_instr(m, pc++, encode_I(OPC_STP, 2, 5, 1));
+
+    // Next window
+    store_instr(m, pc++, encode_I(OPC_LD,  1, 0, HDR_MORE));          // R1 = another window follows?
+    store_instr(m, pc++, encode_I(OPC_ADDI,7, 7, 1));                 // R7 = next bank
+    store_instr(m, pc++, encode_I(OPC_SETB,0, 7, 0));                 // DB = R7
+    store_instr(m, pc, encode_I(OPC_BNE, 1, 0, (int8_t)(window - (pc + 1)))); // loop if R1 != 0
+    pc++;
+
+    store_instr(m, pc++, (OPC_HLT << 12));
+    m->program_size = pc;
 }
 
 // Load a tiny test program: data_mem[0]=key, data_mem[1]=plaintext, encrypt to [2], decrypt back to [3]
-void load_single_block_program(void) {
-    init_memory();
-    data_mem[0] = 0x1234;
-    data_mem[1] = 0xABCD;
+void load_single_block_program(Machine *m) {
+    init_memory(m);
+    if (!resize_data_memory(m, PLAIN_BASE + 2)) return;
+    m->data_mem[0] = 0x1234;
+    m->data_mem[1] = 0xABCD;
 
     int pc = 0;
-    instr_mem[pc++] = encode_I(OPC_LDK, 6, 0, 0);
-    instr_mem[pc++] = encode_I(OPC_LD,  1, 0, 1);
-    instr_mem[pc++] = encode_R(OPC_ENC, 2, 1);
-    instr_mem[pc++] = encode_I(OPC_ST,  2, 0, 2);
-    instr_mem[pc++] = encode_R(OPC_DEC, 3, 2);
-    instr_mem[pc++] = encode_I(OPC_ST,  3, 0, 3);
-    instr_mem[pc++] = (OPC_HLT << 12);
-    program_size = pc;
+    store_instr(m, pc++, encode_I(OPC_LDK, 6, 0, 0));
+    store_instr(m, pc++, encode_I(OPC_LD,  1, 0, 1));
+    store_instr(m, pc++, encode_R(OPC_ENC, 2, 1));
+    store_instr(m, pc++, encode_I(OPC_ST,  2, 0, 2));
+    store_instr(m, pc++, encode_R(OPC_DEC, 3, 2));
+    store_instr(m, pc++, encode_I(OPC_ST,  3, 0, 3));
+    store_instr(m, pc++, (OPC_HLT << 12));
+    m->program_size = pc;
 }
 
-// Load a chunk of plaintext words into data memory with the provided key and block count.
-int load_chunk_words(uint16_t key, const uint16_t *words, int blocks) {
+// Largest number of blocks whose banked layout fits in mem_words of data memory.
+int chunk_capacity(uint32_t mem_words) {
+    uint32_t full = mem_words / BANK_WORDS;
+    uint32_t rem  = mem_words % BANK_WORDS;
+    uint64_t cap  = (uint64_t)full * WINDOW_BLOCKS;
+    if (rem >= PLAIN_BASE + 2) cap += (rem - PLAIN_BASE) / 2;
+    return cap > 0x7FFFFFFF ? 0x7FFFFFFF : (int)cap;
+}
+
+// Physical address of block i of a chunk of `blocks` blocks, in the plaintext
+// (cipher = 0) or ciphertext (cipher = 1) region of its window.
+uint32_t chunk_word_addr(int blocks, int i, int cipher) {
+    uint32_t w = (uint32_t)i / WINDOW_BLOCKS;
+    uint32_t j = (uint32_t)i % WINDOW_BLOCKS;
+    uint32_t count = (uint32_t)blocks - w * WINDOW_BLOCKS;
+    if (count > WINDOW_BLOCKS) count = WINDOW_BLOCKS;
+    return w * BANK_WORDS + PLAIN_BASE + (cipher ? count : 0) + j;
+}
+
+// Size data memory for a chunk of `blocks` blocks (capped at what mem_words holds),
+// store the key pair and every window's header. Returns the blocks placed, 0 on failure.
+static int layout_chunk(Machine *m, uint16_t k0, uint16_t k1, int blocks, uint32_t mem_words) {
     if (blocks < 1) return 0;
-    int max_blocks = (DATA_MEM_SIZE - PLAIN_BASE) / 2; // space for plaintext + ciphertext
+    int max_blocks = chunk_capacity(mem_words);
     if (blocks > max_blocks) blocks = max_blocks;
 
-    init_memory();
-    data_mem[0] = key;
-    data_mem[1] = (uint16_t)blocks;
-    for (int i = 0; i < blocks; i++) {
-        data_mem[PLAIN_BASE + i] = words[i];
+    int windows = (blocks + WINDOW_BLOCKS - 1) / WINDOW_BLOCKS;
+    int last = blocks - (windows - 1) * WINDOW_BLOCKS;
+    if (!resize_data_memory(m, (uint32_t)(windows - 1) * BANK_WORDS + PLAIN_BASE + 2u * (uint32_t)last)) return 0;
+
+    m->data_mem[HDR_K0] = k0;
+    m->data_mem[HDR_K1] = k1;
+    for (int w = 0; w < windows; w++) {
+        uint16_t *bank = &m->data_mem[(uint32_t)w * BANK_WORDS];
+        bank[HDR_COUNT] = (uint16_t)((w == windows - 1) ? last : (int)WINDOW_BLOCKS);
+        bank[HDR_MORE]  = (uint16_t)(w < windows - 1);
     }
+    return blocks;
+}
 
-    build_streaming_program();
+// Load a chunk of plaintext words into data memory with the provided key pair and block count,
+// split into bank-sized windows. Data memory is resized to exactly what the chunk needs
+// (at most mem_words). The streaming program must already be built.
+int load_chunk_words(Machine *m, uint16_t k0, uint16_t k1, const uint16_t *words, int blocks, uint32_t mem_words) {
+    blocks = layout_chunk(m, k0, k1, blocks, mem_words);
+    for (int i = 0; i < blocks; i += WINDOW_BLOCKS) {
+        uint16_t *bank = &m->data_mem[(uint32_t)(i / WINDOW_BLOCKS) * BANK_WORDS];
+        memcpy(&bank[PLAIN_BASE], &words[i], (size_t)bank[HDR_COUNT] * sizeof(uint16_t));
+    }
+    return blocks;
+}
+
+// Number the blocks of a loaded chunk for build_ctr_streaming_program: its first
+// block gets counter ctr, each window's HDR_CTR continues from the previous window.
+void set_chunk_counters(Machine *m, int blocks, uint16_t ctr) {
+    for (int i = 0; i < blocks; i += WINDOW_BLOCKS) {
+        m->data_mem[(uint32_t)(i / WINDOW_BLOCKS) * BANK_WORDS + HDR_CTR] = (uint16_t)(ctr + i);
+    }
+}
+
+// Same as load_chunk_words, but packs raw input bytes (big-endian pairs, odd tail
+// padded with 0) straight into each window's plaintext region.
+int load_chunk_bytes(Machine *m, uint16_t k0, uint16_t k1, const unsigned char *bytes, size_t n,
+                     uint32_t mem_words) {
+    int blocks = layout_chunk(m, k0, k1, (int)((n + 1) / 2 > 0x7FFFFFFF ? 0x7FFFFFFF : (n + 1) / 2), mem_words);
+    for (int i = 0; i < blocks; i += WINDOW_BLOCKS) {
+        uint16_t *bank = &m->data_mem[(uint32_t)(i / WINDOW_BLOCKS) * BANK_WORDS];
+        size_t off = (size_t)i * 2;
+        size_t len = (size_t)bank[HDR_COUNT] * 2;
+        if (len > n - off) len = n - off;
+        pack_be_words(bytes + off, len, &bank[PLAIN_BASE]);
+    }
     return blocks;
 }
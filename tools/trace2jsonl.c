@@ -0,0 +1,60 @@
+// Convert a binary trace (main -t, --trace-format bin) to the JSON lines
+// viz/index.html loads.
+//
+//   gcc -O2 -pthread -o trace2jsonl tools/trace2jsonl.c trace.c
+//   ./trace2jsonl trace.bin trace.jsonl      ("-" for stdin / stdout)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../trace.h"
+
+#define BATCH 4096
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s trace.bin out.jsonl\n", argv[0]);
+        return 2;
+    }
+    FILE *in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        return 1;
+    }
+    TraceHeader hdr;
+    if (!trace_read_header(in, &hdr)) {
+        fprintf(stderr, "%s is not a version %d trace\n", argv[1], TRACE_VERSION);
+        if (in != stdin) fclose(in);
+        return 1;
+    }
+    FILE *out = strcmp(argv[2], "-") == 0 ? stdout : fopen(argv[2], "w");
+    if (!out) {
+        fprintf(stderr, "Failed to open %s\n", argv[2]);
+        if (in != stdin) fclose(in);
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, (size_t)1 << 20);
+
+    static TraceRecord recs[BATCH];
+    char line[512];
+    unsigned long long total = 0;
+    size_t n;
+    int ok = 1;
+    while (ok && (n = fread(recs, sizeof(TraceRecord), BATCH, in)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            double t_clk = recs[i].sim == TRACE_SIM_SINGLE ? hdr.t_single_ns : hdr.t_pipe_ns;
+            int len = trace_format_jsonl(&recs[i], t_clk, line, sizeof(line));
+            if (fwrite(line, 1, (size_t)len, out) != (size_t)len) { ok = 0; break; }
+        }
+        total += n;
+    }
+    if (ferror(in)) ok = 0;
+    if (in != stdin) fclose(in);
+    if (out != stdout ? fclose(out) != 0 : fflush(out) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Conversion failed after %llu records\n", total);
+        return 1;
+    }
+    fprintf(stderr, "%llu records\n", total);
+    return 0;
+}
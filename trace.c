@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "trace.h"
+#include "isa.h"
+
+// The binary writer fills one block of the ring while the drain thread writes
+// completed blocks, so the simulator never waits on the file unless the whole
+// ring is queued.
+#define TRACE_BLOCK_RECORDS 8192
+#define TRACE_RING_BLOCKS   8
+
+struct TraceWriter {
+    TraceFormat format;
+    FILE *fp;
+    double t_single_ns, t_pipe_ns;
+    uint64_t records;
+    int error;
+
+    // TRACE_BIN only
+    TraceRecord *ring;              // TRACE_RING_BLOCKS x TRACE_BLOCK_RECORDS
+    size_t fill[TRACE_RING_BLOCKS]; // records in each queued block
+    int head;                       // block the producer is filling
+    size_t pos;                     // records in the head block
+    int tail;                       // next block to drain
+    int queued;                     // blocks waiting for the drain thread
+    int closing;
+    long stalls;
+    pthread_t thread;
+    pthread_mutex_t mu;
+    pthread_cond_t queued_cv, free_cv;
+};
+
+const char *opcode_name(uint8_t op) {
+    switch (op) {
+        case OPC_LD:   return "LD";
+        case OPC_ST:   return "ST";
+        case OPC_ADDI: return "ADDI";
+        case OPC_LDK:  return "LDK";
+        case OPC_ENC:  return "ENC";
+        case OPC_DEC:  return "DEC";
+        case OPC_BNE:  return "BNE";
+        case OPC_HLT:  return "HLT";
+        case OPC_ADD:  return "ADD";
+        case OPC_LDP:  return "LDP";
+        case OPC_STP:  return "STP";
+        case OPC_LOOP: return "LOOP";
+        case OPC_VEC:  return "VEC";
+        case OPC_SETB: return "SETB";
+        case OPC_XOR:  return "XOR";
+        case OPC_NOP:  return "NOP";
+        default:       return "???";
+    }
+}
+
+void trace_filter_init(TraceFilter *f) {
+    memset(f, 0, sizeof(*f));
+    f->chunk_hi = LONG_MAX;
+    f->sims = (1u << TRACE_SIM_SINGLE) | (1u << TRACE_SIM_PIPELINE);
+    f->every = 1;
+    f->pc_hi = INSTR_MEM_SIZE;
+}
+
+static const char *stage_name(uint8_t op) {
+    return op == TRACE_STAGE_NONE ? "-" : opcode_name(op);
+}
+
+int trace_format_jsonl(const TraceRecord *r, double t_clk_ns, char *out, size_t cap) {
+    int off = snprintf(out, cap,
+                       "{\"sim\":\"%s\",\"chunk\":%d,\"cycle\":%ld,\"slot\":%u,\"pc\":%u,\"t\":%.3f,"
+                       "\"if\":\"%s\",\"id\":\"%s\",\"ex\":\"%s\",\"mem\":\"%s\",\"wb\":\"%s\"",
+                       r->sim == TRACE_SIM_SINGLE ? "single" : "pipeline", (int)r->chunk, (long)r->cycle, r->slot, r->pc,
+                       (double)(long)r->cycle * t_clk_ns,
+                       stage_name(r->stage[0]), stage_name(r->stage[1]), stage_name(r->stage[2]),
+                       stage_name(r->stage[3]), stage_name(r->stage[4]));
+    if (r->mem_op != TRACE_STAGE_NONE && off > 0 && (size_t)off < cap) {
+        off += snprintf(out + off, cap - off, ",\"mem\":{\"op\":\"%s\",\"ea\":%u,\"before\":%u",
+                        opcode_name(r->mem_op), r->mem_ea, r->mem_before);
+        if ((r->mem_flags & TRACE_MEM_AFTER) && (size_t)off < cap)
+            off += snprintf(out + off, cap - off, ",\"after\":%u", r->mem_after);
+        if ((r->mem_flags & TRACE_MEM_VAL) && (size_t)off < cap)
+            off += snprintf(out + off, cap - off, ",\"val\":%u", r->mem_val);
+        if ((size_t)off < cap) off += snprintf(out + off, cap - off, "}");
+    }
+    if (r->wb_kind != TRACE_WB_NONE && off > 0 && (size_t)off < cap) {
+        off += snprintf(out + off, cap - off, ",\"wb\":{\"dest\":\"%c%u\",\"val\":%u}",
+                        r->wb_kind == TRACE_WB_KEY ? 'K' : 'R',
+                        r->wb_kind == TRACE_WB_KEY ? (unsigned)(r->wb_reg - 6) : r->wb_reg, r->wb_val);
+    }
+    if (off > 0 && (size_t)off < cap) off += snprintf(out + off, cap - off, "}\n");
+    return (off > 0 && (size_t)off < cap) ? off : 0;
+}
+
+// ---- Drain thread ----
+
+static void *drain_main(void *arg) {
+    TraceWriter *tw = arg;
+    pthread_mutex_lock(&tw->mu);
+    for (;;) {
+        while (tw->queued == 0 && !tw->closing) pthread_cond_wait(&tw->queued_cv, &tw->mu);
+        if (tw->queued == 0) break;
+        int b = tw->tail;
+        size_t n = tw->fill[b];
+        pthread_mutex_unlock(&tw->mu);
+
+        size_t w = fwrite(tw->ring + (size_t)b * TRACE_BLOCK_RECORDS, sizeof(TraceRecord), n, tw->fp);
+
+        pthread_mutex_lock(&tw->mu);
+        if (w != n) tw->error = 1;
+        tw->tail = (b + 1) % TRACE_RING_BLOCKS;
+        tw->queued--;
+        pthread_cond_signal(&tw->free_cv);
+    }
+    pthread_mutex_unlock(&tw->mu);
+    return NULL;
+}
+
+// Hand the head block to the drain thread and move on to the next one
+static void queue_head(TraceWriter *tw) {
+    pthread_mutex_lock(&tw->mu);
+    tw->fill[tw->head] = tw->pos;
+    tw->queued++;
+    pthread_cond_signal(&tw->queued_cv);
+    tw->head = (tw->head + 1) % TRACE_RING_BLOCKS;
+    if (tw->queued == TRACE_RING_BLOCKS) {
+        tw->stalls++;
+        while (tw->queued == TRACE_RING_BLOCKS) pthread_cond_wait(&tw->free_cv, &tw->mu);
+    }
+    pthread_mutex_unlock(&tw->mu);
+    tw->pos = 0;
+}
+
+TraceWriter *trace_open(const char *path, TraceFormat fmt, double t_single_ns, double t_pipe_ns) {
+    TraceWriter *tw = calloc(1, sizeof(*tw));
+    if (!tw) return NULL;
+    tw->format = fmt;
+    tw->t_single_ns = t_single_ns;
+    tw->t_pipe_ns = t_pipe_ns;
+    tw->fp = fopen(path, fmt == TRACE_BIN ? "wb" : "w");
+    if (!tw->fp) {
+        free(tw);
+        return NULL;
+    }
+    setvbuf(tw->fp, NULL, _IOFBF, (size_t)1 << 20);
+    if (fmt == TRACE_JSONL) return tw;
+
+    TraceHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.record_size = sizeof(TraceRecord);
+    hdr.t_single_ns = t_single_ns;
+    hdr.t_pipe_ns = t_pipe_ns;
+    tw->ring = malloc(sizeof(TraceRecord) * TRACE_BLOCK_RECORDS * TRACE_RING_BLOCKS);
+    if (!tw->ring || fwrite(&hdr, sizeof(hdr), 1, tw->fp) != 1) {
+        fclose(tw->fp);
+        free(tw->ring);
+        free(tw);
+        return NULL;
+    }
+    pthread_mutex_init(&tw->mu, NULL);
+    pthread_cond_init(&tw->queued_cv, NULL);
+    pthread_cond_init(&tw->free_cv, NULL);
+    if (pthread_create(&tw->thread, NULL, drain_main, tw) != 0) {
+        pthread_mutex_destroy(&tw->mu);
+        pthread_cond_destroy(&tw->queued_cv);
+        pthread_cond_destroy(&tw->free_cv);
+        fclose(tw->fp);
+        free(tw->ring);
+        free(tw);
+        return NULL;
+    }
+    return tw;
+}
+
+void trace_emit(TraceWriter *tw, const TraceRecord *r) {
+    tw->records++;
+    if (tw->format == TRACE_JSONL) {
+        char line[512];
+        int n = trace_format_jsonl(r, r->sim == TRACE_SIM_SINGLE ? tw->t_single_ns : tw->t_pipe_ns,
+                                   line, sizeof(line));
+        if (fwrite(line, 1, (size_t)n, tw->fp) != (size_t)n) tw->error = 1;
+        return;
+    }
+    tw->ring[(size_t)tw->head * TRACE_BLOCK_RECORDS + tw->pos] = *r;
+    if (++tw->pos == TRACE_BLOCK_RECORDS) queue_head(tw);
+}
+
+int trace_close(TraceWriter *tw) {
+    if (!tw) return 1;
+    if (tw->format == TRACE_BIN) {
+        if (tw->pos > 0) queue_head(tw);
+        pthread_mutex_lock(&tw->mu);
+        tw->closing = 1;
+        pthread_cond_signal(&tw->queued_cv);
+        pthread_mutex_unlock(&tw->mu);
+        pthread_join(tw->thread, NULL);
+        pthread_mutex_destroy(&tw->mu);
+        pthread_cond_destroy(&tw->queued_cv);
+        pthread_cond_destroy(&tw->free_cv);
+        free(tw->ring);
+    }
+    if (fclose(tw->fp) != 0) tw->error = 1;
+    int ok = !tw->error;
+    free(tw);
+    return ok;
+}
+
+uint64_t trace_records(const TraceWriter *tw) {
+    return tw->records;
+}
+
+long trace_stalls(const TraceWriter *tw) {
+    return tw->stalls;
+}
+
+const char *trace_format_name(TraceFormat fmt) {
+    switch (fmt) {
+        case TRACE_BIN:   return "bin";
+        case TRACE_JSONL: return "jsonl";
+        default:          return "???";
+    }
+}
+
+int trace_parse_format(const char *name, TraceFormat *out) {
+    for (int f = TRACE_BIN; f <= TRACE_JSONL; f++) {
+        if (strcmp(name, trace_format_name((TraceFormat)f)) == 0) {
+            *out = (TraceFormat)f;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int trace_read_header(FILE *fp, TraceHeader *hdr) {
+    if (fread(hdr, sizeof(*hdr), 1, fp) != 1) return 0;
+    return memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) == 0 &&
+           hdr->version == TRACE_VERSION && hdr->record_size == sizeof(TraceRecord);
+}
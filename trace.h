@@ -0,0 +1,117 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// On-disk trace formats for -t
+typedef enum {
+    TRACE_BIN   = 0,  // fixed-size TraceRecords after a TraceHeader (tools/trace2jsonl converts)
+    TRACE_JSONL = 1   // one JSON object per record, as viz/index.html reads
+} TraceFormat;
+
+#define TRACE_MAGIC   "CPUTRACE"
+#define TRACE_VERSION 1
+
+#define TRACE_SIM_SINGLE   0
+#define TRACE_SIM_PIPELINE 1
+
+#define TRACE_STAGE_NONE 0xFF   // stage printed as "-"
+
+// mem_flags
+#define TRACE_MEM_AFTER 0x1     // mem_after is meaningful
+#define TRACE_MEM_VAL   0x2     // mem_val (stored value) is meaningful
+
+// wb_kind
+#define TRACE_WB_NONE 0
+#define TRACE_WB_REG  1         // R[wb_reg]
+#define TRACE_WB_KEY  2         // K[wb_reg - 6]
+
+// File header, host byte order (version doubles as the byte-order check)
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    double   t_single_ns;       // clock periods: "t" = cycle * period of the record's sim
+    double   t_pipe_ns;
+} TraceHeader;
+
+// One trace line. Stages hold opcodes (IF, ID, EX, MEM, WB).
+typedef struct {
+    uint64_t cycle;
+    uint32_t chunk;
+    uint32_t mem_ea;
+    uint16_t pc;
+    uint16_t mem_before;
+    uint16_t mem_after;
+    uint16_t mem_val;
+    uint16_t wb_val;
+    uint8_t  sim;               // TRACE_SIM_*
+    uint8_t  stage[5];
+    uint8_t  mem_op;            // opcode of the memory access, TRACE_STAGE_NONE if none
+    uint8_t  mem_flags;
+    uint8_t  wb_kind;
+    uint8_t  wb_reg;            // raw f1 field of the writing instruction
+    uint8_t  slot;              // issue lane (dual-issue pipeline writes one record per lane);
+                                // was reserved and zero, so older traces read as lane 0
+    uint8_t  reserved[3];
+} TraceRecord;
+
+// What -t keeps. Checked before a record is built, so filtered-out cycles
+// cost a compare; chunks and sims that are filtered out entirely are run
+// untraced (the threaded engine included).
+#define TRACE_TRIGGER_NONE     0
+#define TRACE_TRIGGER_LOAD_USE 1   // nothing is kept until the first load-use stall
+
+typedef struct {
+    long chunk_lo, chunk_hi;    // chunks to trace (inclusive)
+    unsigned sims;              // bit (1 << TRACE_SIM_*) per simulator to trace
+    long every;                 // keep cycles where cycle % every == 0
+    long pc_lo, pc_hi;          // keep PCs in [pc_lo, pc_hi]
+    int trigger;                // TRACE_TRIGGER_*
+    uint64_t max_records;       // stop after this many (0 = no limit; an instruction's two
+                                // single-cycle records, or a cycle's dual-issue lanes, are
+                                // kept together)
+    // Run state
+    int armed;                  // trigger set and not yet fired
+    uint64_t kept;
+} TraceFilter;
+
+// Keep everything
+void trace_filter_init(TraceFilter *f);
+
+static inline int trace_want(const TraceFilter *f, unsigned sim, long cycle, uint16_t pc) {
+    return !f->armed && (f->sims & (1u << sim)) &&
+           (f->every <= 1 || cycle % f->every == 0) &&
+           pc >= f->pc_lo && pc <= f->pc_hi &&
+           (f->max_records == 0 || f->kept < f->max_records);
+}
+
+typedef struct TraceWriter TraceWriter;
+
+// Open path for writing. TRACE_BIN starts a background thread that drains a
+// ring of record blocks to the file. Returns NULL on failure.
+TraceWriter *trace_open(const char *path, TraceFormat fmt, double t_single_ns, double t_pipe_ns);
+
+// Append one record (copied). Blocks only if the drain thread is a full ring behind.
+void trace_emit(TraceWriter *tw, const TraceRecord *r);
+
+// Flush, stop the drain thread and close. Returns 0 if a write failed.
+int trace_close(TraceWriter *tw);
+
+uint64_t trace_records(const TraceWriter *tw);
+long trace_stalls(const TraceWriter *tw);   // times the producer waited for the drain thread
+
+const char *trace_format_name(TraceFormat fmt);
+int trace_parse_format(const char *name, TraceFormat *out);
+
+// Read and check a TRACE_BIN header. Returns 0 if fp is not a trace this build can read.
+int trace_read_header(FILE *fp, TraceHeader *hdr);
+
+// Format r as one JSON line (with '\n'), t_clk_ns being its sim's clock period.
+// Returns the length, or 0 if cap is too small.
+int trace_format_jsonl(const TraceRecord *r, double t_clk_ns, char *out, size_t cap);
+
+const char *opcode_name(uint8_t op);
+
+#endif // TRACE_H
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "workpool.h"
+
+typedef struct {
+    WorkPool *pool;
+    void *arg;
+    pthread_t tid;
+} Worker;
+
+// Jobs live in a ring indexed by submission sequence number:
+// [head, next) are running or done, [next, tail) are waiting for a worker.
+struct WorkPool {
+    WorkFn fn;
+    int depth;
+    void **jobs;
+    int *done;
+    unsigned long head, next, tail;
+    int stopping;
+    int threads;
+    Worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;   // a job was queued, or the pool is stopping
+    pthread_cond_t done_cv;   // a job finished
+};
+
+static void *worker_main(void *p) {
+    Worker *w = p;
+    WorkPool *pool = w->pool;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->next == pool->tail && !pool->stopping) {
+            pthread_cond_wait(&pool->work_cv, &pool->lock);
+        }
+        if (pool->next == pool->tail) break;
+        unsigned long seq = pool->next++;
+        void *job = pool->jobs[seq % pool->depth];
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->fn(job, w->arg);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->done[seq % pool->depth] = 1;
+        pthread_cond_broadcast(&pool->done_cv);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+WorkPool *workpool_create(int threads, int depth, WorkFn fn, void **worker_args) {
+    if (threads < 1 || depth < 1) return NULL;
+    WorkPool *p = calloc(1, sizeof(*p));
+    if (!p) return NULL;
+    p->fn = fn;
+    p->depth = depth;
+    p->jobs = calloc((size_t)depth, sizeof(*p->jobs));
+    p->done = calloc((size_t)depth, sizeof(*p->done));
+    p->workers = calloc((size_t)threads, sizeof(*p->workers));
+    if (!p->jobs || !p->done || !p->workers) {
+        free(p->jobs); free(p->done); free(p->workers); free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work_cv, NULL);
+    pthread_cond_init(&p->done_cv, NULL);
+    for (int i = 0; i < threads; i++) {
+        p->workers[i].pool = p;
+        p->workers[i].arg = worker_args ? worker_args[i] : NULL;
+        if (pthread_create(&p->workers[i].tid, NULL, worker_main, &p->workers[i]) != 0) break;
+        p->threads++;
+    }
+    if (p->threads == 0) {
+        workpool_destroy(p);
+        return NULL;
+    }
+    return p;
+}
+
+int workpool_submit(WorkPool *p, void *job) {
+    pthread_mutex_lock(&p->lock);
+    if (p->tail - p->head >= (unsigned long)p->depth) {
+        pthread_mutex_unlock(&p->lock);
+        return 0;
+    }
+    p->jobs[p->tail % p->depth] = job;
+    p->done[p->tail % p->depth] = 0;
+    p->tail++;
+    pthread_cond_signal(&p->work_cv);
+    pthread_mutex_unlock(&p->lock);
+    return 1;
+}
+
+void *workpool_collect(WorkPool *p) {
+    void *job = NULL;
+    pthread_mutex_lock(&p->lock);
+    if (p->head != p->tail) {
+        while (!p->done[p->head % p->depth]) {
+            pthread_cond_wait(&p->done_cv, &p->lock);
+        }
+        job = p->jobs[p->head % p->depth];
+        p->head++;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return job;
+}
+
+int workpool_outstanding(WorkPool *p) {
+    pthread_mutex_lock(&p->lock);
+    int n = (int)(p->tail - p->head);
+    pthread_mutex_unlock(&p->lock);
+    return n;
+}
+
+void workpool_destroy(WorkPool *p) {
+    if (!p) return;
+    pthread_mutex_lock(&p->lock);
+    p->stopping = 1;
+    pthread_cond_broadcast(&p->work_cv);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->threads; i++) {
+        pthread_join(p->workers[i].tid, NULL);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work_cv);
+    pthread_cond_destroy(&p->done_cv);
+    free(p->jobs);
+    free(p->done);
+    free(p->workers);
+    free(p);
+}
+
+int workpool_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
@@ -0,0 +1,29 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+// Fixed set of worker threads running one function over submitted jobs.
+// Jobs may finish in any order but are collected strictly in submission order.
+typedef void (*WorkFn)(void *job, void *worker_arg);
+
+typedef struct WorkPool WorkPool;
+
+// Start `threads` workers; worker i is passed worker_args[i]. At most `depth`
+// jobs may be outstanding (submitted but not yet collected).
+WorkPool *workpool_create(int threads, int depth, WorkFn fn, void **worker_args);
+
+// Queue a job. Returns 0 (and does not queue it) if `depth` jobs are already outstanding.
+int workpool_submit(WorkPool *p, void *job);
+
+// Wait for the oldest outstanding job and return it; NULL if nothing is outstanding
+void *workpool_collect(WorkPool *p);
+
+// Jobs submitted but not yet collected
+int workpool_outstanding(WorkPool *p);
+
+// Finish outstanding jobs, stop the workers and free the pool
+void workpool_destroy(WorkPool *p);
+
+// Number of online CPUs (at least 1)
+int workpool_cpu_count(void);
+
+#endif // WORKPOOL_H